@@ -0,0 +1,382 @@
+/**
+ * file   : accesslog.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * access log of server_base: fixed size records, written and rotated by a thread of its own
+ */
+#pragma once
+#ifndef ACCESS_LOG_HTTP_HPP
+#define ACCESS_LOG_HTTP_HPP
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "ratelimit.hpp"
+
+namespace basiohttp
+{
+
+enum ACCESS_LOG_FORMAT
+{
+    access_text,    // one line per request, formatted by the writer thread
+    access_binary   // access_record as it is, 128 bytes per request
+};
+
+struct access_log_options
+{
+    string path;
+    ACCESS_LOG_FORMAT format;
+    size_t rotate_bytes;    // rotate once the file is this large, 0 never
+    size_t rotate_seconds;  // rotate once the file is this old, 0 never
+    size_t sample;          // log 1 in `sample` requests, 1 logs all
+    size_t flush_ms;        // the writer wakes up at least this often
+    size_t max_pending;     // records waiting for the writer, more are dropped
+
+    access_log_options(const string& path = "access.log"):
+        path(path),
+        format(access_text),
+        rotate_bytes(256 << 20),
+        rotate_seconds(0),
+        sample(1),
+        flush_ms(200),
+        max_pending(1 << 16)
+    {
+    }
+};
+
+
+// what io threads hand over, copied by value and formatted later
+struct access_record
+{
+    uint64_t time_us;       // wall clock when the response was ready
+    ip_key   peer;
+    uint64_t bytes;         // response size, headers included
+    uint32_t total_us;      // request head read to response ready
+    uint32_t handler_us;    // handler dispatched to response ready, offload and defer included
+    uint16_t status;
+    uint8_t  method_size;
+    uint8_t  path_size;     // path is cut at sizeof(path)
+    char     method[12];
+    char     path[72];
+};
+
+static_assert(sizeof(access_record) == 128, "access_record is a fixed 128 byte layout");
+
+
+// status code of a response as handlers write it, 0 if it does not start with a status line
+inline uint16_t response_status(const char* p, const size_t size)
+{
+    if (size < 12 or memcmp(p, "HTTP/", 5) != 0) {
+        return 0;
+    }
+    return (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+}
+
+inline uint16_t response_status(const boost::asio::streambuf& response)
+{
+    auto data = response.data();
+    return response_status(boost::asio::buffer_cast<const char*>(data), boost::asio::buffer_size(data));
+}
+
+
+// io threads append records to one of NUM_STRIPES buffers (picked by thread) under a short
+// lock, the writer thread swaps the buffers out, formats them and writes them with one
+// writev to an O_APPEND file. rotation happens on the writer thread only, and a writer that
+// falls behind makes records drop, never io threads wait.
+struct access_logger: public boost::noncopyable
+{
+    enum { NUM_STRIPES = 8 };
+
+    explicit access_logger(const access_log_options& opts):
+        __opts(opts),
+        __fd(-1),
+        __size(0),
+        __opened(0),
+        __sequence(0),
+        __written(0),
+        __dropped(0),
+        __stopping(false)
+    {
+        __opts.sample = max<size_t>(__opts.sample, 1);
+        __stripe_limit = max<size_t>(__opts.max_pending / NUM_STRIPES, 1);
+        open_file();
+        __writer = boost::thread([this]() { this->run(); });
+    }
+
+    ~access_logger(void)
+    {
+        stop();
+    }
+
+    // writes what is pending, then ends the writer
+    void stop(void)
+    {
+        {
+            boost::mutex::scoped_lock lock(__wake_mutex);
+            __stopping.store(true);
+            __wake.notify_one();
+        }
+        if (__writer.joinable()) {
+            __writer.join();
+        }
+        if (__fd >= 0) {
+            ::close(__fd);
+            __fd = -1;
+        }
+    }
+
+    inline bool sampled(void)
+    {
+        return __opts.sample == 1 or __sequence.fetch_add(1, boost::memory_order_relaxed) % __opts.sample == 0;
+    }
+
+    void commit(const ip_key& peer, const string& method, const string& path, const uint16_t status,
+                const uint64_t bytes, const uint64_t total_us, const uint64_t handler_us)
+    {
+        if (not sampled()) {
+            return;
+        }
+        access_record r;
+        r.time_us = realtime_us();
+        r.peer = peer;
+        r.bytes = bytes;
+        r.total_us = static_cast<uint32_t>(min<uint64_t>(total_us, 0xffffffff));
+        r.handler_us = static_cast<uint32_t>(min<uint64_t>(handler_us, 0xffffffff));
+        r.status = status;
+        r.method_size = static_cast<uint8_t>(min(method.size(), sizeof(r.method)));
+        r.path_size = static_cast<uint8_t>(min(path.size(), sizeof(r.path)));
+        memcpy(r.method, method.data(), r.method_size);
+        memcpy(r.path, path.data(), r.path_size);
+        memset(r.method + r.method_size, 0, sizeof(r.method) - r.method_size);
+        memset(r.path + r.path_size, 0, sizeof(r.path) - r.path_size);
+
+        stripe& s = __stripes[boost::hash<boost::thread::id>()(boost::this_thread::get_id()) % NUM_STRIPES];
+        size_t pending = 0;
+        {
+            boost::mutex::scoped_lock lock(s.mutex);
+            if (s.records.size() >= __stripe_limit) {
+                __dropped.fetch_add(1, boost::memory_order_relaxed);
+                return;
+            }
+            s.records.push_back(r);
+            pending = s.records.size();
+        }
+        // a stripe half full does not wait for the next flush_ms, a lost wakeup only delays
+        if (pending == __stripe_limit / 2) {
+            __wake.notify_one();
+        }
+    }
+
+    inline size_t written(void) const
+    {
+        return __written.load(boost::memory_order_relaxed);
+    }
+
+    inline size_t dropped(void) const
+    {
+        return __dropped.load(boost::memory_order_relaxed);
+    }
+
+    // one line as the text format writes it
+    static void format(const access_record& r, string& out)
+    {
+        char time[32];
+        const time_t seconds = r.time_us / 1000000;
+        struct tm parts;
+        gmtime_r(&seconds, &parts);
+        strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &parts);
+
+        unsigned char bytes[16];
+        memcpy(bytes, &r.peer.hi, 8);
+        memcpy(bytes + 8, &r.peer.lo, 8);
+        static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        char address[INET6_ADDRSTRLEN];
+        if (memcmp(bytes, mapped, sizeof(mapped)) == 0) {
+            inet_ntop(AF_INET, bytes + 12, address, sizeof(address));
+        }
+        else {
+            inet_ntop(AF_INET6, bytes, address, sizeof(address));
+        }
+
+        char line[256];
+        const int n = snprintf(line, sizeof(line), "%s.%06uZ %s %.*s %.*s %u %llu %u %u\n",
+                               time, static_cast<unsigned>(r.time_us % 1000000), address,
+                               static_cast<int>(r.method_size), r.method,
+                               static_cast<int>(r.path_size), r.path,
+                               static_cast<unsigned>(r.status), static_cast<unsigned long long>(r.bytes),
+                               r.total_us, r.handler_us);
+        out.append(line, min<size_t>(n, sizeof(line) - 1));
+    }
+
+protected:
+    struct stripe
+    {
+        boost::mutex mutex;
+        std::vector<access_record> records;
+        char pad[64];
+    };
+
+    static uint64_t realtime_us(void)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    void open_file(void)
+    {
+        __fd = ::open(__opts.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (__fd < 0) {
+            throw std::runtime_error("cannot open access log " + __opts.path + ": " + strerror(errno));
+        }
+        struct stat st;
+        __size = fstat(__fd, &st) == 0 ? st.st_size : 0;
+        __opened = time(0);
+    }
+
+    // the current file gets the time of rotation as suffix, a fresh one takes its place
+    void rotate(void)
+    {
+        char suffix[32];
+        const time_t now = time(0);
+        struct tm parts;
+        localtime_r(&now, &parts);
+        strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &parts);
+        string target = __opts.path + suffix;
+        for (size_t n = 1; ::access(target.c_str(), F_OK) == 0; ++n) {
+            target = __opts.path + suffix + "." + dtos(n);
+        }
+        if (::rename(__opts.path.c_str(), target.c_str()) != 0) {
+            return; //keep writing to the old file
+        }
+        const int old = __fd;
+        try {
+            open_file();
+            ::close(old);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "access_log: " << e.what() << "\n";
+            __fd = old;
+        }
+    }
+
+    bool write_all(std::vector<iovec>& iov)
+    {
+        size_t first = 0;
+        while (first < iov.size()) {
+            const int count = static_cast<int>(min<size_t>(iov.size() - first, IOV_MAX));
+            const ssize_t n = ::writev(__fd, &iov[first], count);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            __size += n;
+            size_t left = n;
+            while (first < iov.size() and left >= iov[first].iov_len) {
+                left -= iov[first].iov_len;
+                ++first;
+            }
+            if (left) {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+                iov[first].iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    void run(void)
+    {
+        std::vector<access_record> batches[NUM_STRIPES];
+        std::vector<iovec> iov;
+        string text;
+        for (;;) {
+            {
+                boost::mutex::scoped_lock lock(__wake_mutex);
+                if (not __stopping.load()) {
+                    __wake.timed_wait(lock, boost::posix_time::milliseconds(__opts.flush_ms));
+                }
+            }
+            const bool last = __stopping.load();
+
+            size_t count = 0;
+            for (size_t i = 0; i < NUM_STRIPES; ++i) {
+                batches[i].clear();
+                boost::mutex::scoped_lock lock(__stripes[i].mutex);
+                batches[i].swap(__stripes[i].records);
+                count += batches[i].size();
+            }
+
+            if (count) {
+                iov.clear();
+                if (__opts.format == access_binary) {
+                    for (auto& b : batches) {
+                        if (not b.empty()) {
+                            iov.push_back(iovec{b.data(), b.size() * sizeof(access_record)});
+                        }
+                    }
+                }
+                else {
+                    text.clear();
+                    for (auto& b : batches) {
+                        for (auto& r : b) {
+                            format(r, text);
+                        }
+                    }
+                    iov.push_back(iovec{&text[0], text.size()});
+                }
+                if (write_all(iov)) {
+                    __written.fetch_add(count, boost::memory_order_relaxed);
+                }
+                else {
+                    __dropped.fetch_add(count, boost::memory_order_relaxed);
+                }
+            }
+
+            if (__size > 0 and ((__opts.rotate_bytes and __size >= __opts.rotate_bytes) or
+                (__opts.rotate_seconds and static_cast<size_t>(time(0) - __opened) >= __opts.rotate_seconds))) {
+                rotate();
+            }
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    access_log_options __opts;
+    size_t   __stripe_limit;
+    int      __fd;
+    size_t   __size;
+    time_t   __opened;
+    stripe   __stripes[NUM_STRIPES];
+
+    boost::atomic<size_t> __sequence;
+    boost::atomic<size_t> __written;
+    boost::atomic<size_t> __dropped;
+
+    boost::atomic<bool> __stopping;
+    boost::mutex __wake_mutex;
+    boost::condition_variable __wake;
+    boost::thread __writer;
+};
+
+typedef boost::shared_ptr<access_logger> access_logger_ptr;
+
+}//basiohttp
+
+
+#endif//ACCESS_LOG_HTTP_HPP
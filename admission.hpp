@@ -0,0 +1,162 @@
+/**
+ * file   : admission.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * admission control and overload shedding for server_base
+ */
+#pragma once
+#ifndef ADMISSION_HTTP_HPP
+#define ADMISSION_HTTP_HPP
+#include <cmath>
+#include <cstdint>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/chrono.hpp>
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+struct admission_options
+{
+    size_t max_connections;     // open sockets incl. the pending accept, accept pauses at the limit
+    size_t max_inflight;        // requests between parsed and written, beyond that 503
+    size_t codel_target_us;     // acceptable queue delay of a request, 0 disables shedding
+    size_t codel_interval_us;   // delay stays above target this long before shedding, paces it too
+
+    admission_options(void):
+        max_connections(0),
+        max_inflight(0),
+        codel_target_us(0),
+        codel_interval_us(100000)
+    {
+        //all limits are 0 (unlimited) by default
+    }
+};
+
+
+inline uint64_t steady_us(void)
+{
+    using namespace boost::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// codel (rfc 8289) over the queue delay of each request as it is admitted. a delay above target
+// is fine as a burst, once it has stayed above target for a whole interval the queue is standing:
+// one request is shed, then the next one interval/sqrt(count) later, count growing with each
+// shed, until a request gets through below target. a queue that stands again soon after resumes
+// at about the count it left with. shared by all io threads: requests below target while
+// nothing is tracked only read one flag, the state is under a mutex otherwise
+struct codel_shedder
+{
+    codel_shedder(void):
+        __tracking(false),
+        __shed(0),
+        __first_above(0),
+        __drop_next(0),
+        __count(0),
+        __lastcount(0),
+        __dropping(false)
+    {
+    }
+
+    inline bool admit(const uint64_t sojourn_us, const uint64_t now_us, const admission_options& opts)
+    {
+        const bool below = sojourn_us < opts.codel_target_us;
+        if (below and not __tracking.load(boost::memory_order_relaxed)) {
+            return true;
+        }
+        boost::mutex::scoped_lock lock(__mutex);
+        if (below) {
+            __first_above = 0;
+            __dropping = false;
+            __tracking.store(false, boost::memory_order_relaxed);
+            return true;
+        }
+        __tracking.store(true, boost::memory_order_relaxed);
+        if (__first_above == 0) {
+            __first_above = now_us + opts.codel_interval_us;
+            return true;
+        }
+        if (now_us < __first_above) {
+            return true;
+        }
+        if (__dropping) {
+            if (now_us < __drop_next) {
+                return true;
+            }
+            ++__count;
+            __drop_next = control_law(__drop_next, opts);
+        }
+        else {
+            // dropping again soon after the last time, the queue likely needs about as many
+            const uint32_t delta = __count - __lastcount;
+            __count = delta > 1 and now_us < __drop_next + 16 * opts.codel_interval_us ? delta : 1;
+            __lastcount = __count;
+            __drop_next = control_law(now_us, opts);
+            __dropping = true;
+        }
+        __shed.fetch_add(1, boost::memory_order_relaxed);
+        return false;
+    }
+
+    inline uint64_t control_law(const uint64_t t, const admission_options& opts) const
+    {
+        return t + uint64_t(opts.codel_interval_us / std::sqrt(double(__count)));
+    }
+
+    boost::atomic<bool>     __tracking;     // a delay above target has been seen, not yet one below
+    boost::atomic<size_t>   __shed;
+    boost::mutex            __mutex;
+    uint64_t                __first_above;  // the delay is standing once now passes this
+    uint64_t                __drop_next;    // the next shed is due then
+    uint32_t                __count;        // sheds since dropping began
+    uint32_t                __lastcount;    // __count when dropping began the last time
+    bool                    __dropping;
+};
+
+
+// concurrency limit of one route (regex), see server_base::set_route_limit
+struct route_limit
+{
+    explicit route_limit(const size_t limit = 0):__limit(limit), __active(0)
+    {
+    }
+
+    inline bool acquire(void)
+    {
+        if (__active.fetch_add(1, boost::memory_order_relaxed) >= __limit) {
+            __active.fetch_sub(1, boost::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    inline void release(void)
+    {
+        __active.fetch_sub(1, boost::memory_order_relaxed);
+    }
+
+    size_t __limit;
+    boost::atomic<size_t> __active;
+};
+
+
+// counters, readable at any time
+struct admission_stats
+{
+    boost::atomic<size_t> connections;  // open sockets
+    boost::atomic<size_t> inflight;     // requests being handled
+    boost::atomic<size_t> rejected;     // 503 for any reason
+    boost::atomic<size_t> limited;      // 429, client over its rate limit
+
+    admission_stats(void):connections(0), inflight(0), rejected(0), limited(0)
+    {
+    }
+};
+
+}//basiohttp
+
+
+#endif//ADMISSION_HTTP_HPP
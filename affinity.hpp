@@ -0,0 +1,300 @@
+/**
+ * file   : affinity.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * numa topology from sysfs, pinning of io threads, per node instances of shared data
+ */
+#pragma once
+#ifndef AFFINITY_HTTP_HPP
+#define AFFINITY_HTTP_HPP
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#include <sched.h>
+#include <pthread.h>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+// "0-3,8,10-11" as in /sys/devices/system/node/node*/cpulist
+inline std::vector<int> parse_cpulist(const string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        char* end = nullptr;
+        const long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long c = first; c <= last; ++c) {
+            cpus.push_back(static_cast<int>(c));
+        }
+        while (*p == ',' or *p == '\n' or *p == ' ') {
+            ++p;
+        }
+    }
+    return cpus;
+}
+
+
+// the nodes and cpus this process may run on. without /sys/devices/system/node (no numa
+// kernel, containers) all allowed cpus form one node
+struct cpu_topology
+{
+    struct node
+    {
+        int id;                 // kernel node number
+        std::vector<int> cpus;
+    };
+
+    std::vector<node> nodes;
+    std::vector<int>  node_of;  // cpu -> index into nodes, -1 if not allowed
+
+    static const cpu_topology& system(void)
+    {
+        static const cpu_topology topology = probe();
+        return topology;
+    }
+
+    // index into nodes of the node of `cpu`, 0 if unknown
+    inline size_t node_index(const int cpu) const
+    {
+        return cpu >= 0 and static_cast<size_t>(cpu) < node_of.size() and node_of[cpu] >= 0 ? node_of[cpu] : 0;
+    }
+
+    size_t num_cpus(void) const
+    {
+        size_t n = 0;
+        for (auto& nd : nodes) {
+            n += nd.cpus.size();
+        }
+        return n;
+    }
+
+    static cpu_topology probe(void)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                CPU_SET(c, &allowed);
+            }
+        }
+
+        cpu_topology t;
+        boost::system::error_code ec;
+        const boost::filesystem::path root("/sys/devices/system/node");
+        for (int id = 0; boost::filesystem::exists(root / ("node" + dtos(id)), ec); ++id) {
+            std::ifstream in((root / ("node" + dtos(id)) / "cpulist").string());
+            string list;
+            std::getline(in, list);
+            node nd;
+            nd.id = id;
+            for (const int c : parse_cpulist(list)) {
+                if (c < CPU_SETSIZE and CPU_ISSET(c, &allowed)) {
+                    nd.cpus.push_back(c);
+                }
+            }
+            if (not nd.cpus.empty()) {
+                t.nodes.push_back(nd);
+            }
+        }
+        if (t.nodes.empty()) {
+            node nd;
+            nd.id = 0;
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &allowed)) {
+                    nd.cpus.push_back(c);
+                }
+            }
+            t.nodes.push_back(nd);
+        }
+        for (size_t i = 0; i < t.nodes.size(); ++i) {
+            for (const int c : t.nodes[i].cpus) {
+                if (static_cast<size_t>(c) >= t.node_of.size()) {
+                    t.node_of.resize(c + 1, -1);
+                }
+                t.node_of[c] = static_cast<int>(i);
+            }
+        }
+        return t;
+    }
+};
+
+
+enum AFFINITY_POLICY
+{
+    affinity_none,      // threads float, the default
+    affinity_compact,   // thread i on the i-th cpu, a node is filled before the next is used
+    affinity_scatter,   // threads dealt round robin over the nodes, cpus in order within a node
+    affinity_cpus       // thread i on cpus[i % cpus.size()]
+};
+
+struct affinity_options
+{
+    AFFINITY_POLICY  policy;
+    std::vector<int> cpus;      // for affinity_cpus
+    std::vector<int> nodes;     // kernel node numbers compact and scatter may use, empty all
+    bool incoming_cpu;          // io_uring backend: each ring accepts on a listener of its own
+                                // with SO_INCOMING_CPU, connections stay on the receiving core
+
+    affinity_options(const AFFINITY_POLICY policy = affinity_none):
+        policy(policy),
+        incoming_cpu(false)
+    {
+    }
+};
+
+
+// cpu of each of `num_threads` io threads, -1 where a thread is not pinned
+inline std::vector<int> plan_affinity(const affinity_options& opts, const size_t num_threads,
+                                      const cpu_topology& topology = cpu_topology::system())
+{
+    std::vector<int> plan(num_threads, -1);
+    if (opts.policy == affinity_none or num_threads == 0) {
+        return plan;
+    }
+    if (opts.policy == affinity_cpus) {
+        for (size_t i = 0; not opts.cpus.empty() and i < num_threads; ++i) {
+            plan[i] = opts.cpus[i % opts.cpus.size()];
+        }
+        return plan;
+    }
+
+    std::vector<const cpu_topology::node*> nodes;
+    for (auto& nd : topology.nodes) {
+        if (opts.nodes.empty() or std::find(opts.nodes.begin(), opts.nodes.end(), nd.id) != opts.nodes.end()) {
+            nodes.push_back(&nd);
+        }
+    }
+    if (nodes.empty()) {
+        return plan;
+    }
+    std::vector<int> order;
+    if (opts.policy == affinity_compact) {
+        for (auto nd : nodes) {
+            order.insert(order.end(), nd->cpus.begin(), nd->cpus.end());
+        }
+    }
+    else {
+        for (size_t k = 0; order.size() < num_threads; ++k) {
+            bool any = false;
+            for (auto nd : nodes) {
+                if (k < nd->cpus.size()) {
+                    order.push_back(nd->cpus[k]);
+                    any = true;
+                }
+            }
+            if (not any) {
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        plan[i] = order[i % order.size()];  //more threads than cpus wrap around
+    }
+    return plan;
+}
+
+
+// cpu the calling thread was pinned to by pin_thread(), -1 if none
+inline int& pinned_cpu(void)
+{
+    static thread_local int cpu = -1;
+    return cpu;
+}
+
+// pins the calling thread to `cpu`, nothing for -1. memory the thread touches first is then
+// allocated on its node, so pin before allocating per thread state
+inline bool pin_thread(const int cpu)
+{
+    if (cpu < 0 or cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+    pinned_cpu() = cpu;
+    return true;
+}
+
+// index into cpu_topology::system().nodes of the node the calling thread runs on
+inline size_t current_node(void)
+{
+    const int cpu = pinned_cpu() >= 0 ? pinned_cpu() : sched_getcpu();
+    return cpu_topology::system().node_index(cpu);
+}
+
+
+// one T per numa node, e.g. replicas or shards of hot cache data. the instance of a node is
+// made by the first thread of that node calling local(), so its memory is on that node too
+template<typename T>
+struct node_local: public boost::noncopyable
+{
+    node_local(void):
+        __instances(cpu_topology::system().nodes.size())
+    {
+        for (auto& p : __instances) {
+            p.store(nullptr);
+        }
+    }
+
+    ~node_local(void)
+    {
+        for (auto& p : __instances) {
+            delete p.load();
+        }
+    }
+
+    T& local(void)
+    {
+        return at(current_node());
+    }
+
+    T& at(const size_t node)
+    {
+        auto& slot = __instances[node % __instances.size()];
+        T* p = slot.load(boost::memory_order_acquire);
+        if (not p) {
+            boost::mutex::scoped_lock lock(__mutex);
+            p = slot.load(boost::memory_order_acquire);
+            if (not p) {
+                p = new T;
+                slot.store(p, boost::memory_order_release);
+            }
+        }
+        return *p;
+    }
+
+    inline size_t size(void) const
+    {
+        return __instances.size();
+    }
+
+protected:
+    std::vector<boost::atomic<T*>> __instances;
+    boost::mutex __mutex;
+};
+
+}//basiohttp
+
+
+#endif//AFFINITY_HTTP_HPP
@@ -0,0 +1,473 @@
+/**
+ * file   : assetpack.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * immutable static asset pack: one mmaped file holding bodies, preformatted headers, etags
+ * and a minimal perfect hash index of paths. build it with mkpack, serve it with pack_handler.
+ */
+#pragma once
+#ifndef ASSET_PACK_HTTP_HPP
+#define ASSET_PACK_HTTP_HPP
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <zlib.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "reply.hpp"
+#include "crc.hpp"
+
+namespace basiohttp
+{
+
+//// on disk layout //////////////////////////////////////////////////////////////////////////////
+// [pack_header][uint32 seeds x num_buckets][pack_entry x count][blobs...]
+// all offsets are from the start of the file, all integers are host endian.
+const char PACK_MAGIC[8] = {'B','A','S','P','A','C','K','1'};
+
+struct pack_header
+{
+    char     magic[8];
+    uint32_t count;         // number of assets, also number of index slots
+    uint32_t num_buckets;   // displacement seeds of the perfect hash
+    uint64_t seeds_offset;
+    uint64_t entries_offset;
+    uint64_t file_size;     // catches truncated packs
+};
+
+struct pack_blob
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct pack_entry
+{
+    uint64_t  hash;         // pack_hash of path
+    pack_blob path;         // relative to the packed directory, e.g. "css/site.css"
+    pack_blob etag;         // quoted, e.g. "\"1a2b3c4d-4f2\""
+    pack_blob head;         // entity headers of the identity body, ends with a blank line
+    pack_blob body;
+    pack_blob gzip_head;    // size 0 if the asset was not precompressed
+    pack_blob gzip_body;
+};
+
+inline uint64_t pack_hash(const char* s, const size_t n)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ uint8_t(s[i])) * 1099511628211ull;
+    }
+    return h;
+}
+
+// slot of a key inside its bucket's displacement, splitmix64 finalizer
+inline uint32_t pack_slot(const uint64_t hash, const uint32_t seed, const uint32_t count)
+{
+    uint64_t z = hash + (uint64_t(seed) + 1) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return uint32_t((z ^ (z >> 31)) % count);
+}
+
+
+//// reader //////////////////////////////////////////////////////////////////////////////////////
+struct asset_pack: public boost::noncopyable
+{
+    asset_pack(void):__mapped(nullptr), __size(0), __header(nullptr), __seeds(nullptr), __entries(nullptr)
+    {
+    }
+
+    ~asset_pack(void)
+    {
+        if (__mapped) {
+            ::munmap(__mapped, __size);
+        }
+    }
+
+    // maps the whole pack and faults it in, so requests never touch the disk
+    bool open(const string& filename)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 or size_t(st.st_size) < sizeof(pack_header)) {
+            ::close(fd);
+            return false;
+        }
+        void* p = ::mmap(0, st.st_size, PROT_READ, MAP_SHARED|MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        __mapped = static_cast<char*>(p);
+        __size = st.st_size;
+        __header = reinterpret_cast<const pack_header*>(__mapped);
+
+        if (memcmp(__header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 or
+            __header->file_size != __size or
+            __header->num_buckets == 0 or
+            __header->seeds_offset + __header->num_buckets * sizeof(uint32_t) > __size or
+            __header->entries_offset + __header->count * sizeof(pack_entry) > __size) {
+            return false;
+        }
+        __seeds = reinterpret_cast<const uint32_t*>(__mapped + __header->seeds_offset);
+        __entries = reinterpret_cast<const pack_entry*>(__mapped + __header->entries_offset);
+        ::madvise(__mapped, __size, MADV_WILLNEED);
+        return true;
+    }
+
+    // nullptr if the path is not in the pack
+    const pack_entry* find(const char* path, const size_t n) const
+    {
+        if (not __entries or not __header->count) {
+            return nullptr;
+        }
+        const uint64_t h = pack_hash(path, n);
+        const uint32_t seed = __seeds[h % __header->num_buckets];
+        const pack_entry* e = __entries + pack_slot(h, seed, __header->count);
+        if (e->hash != h or e->path.size != n or memcmp(data(e->path), path, n) != 0) {
+            return nullptr;
+        }
+        return e;
+    }
+
+    inline const pack_entry* find(const string& path) const
+    {
+        return find(path.data(), path.size());
+    }
+
+    inline const char* data(const pack_blob& blob) const
+    {
+        return __mapped + blob.offset;
+    }
+
+    inline size_t count(void) const
+    {
+        return __header ? __header->count : 0;
+    }
+
+    char*  __mapped;
+    size_t __size;
+    const pack_header* __header;
+    const uint32_t*    __seeds;
+    const pack_entry*  __entries;
+};
+
+typedef boost::shared_ptr<asset_pack> asset_pack_ptr;
+
+
+// holds the live pack, a deploy is an atomic rename of the pack file followed by reload()
+struct asset_store
+{
+    bool reload(const string& filename)
+    {
+        asset_pack_ptr fresh(new asset_pack);
+        if (not fresh->open(filename)) {
+            return false;
+        }
+        boost::atomic_store(&__current, fresh);
+        return true;
+    }
+
+    // in flight requests keep the old mapping alive until they are done with it
+    inline asset_pack_ptr get(void) const
+    {
+        return boost::atomic_load(&__current);
+    }
+
+    asset_pack_ptr __current;
+};
+
+
+// whether an If-None-Match value lists `etag`: "*", or one of its comma separated entity tags
+// equal to it, a weak W/ prefix is ignored as the comparison for GET is the weak one
+inline bool etag_listed(const string& tags, const string& etag)
+{
+    size_t i = 0;
+    while (i < tags.size()) {
+        if (tags[i] == ' ' or tags[i] == '\t' or tags[i] == ',') {
+            ++i;
+            continue;
+        }
+        if (tags.compare(i, 2, "W/") == 0) {
+            i += 2;
+        }
+        size_t end;
+        if (i < tags.size() and tags[i] == '"') {
+            end = tags.find('"', i + 1);
+            end = end == string::npos ? tags.size() : end + 1;
+        } else {
+            end = std::min(tags.find(',', i), tags.size());
+        }
+        size_t last = end;
+        while (last > i and (tags[last - 1] == ' ' or tags[last - 1] == '\t')) {
+            --last;
+        }
+        if (tags.compare(i, last - i, "*") == 0 or tags.compare(i, last - i, etag) == 0) {
+            return true;
+        }
+        i = end;
+    }
+    return false;
+}
+
+
+// serves r->match1 out of the pack: 200, 304 on a matching If-None-Match, or 404.
+// a path ending in '/' (or empty) maps to its index.html
+inline handler_for_server pack_handler(asset_store& store)
+{
+    return [&store](streambuf_ptr resbuf, request_ptr r) {
+        static const string not_found_body = "<html><h1>404 Not Found</h1></html>";
+        auto pack = store.get();
+        const pack_entry* e = nullptr;
+
+        if (pack) {
+            if (r->match1.empty() or *r->match1.rbegin() == '/') {
+                e = pack->find(r->match1 + "index.html");
+            } else {
+                e = pack->find(r->match1);
+            }
+        }
+        if (not e) {
+            header_builder(*resbuf).status(not_found)
+                                   .content_type(mime_html)
+                                   .content_length(not_found_body.size())
+                                   .end();
+            resbuf->sputn(not_found_body.data(), not_found_body.size());
+            return;
+        }
+
+        bool gzip = false;
+        if (e->gzip_body.size) {
+            auto ae = r->header.find("Accept-Encoding");
+            gzip = ae != r->header.end() and ae->second.find("gzip") != string::npos;
+        }
+
+        auto inm = r->header.find("If-None-Match");
+        if (inm != r->header.end()) {
+            // a client may hold either variant, the 304 names the one it would get now
+            const string& tags = inm->second;
+            const string etag(pack->data(e->etag), e->etag.size);
+            string gztag;
+            if (e->gzip_body.size) {
+                gztag = etag;
+                gztag.insert(gztag.size() - 1, "-gz");
+            }
+            if (etag_listed(tags, etag) or (not gztag.empty() and etag_listed(tags, gztag))) {
+                header_builder h(*resbuf);
+                h.status(not_modified).header("ETag", gzip ? gztag : etag);
+                if (not gztag.empty()) {
+                    h.header("Vary", "Accept-Encoding");
+                }
+                h.end();
+                return;
+            }
+        }
+
+        const pack_blob& head = gzip ? e->gzip_head : e->head;
+        const pack_blob& body = gzip ? e->gzip_body : e->body;
+        header_builder(*resbuf).status(ok).write(pack->data(head), head.size);
+        resbuf->sputn(pack->data(body), body.size);
+    };
+}
+
+
+//// writer //////////////////////////////////////////////////////////////////////////////////////
+// types worth precompressing, images and archives are compressed already
+inline bool pack_compressible(const string& type)
+{
+    return type.compare(0, 5, "text/") == 0 or
+           type.find("javascript") != string::npos or
+           type.find("json") != string::npos or
+           type.find("xml") != string::npos or
+           type.find("wasm") != string::npos;
+}
+
+inline bool gzip_compress(const string& in, string& out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&zs, in.size()) + 32);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+// packs every regular file under `dir` into `packfile`. the pack is written next to the target
+// and renamed over it, so a running server never sees a half written file.
+// returns number of assets packed, throws std::runtime_error on io errors.
+inline size_t build_asset_pack(const string& dir, const string& packfile, const bool precompress)
+{
+    namespace fs = boost::filesystem;
+
+    struct item
+    {
+        string path, etag, head, body, gzip_head, gzip_body;
+        uint64_t hash;
+    };
+    std::vector<item> items;
+    crc_calculator crc;
+    const fs::path root(dir);
+
+    for (fs::recursive_directory_iterator it(root), end; it != end; ++it) {
+        if (not fs::is_regular_file(it->status())) {
+            continue;
+        }
+        item a;
+        a.path = it->path().generic_string().substr(root.generic_string().size());
+        while (not a.path.empty() and a.path[0] == '/') {
+            a.path.erase(0, 1);
+        }
+        std::ifstream in(it->path().string(), std::ios::binary);
+        a.body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (in.bad()) {
+            throw std::runtime_error("can not read " + it->path().string());
+        }
+        a.hash = pack_hash(a.path.data(), a.path.size());
+
+        char tag[48];
+        snprintf(tag, sizeof(tag), "\"%08x-%zx\"", crc.crc32(a.body.data(), a.body.size()), a.body.size());
+        a.etag = tag;
+
+        const string& type = path_to_type(a.path);
+        if (precompress and pack_compressible(type) and gzip_compress(a.body, a.gzip_body) and
+            a.gzip_body.size() < a.body.size() * 9 / 10) {
+            string gztag = a.etag;
+            gztag.insert(gztag.size() - 1, "-gz");
+            a.gzip_head = "Content-Type: " + type + "\r\n"
+                          "Content-Encoding: gzip\r\n"
+                          "Content-Length: " + dtos(a.gzip_body.size()) + "\r\n"
+                          "ETag: " + gztag + "\r\n"
+                          "Vary: Accept-Encoding\r\n\r\n";
+        } else {
+            a.gzip_body.clear();
+        }
+        a.head = "Content-Type: " + type + "\r\n"
+                 "Content-Length: " + dtos(a.body.size()) + "\r\n"
+                 "ETag: " + a.etag + "\r\n" +
+                 (a.gzip_body.empty() ? "" : "Vary: Accept-Encoding\r\n") + "\r\n";
+        items.push_back(std::move(a));
+    }
+
+    // hash and displace: buckets of ~4 keys, biggest first, each gets the first seed that
+    // lands all its keys on free slots. this gives a minimal perfect hash of `count` slots.
+    const uint32_t count = items.size();
+    const uint32_t num_buckets = max<uint32_t>(1, (count + 3) / 4);
+    std::vector<std::vector<uint32_t>> buckets(num_buckets);
+    for (uint32_t i = 0; i < count; ++i) {
+        buckets[items[i].hash % num_buckets].push_back(i);
+    }
+    std::vector<uint32_t> order(num_buckets);
+    for (uint32_t b = 0; b < num_buckets; ++b) {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t x, uint32_t y) {
+        return buckets[x].size() > buckets[y].size();
+    });
+
+    std::vector<uint32_t> seeds(num_buckets, 0);
+    std::vector<int64_t> slots(count, -1);
+    std::vector<uint32_t> tried;
+    for (auto b : order) {
+        if (buckets[b].empty()) {
+            continue;
+        }
+        for (uint32_t seed = 0; ; ++seed) {
+            if (seed == (1u << 26)) {
+                throw std::runtime_error("perfect hash failed, duplicate paths?");
+            }
+            tried.clear();
+            bool fits = true;
+            for (auto i : buckets[b]) {
+                uint32_t s = pack_slot(items[i].hash, seed, count);
+                if (slots[s] >= 0 or std::find(tried.begin(), tried.end(), s) != tried.end()) {
+                    fits = false;
+                    break;
+                }
+                tried.push_back(s);
+            }
+            if (fits) {
+                for (size_t k = 0; k < tried.size(); ++k) {
+                    slots[tried[k]] = buckets[b][k];
+                }
+                seeds[b] = seed;
+                break;
+            }
+        }
+    }
+
+    // lay out header, seeds, entries, then blobs
+    pack_header header;
+    memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.count = count;
+    header.num_buckets = num_buckets;
+    header.seeds_offset = sizeof(pack_header);
+    header.entries_offset = (header.seeds_offset + num_buckets * sizeof(uint32_t) + 7) & ~uint64_t(7);
+
+    string blobs;
+    uint64_t blobs_offset = header.entries_offset + uint64_t(count) * sizeof(pack_entry);
+    auto put = [&blobs, blobs_offset](const string& s) {
+        pack_blob blob = { blobs_offset + blobs.size(), s.size() };
+        blobs += s;
+        return blob;
+    };
+    std::vector<pack_entry> entries(count);
+    for (uint32_t s = 0; s < count; ++s) {
+        const item& a = items[slots[s]];
+        pack_entry& e = entries[s];
+        e.hash = a.hash;
+        e.path = put(a.path);
+        e.etag = put(a.etag);
+        e.head = put(a.head);
+        e.body = put(a.body);
+        e.gzip_head = put(a.gzip_head);
+        e.gzip_body = put(a.gzip_body);
+    }
+    header.file_size = blobs_offset + blobs.size();
+
+    const string tmpfile = packfile + ".tmp";
+    {
+        std::ofstream out(tmpfile, std::ios::binary|std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(seeds.data()), seeds.size() * sizeof(uint32_t));
+        const string pad(header.entries_offset - header.seeds_offset - seeds.size() * sizeof(uint32_t), 0);
+        out.write(pad.data(), pad.size());
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(pack_entry));
+        out.write(blobs.data(), blobs.size());
+        out.flush();
+        if (not out) {
+            throw std::runtime_error("can not write " + tmpfile);
+        }
+    }
+    if (::rename(tmpfile.c_str(), packfile.c_str()) != 0) {
+        throw std::runtime_error("can not rename " + tmpfile + " to " + packfile);
+    }
+    return count;
+}
+
+}//basiohttp
+
+
+#endif//ASSET_PACK_HTTP_HPP
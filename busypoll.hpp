@@ -0,0 +1,108 @@
+/**
+ * file   : busypoll.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * accounting of io threads that spin before they block, see server_base::set_busy_poll
+ */
+#pragma once
+#ifndef BUSY_POLL_HTTP_HPP
+#define BUSY_POLL_HTTP_HPP
+#include <cstdint>
+#include <sched.h>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include "admission.hpp"
+
+namespace basiohttp
+{
+
+// summed over all io threads, microseconds
+struct busy_poll_stats
+{
+    boost::atomic<uint64_t> spin_us;    // polling without finding anything to do
+    boost::atomic<uint64_t> work_us;    // running what a poll found
+    boost::atomic<uint64_t> polls;      // non-blocking polls
+    boost::atomic<uint64_t> blocks;     // budget used up, the thread went to sleep in the kernel
+
+    busy_poll_stats(void):spin_us(0), work_us(0), polls(0), blocks(0)
+    {
+    }
+};
+
+
+// one per io thread, counts locally and adds to the shared stats every FLUSH_EVERY polls and
+// before the thread blocks, so spinning threads do not bounce a cache line between them
+struct busy_poll_meter: public boost::noncopyable
+{
+    enum { FLUSH_EVERY = 4096 };
+
+    busy_poll_meter(busy_poll_stats& stats, const uint64_t budget_us):
+        __stats(stats),
+        __budget_us(budget_us),
+        __idle_since(steady_us()),
+        __spin_us(0),
+        __work_us(0),
+        __polls(0)
+    {
+    }
+
+    ~busy_poll_meter(void)
+    {
+        flush();
+    }
+
+    // true while an idle thread should go on polling
+    inline bool spinning(const uint64_t now) const
+    {
+        return now - __idle_since < __budget_us;
+    }
+
+    // a poll from `begin` to `end` that found `found` things to do, an empty one gives up the cpu
+    inline void polled(const uint64_t begin, const uint64_t end, const size_t found)
+    {
+        if (found) {
+            __work_us += end - begin;
+            __idle_since = end;
+        }
+        else {
+            __spin_us += end - begin;
+            sched_yield(); //threads sharing the core, the peer that sends the work among them, go first
+        }
+        if (++__polls % FLUSH_EVERY == 0) {
+            flush();
+        }
+    }
+
+    inline void blocking(void)
+    {
+        flush();
+        __stats.blocks.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // the blocking wait returned with work, spin again from here
+    inline void woken(const uint64_t now)
+    {
+        __idle_since = now;
+    }
+
+    void flush(void)
+    {
+        __stats.spin_us.fetch_add(__spin_us, boost::memory_order_relaxed);
+        __stats.work_us.fetch_add(__work_us, boost::memory_order_relaxed);
+        __stats.polls.fetch_add(__polls, boost::memory_order_relaxed);
+        __spin_us = __work_us = __polls = 0;
+    }
+
+protected:
+    busy_poll_stats& __stats;
+    uint64_t __budget_us;
+    uint64_t __idle_since;
+    uint64_t __spin_us;
+    uint64_t __work_us;
+    uint64_t __polls;
+};
+
+}//basiohttp
+
+
+#endif//BUSY_POLL_HTTP_HPP
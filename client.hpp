@@ -14,53 +14,64 @@
 #include <boost/atomic.hpp>
 #include "utils.hpp"
 #include "typedefs.hpp"
+#include "dnscache.hpp"
+#include "tls.hpp"
 
 namespace basiohttp
 {
 
 struct client
 {
+    enum { CONNECT_STAGGER_MS = 250 };  // before the next address is tried alongside
+
     client(void) = delete; //no default constructor
 
+    // https goes through client_tls::shared(), `port` empty means the one of the scheme
     client(asio_service& io_service,
            handler_for_client& response_handler,
            const string& host,
            const string& path,
-           const string method = "GET") //only support GET and HEAD
+           const string method = "GET", //only support GET and HEAD
+           const bool https = false,
+           const string& port = string())
     try :
-        __url("http://" + host + path),
+        __url((https ? "https://" : "http://") + host + (port.empty() ? "" : ":" + port) + path),
         __socket(io_service),
-        __resolver(io_service),
+        __host(host),
+        __session_key(host + ":" + (port.empty() ? (https ? "443" : "80") : port)),
         __data(new _response),
         __timer(new boost::asio::deadline_timer(io_service)),
         __user_handler(response_handler),
         __finished(false)
     {
+        if (https) {
+            __tls.reset(new asio_https(io_service, client_tls::shared().context()));
+        }
         using boost::replace_first_copy;
-        // connection callback to each endpoint here until we successfully establish a connection.
-        auto resolve_cb = [this](const error_code& err, asio_resolver::iterator endpoint_iterator){
+        // race the addresses of the host, the first to connect gets the request
+        auto resolve_cb = [this](const error_code& err, const endpoint_list& endpoints){
             if (not err) {
-               boost::asio::async_connect(this->__socket, endpoint_iterator,
-                   [this](const error_code& _err, asio_resolver::iterator endpoint_iterator){
+               connect_race::start(this->tcp(), endpoints, CONNECT_STAGGER_MS,
+                   [this](const error_code& _err){
                        this->handle_connect(_err);
                    }
                );
            }
            else {
                std::cerr << "Error: " << err.message() << "\n";
-               this->__socket.lowest_layer().shutdown(asio_socket::shutdown_both);
-               this->__socket.lowest_layer().close();
+               error_code ignored;
+               this->tcp().close(ignored);
            }
         };
 
-        asio_resolver::query query(host, "http");
         ostream reqos(&__reqbuf);
 
+        const string host_header = port.empty() ? host : host + ":" + port;
         if (method == "GET") {
-            reqos << sreplace(templates::get, {"$path", path}, {"$host", host});
+            reqos << sreplace(templates::get, {"$path", path}, {"$host", host_header});
         }
         else if (method == "HEAD") {
-            reqos << sreplace(templates::head, {"$path", path}, {"$host", host});
+            reqos << sreplace(templates::head, {"$path", path}, {"$host", host_header});
         }
         else if (method == "POST") {
             throw std::runtime_error("POST not support now!");
@@ -68,7 +79,8 @@ struct client
         else  {
             throw std::runtime_error("method not correct!");
         }
-        __resolver.async_resolve(query, resolve_cb);
+        // shared by all clients, a burst of fetches from one host makes one lookup
+        dns_cache::shared().resolve(io_service, host, port.empty() ? (https ? "https" : "http") : port, resolve_cb);
     }
     catch (const std::exception& e) {
         std::cout << __func__ << "Exception: " << e.what() << "\n";
@@ -83,18 +95,77 @@ struct client
     {
     }
 
+    // the tcp connection, under the tls stream for https
+    inline asio_socket& tcp(void)
+    {
+        return __tls ? __tls->next_layer() : __socket;
+    }
+
     void handle_connect(const error_code& err)
     {
-        if (not err) {
-            // the connection was successful, send the request.
-            boost::asio::async_write(__socket, __reqbuf,
-                [this](const error_code& _err, const size_t& _nbytes) {
-                    this->handle_write_request(_err, _nbytes, this->__timer);
+        if (err) {
+            std::cerr << __func__ << " Error : " << err.message() << "\n";
+            return;
+        }
+        if (not __tls) {
+            send_request();
+            return;
+        }
+        // resumes the last session with this host if there is one
+        client_tls::shared().prepare(*__tls, __host, &__session_key);
+        __tls->async_handshake(boost::asio::ssl::stream_base::client,
+            [this](const error_code& _err) {
+                if (_err) {
+                    std::cerr << "handle_handshake Error : " << _err.message() << "\n";
+                    client_tls::shared().forget(this->__session_key);
+                    return;
                 }
-            );
+                client_tls::shared().handshaken(*this->__tls);
+                this->send_request();
+            }
+        );
+    }
+
+    void send_request(void)
+    {
+        // the connection was successful, send the request.
+        async_write_stream(__reqbuf,
+            [this](const error_code& _err, const size_t& _nbytes) {
+                this->handle_write_request(_err, _nbytes, this->__timer);
+            }
+        );
+    }
+
+    template<typename Handler>
+    void async_write_stream(boost::asio::streambuf& buffer, Handler handler)
+    {
+        if (__tls) {
+            boost::asio::async_write(*__tls, buffer, handler);
         }
         else {
-            std::cerr << __func__ << " Error : " << err.message() << "\n";
+            boost::asio::async_write(__socket, buffer, handler);
+        }
+    }
+
+    template<typename Handler>
+    void async_read_until_stream(boost::asio::streambuf& buffer, const char* delim, Handler handler)
+    {
+        if (__tls) {
+            boost::asio::async_read_until(*__tls, buffer, delim, handler);
+        }
+        else {
+            boost::asio::async_read_until(__socket, buffer, delim, handler);
+        }
+    }
+
+    template<typename Condition, typename Handler>
+    void async_read_stream(boost::asio::streambuf& buffer, Condition cond, Handler handler)
+    {
+        if (__tls) {
+            boost::asio::async_read(*__tls, buffer, cond, handler);
+        }
+        else {
+            boost::asio::async_read(__socket, buffer, cond, handler);
         }
     }
 
@@ -104,7 +175,7 @@ struct client
         if (not err) {
             // read the response status line. The __resbuf will automatically grow to accommodate the entire line.
             // the growth may be limited by passing a maximum size to the streambuf constructor.
-            boost::asio::async_read_until(__socket, __resbuf, "\r\n",
+            async_read_until_stream(__resbuf, "\r\n",
                 [this](const error_code& _err, const size_t& _nbytes){
                     this->handle_read_status_line(_err, _nbytes);
                 }
@@ -136,7 +207,7 @@ struct client
                 return;
             }
             // read the response headers, which are terminated by a blank line.
-            boost::asio::async_read_until(__socket, __resbuf, "\r\n\r\n",
+            async_read_until_stream(__resbuf, "\r\n\r\n",
                 [this](const error_code& _err, const size_t& _nbytes){
                     this->handle_read_headers(_err, _nbytes);
                 }
@@ -159,7 +230,7 @@ struct client
         if (not err) {
             streambuf2cstr(__data->head, __resbuf, nbytes);
             boost::erase_last(__data->head, "\r\n");
-            boost::asio::async_read(__socket, __resbuf, __transctl(),
+            async_read_stream(__resbuf, __transctl(),
                 [this](const error_code& _err, const size_t& _nbytes){
                     this->handle_read_content(_err, _nbytes);
                 }
@@ -175,13 +246,18 @@ struct client
     {
         if (not err) {
             // write all of the data that has been read so far, continue reading remaining data until eof
-            boost::asio::async_read(__socket, __resbuf, __transctl(), boost::bind(&client::handle_read_content,
+            async_read_stream(__resbuf, __transctl(), boost::bind(&client::handle_read_content,
                                                                                   this,
                                                                                   boost::asio::placeholders::error,
                                                                                   _2));
             // note here should NOT use lambda expr!!!
         }
-        else if (err == boost::asio::error::eof) {
+        else if (err == boost::asio::error::eof or err == boost::asio::ssl::error::stream_truncated) {
+            // servers commonly close a tls connection without close_notify. the response is
+            // complete all the same, and openssl must not throw its session away when freed
+            if (__tls) {
+                SSL_set_shutdown(__tls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            }
             streambuf2cstr(__data->content, __resbuf, __resbuf.size());
             __user_handler(__url, __data);
             __finished.store(true, boost::memory_order_seq_cst);
@@ -195,7 +271,9 @@ struct client
     // see typedefs.hpp for more details
     const string  __url;
     asio_socket   __socket;
-    asio_resolver __resolver;
+    boost::shared_ptr<asio_https> __tls;    // null for http
+    const string  __host;
+    const string  __session_key;            // host:port, of the tls session to resume
 
     boost::asio::streambuf __reqbuf;
     boost::asio::streambuf __resbuf;
@@ -211,21 +289,46 @@ struct client
 
 typedef boost::shared_ptr<client> client_ptr;
 
+// [http[s]://]host[:port][/path]
+struct url_parts
+{
+    bool   https;
+    string host;
+    string port;    // empty if the url has none
+    string path;    // "/" if the url has none
+
+    // the port to connect to, as a service name if the url has none
+    string service(void) const
+    {
+        return port.empty() ? (https ? "https" : "http") : port;
+    }
+};
+
+inline bool parse_url(const string& url, url_parts& parts)
+{
+    static boost::regex x("^(https?://)?([^/:]+)(?::(\\d+))?(/.*)?$");
+    boost::smatch match;
+    if (not boost::regex_match(url, match, x)) {
+        return false;
+    }
+    parts.https = match[1] == "https://";
+    parts.host = match[2];
+    parts.port = match[3];
+    parts.path = match[4];
+    if (parts.path.empty()) {
+        parts.path = "/";
+    }
+    return true;
+}
+
 inline client_ptr create_client(asio_service& io_service,
                                 const string& url,
                                 const string& method,
                                 handler_for_client handler)
 {
-    static boost::regex x("^(http://)?(\\w+\\.\\w.*?)(/.*)?$");
-    boost::smatch match;
-    boost::regex_match(url, match, x);
-    string prot(match[1]);
-    string host(match[2]);
-    string path(match[3]);
-    if (path.empty()) {
-        path = "/";
-    }
-    return boost::make_shared<client>(io_service, handler, host, path, method);
+    url_parts parts;
+    parse_url(url, parts);
+    return boost::make_shared<client>(io_service, handler, parts.host, parts.path, method, parts.https, parts.port);
 }
 
 
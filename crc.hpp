@@ -229,13 +229,51 @@ struct crc_calculator
 
     inline uint32_t crc32(const byte* data, uint64_t len)
     {
-        uint32_t i = 0;
-        uint32_t crc = 0xffffffff;
-        for (; i < len; ++i) {
-            byte k = data[i];
-            crc = crc32_table[((byte)crc ^ k) & 0xff] ^ (crc >> 8);
+        return crc32_update(0, data, len);
+    }
+
+    // the crc32 of a stream that had `crc` so far and goes on with `data`, crc 0 to start
+    inline uint32_t crc32_update(uint32_t crc, const byte* data, uint64_t len)
+    {
+        crc = ~crc;
+        for (uint64_t i = 0; i < len; ++i) {
+            crc = crc32_table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    // the crc32 of a followed by b, from the crc32 of both and the length of b. pieces of a
+    // stream checked apart, e.g. in parallel, are put together this way (same as zlib)
+    inline uint32_t crc32_combine(uint32_t crc1, const uint32_t crc2, uint64_t len2)
+    {
+        if (len2 == 0) {
+            return crc1;
+        }
+        uint32_t even[32];  // operator for an even number of zero bits
+        uint32_t odd[32];   // and an odd
+        odd[0] = 0xedb88320;
+        for (uint32_t n = 1, row = 1; n < 32; ++n, row <<= 1) {
+            odd[n] = row;
         }
-        return crc ^ 0xffffffff;
+        gf2_square(even, odd);  // 2 zero bits
+        gf2_square(odd, even);  // 4 zero bits
+        // apply len2 zero bytes to crc1, the first square gives the operator for one
+        do {
+            gf2_square(even, odd);
+            if (len2 & 1) {
+                crc1 = gf2_times(even, crc1);
+            }
+            len2 >>= 1;
+            if (len2 == 0) {
+                break;
+            }
+            gf2_square(odd, even);
+            if (len2 & 1) {
+                crc1 = gf2_times(odd, crc1);
+            }
+            len2 >>= 1;
+        } while (len2);
+        return crc1 ^ crc2;
     }
 
     inline uint64_t crc64(const byte* data, uint64_t len)
@@ -243,8 +281,7 @@ struct crc_calculator
         uint64_t i = 0;
         uint64_t crc = 0;
         for (; i < len; ++i) {
-            byte k = data[i];
-            crc = crc64_table[(byte)crc ^ k] ^ (crc >> 8);
+            crc = crc64_table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
         }
         return crc;
     }
@@ -256,20 +293,39 @@ struct crc_calculator
         auto buffer = mr.read();
         auto fsize  = mr.size();
         if (not buffer) {
-            fprintf(stderr, "Memory MAP Error: %s\n", filename);
-            return;
+            fprintf(stderr, "Memory MAP Error: %s\n", filename.c_str());
+            return 0;
         }
-        if (sizeof(T) == 32) {
-            return crc32(buffer, fsize);
+        if (sizeof(T) == sizeof(uint32_t)) {
+            return static_cast<T>(crc32(buffer, fsize));
         }
-        else if (sizeof(T) == 64) {
-            return crc64(buffer, fsize);
+        else if (sizeof(T) == sizeof(uint64_t)) {
+            return static_cast<T>(crc64(buffer, fsize));
         }
         else {
             assert(0);
             return 0;
         }
     }
+
+protected:
+    static inline uint32_t gf2_times(const uint32_t* mat, uint32_t vec)
+    {
+        uint32_t sum = 0;
+        for (; vec; vec >>= 1, ++mat) {
+            if (vec & 1) {
+                sum ^= *mat;
+            }
+        }
+        return sum;
+    }
+
+    static inline void gf2_square(uint32_t* square, const uint32_t* mat)
+    {
+        for (int n = 0; n < 32; ++n) {
+            square[n] = gf2_times(mat, mat[n]);
+        }
+    }
 };
 
 }
@@ -0,0 +1,300 @@
+/**
+ * file   : dnscache.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * shared cache of name lookups for the client, and connecting by racing the addresses
+ */
+#pragma once
+#ifndef DNS_CACHE_HTTP_HPP
+#define DNS_CACHE_HTTP_HPP
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "admission.hpp"
+
+namespace basiohttp
+{
+
+typedef std::vector<asio_endpoint> endpoint_list;
+typedef boost::function<void(const error_code&, const endpoint_list&)> resolve_handler;
+
+// getaddrinfo() does not tell the ttl of the records, so the cache keeps answers for a fixed
+// time. set ttl_ms to what the zones of the backends use
+struct dns_cache_options
+{
+    size_t ttl_ms;          // how long an answer is used
+    size_t negative_ttl_ms; // and a failed lookup
+    size_t capacity;        // names kept, expired and then the soonest to expire go first
+
+    dns_cache_options(void):
+        ttl_ms(30000),
+        negative_ttl_ms(5000),
+        capacity(1024)
+    {
+    }
+};
+
+struct dns_cache_stats
+{
+    size_t hits;
+    size_t lookups;     // getaddrinfo() calls made
+    size_t coalesced;   // requests that waited for the lookup of another one
+
+    dns_cache_stats(void):hits(0), lookups(0), coalesced(0)
+    {
+    }
+};
+
+
+// resolve() answers from the cache while an entry is fresh, else asks the asio resolver of
+// the calling io_service. requests for a name that is being looked up already wait for that
+// lookup instead of starting their own. handlers always run later on the io_service passed
+// to resolve(), never inside it
+struct dns_cache: public boost::noncopyable
+{
+    explicit dns_cache(const dns_cache_options& opts = dns_cache_options()):
+        __opts(opts)
+    {
+    }
+
+    // the cache create_client() and client use
+    static dns_cache& shared(void)
+    {
+        static dns_cache cache;
+        return cache;
+    }
+
+    void resolve(asio_service& io_service, const string& host, const string& service, const resolve_handler& handler)
+    {
+        const string key = host + ":" + service;
+        const uint64_t now = steady_us();
+        boost::mutex::scoped_lock lock(__mutex);
+        auto found = __entries.find(key);
+        if (found != __entries.end() and now < found->second.expires) {
+            ++__stats.hits;
+            const error_code ec = found->second.error;
+            const endpoint_list endpoints = found->second.endpoints;
+            io_service.post([handler, ec, endpoints]() { handler(ec, endpoints); });
+            return;
+        }
+        auto pending = __pending.find(key);
+        if (pending != __pending.end()) {
+            ++__stats.coalesced;
+            pending->second.push_back(waiter{&io_service, handler});
+            return;
+        }
+        ++__stats.lookups;
+        __pending[key].push_back(waiter{&io_service, handler});
+        lock.unlock();
+
+        auto resolver = boost::make_shared<asio_resolver>(io_service);
+        resolver->async_resolve(asio_resolver::query(host, service),
+            [this, key, resolver](const error_code& ec, asio_resolver::iterator it) {
+                endpoint_list endpoints;
+                for (; not ec and it != asio_resolver::iterator(); ++it) {
+                    endpoints.push_back(it->endpoint());
+                }
+                this->complete(key, ec, endpoints);
+            });
+    }
+
+    // drop the answer for `host`, e.g. after connecting to all of its addresses failed
+    void invalidate(const string& host, const string& service)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        __entries.erase(host + ":" + service);
+    }
+
+    dns_cache_stats stats(void)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        return __stats;
+    }
+
+protected:
+    struct entry
+    {
+        endpoint_list endpoints;
+        error_code    error;
+        uint64_t      expires;  // steady_us
+    };
+
+    struct waiter
+    {
+        asio_service*   io_service;
+        resolve_handler handler;
+    };
+
+    void complete(const string& key, const error_code& ec, const endpoint_list& endpoints)
+    {
+        std::vector<waiter> waiters;
+        {
+            const uint64_t now = steady_us();
+            boost::mutex::scoped_lock lock(__mutex);
+            if (__entries.size() >= __opts.capacity and not __entries.count(key)) {
+                evict(now);
+            }
+            entry& e = __entries[key];
+            e.endpoints = endpoints;
+            e.error = ec;
+            e.expires = now + (ec or endpoints.empty() ? __opts.negative_ttl_ms : __opts.ttl_ms) * 1000;
+            waiters.swap(__pending[key]);
+            __pending.erase(key);
+        }
+        for (auto& w : waiters) {
+            const resolve_handler handler = w.handler;
+            w.io_service->post([handler, ec, endpoints]() { handler(ec, endpoints); });
+        }
+    }
+
+    // expired entries, or else the one expiring first
+    void evict(const uint64_t now)
+    {
+        auto soonest = __entries.begin();
+        for (auto it = __entries.begin(); it != __entries.end(); ) {
+            if (it->second.expires <= now) {
+                it = __entries.erase(it);
+                soonest = __entries.begin();
+                continue;
+            }
+            if (it->second.expires < soonest->second.expires) {
+                soonest = it;
+            }
+            ++it;
+        }
+        if (__entries.size() >= __opts.capacity and soonest != __entries.end()) {
+            __entries.erase(soonest);
+        }
+    }
+
+    dns_cache_options __opts;
+    boost::mutex      __mutex;
+    boost::unordered_map<string, entry> __entries;
+    boost::unordered_map<string, std::vector<waiter>> __pending;
+    dns_cache_stats   __stats;
+};
+
+
+// connects `socket` to one of `endpoints`. attempts start `stagger_ms` apart, or at once when
+// the one before failed, and run side by side. the first to connect becomes `socket`, the
+// others are closed. addresses are tried alternating between ipv6 and ipv4, starting with the
+// family of the first one (rfc 8305). `handler` gets the error of the last attempt if none
+// connects. the io_service must not run the race on more than one thread at a time
+struct connect_race: public boost::enable_shared_from_this<connect_race>
+{
+    typedef boost::function<void(const error_code&)> handler_type;
+
+    static void start(asio_socket& socket, const endpoint_list& endpoints, const size_t stagger_ms,
+                      const handler_type& handler)
+    {
+        boost::shared_ptr<connect_race> race(new connect_race(socket, endpoints, stagger_ms, handler));
+        if (race->__endpoints.empty()) {
+            boost::asio::post(socket.get_executor(), [handler]() { handler(boost::asio::error::host_not_found); });
+            return;
+        }
+        race->attempt();
+    }
+
+protected:
+    connect_race(asio_socket& socket, const endpoint_list& endpoints, const size_t stagger_ms,
+                 const handler_type& handler):
+        __socket(socket),
+        __timer(socket.get_executor()),
+        __stagger_ms(stagger_ms),
+        __handler(handler),
+        __next(0),
+        __running(0),
+        __generation(0),
+        __done(false)
+    {
+        std::vector<asio_endpoint> first, second;
+        for (auto& e : endpoints) {
+            (e.address().is_v6() == endpoints.front().address().is_v6() ? first : second).push_back(e);
+        }
+        for (size_t i = 0; i < first.size() or i < second.size(); ++i) {
+            if (i < first.size()) {
+                __endpoints.push_back(first[i]);
+            }
+            if (i < second.size()) {
+                __endpoints.push_back(second[i]);
+            }
+        }
+    }
+
+    void attempt(void)
+    {
+        if (__done or __next >= __endpoints.size()) {
+            return;
+        }
+        auto self = this->shared_from_this();
+        auto s = boost::make_shared<asio_socket>(__socket.get_executor());
+        __attempts.push_back(s);
+        ++__running;
+        s->async_connect(__endpoints[__next++], [self, s](const error_code& ec) {
+            self->connected(ec, s);
+        });
+        if (__next < __endpoints.size()) {
+            const size_t generation = ++__generation;
+            __timer.expires_from_now(boost::posix_time::milliseconds(__stagger_ms));
+            __timer.async_wait([self, generation](const error_code& ec) {
+                if (not ec and generation == self->__generation) {
+                    self->attempt();
+                }
+            });
+        }
+    }
+
+    void connected(const error_code& ec, const boost::shared_ptr<asio_socket>& s)
+    {
+        --__running;
+        if (__done) {
+            return;
+        }
+        if (not ec) {
+            __done = true;
+            error_code ignored;
+            __timer.cancel(ignored);
+            for (auto& a : __attempts) {
+                if (a != s) {
+                    a->close(ignored);
+                }
+            }
+            __socket = std::move(*s);
+            __handler(ec);
+            return;
+        }
+        __error = ec;
+        if (__next < __endpoints.size()) {
+            ++__generation; //the pending stagger timer must not start one more
+            attempt();
+        }
+        else if (__running == 0) {
+            __done = true;
+            __handler(__error);
+        }
+    }
+
+    asio_socket&  __socket;
+    boost::asio::deadline_timer __timer;
+    size_t        __stagger_ms;
+    handler_type  __handler;
+    endpoint_list __endpoints;
+    std::vector<boost::shared_ptr<asio_socket>> __attempts;
+    size_t        __next;
+    size_t        __running;
+    size_t        __generation;
+    bool          __done;
+    error_code    __error;
+};
+
+}//basiohttp
+
+
+#endif//DNS_CACHE_HTTP_HPP
@@ -0,0 +1,570 @@
+/**
+ * file   : download.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * downloading into a file as the body arrives, in ranges over parallel connections when the
+ * server supports them
+ */
+#pragma once
+#ifndef DOWNLOAD_HTTP_HPP
+#define DOWNLOAD_HTTP_HPP
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/algorithm/string.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "dnscache.hpp"
+#include "client.hpp"
+#include "crc.hpp"
+#include "tls.hpp"
+
+namespace basiohttp
+{
+
+struct download_options
+{
+    size_t   segments;      // connections at most, 1 fetches the body in one piece
+    size_t   min_segment;   // bytes, a file is not split into smaller pieces than this
+    size_t   chunk;         // bytes written at once, the buffer of each connection. rounded up
+                            // to pages, the pieces start at multiples of it
+    size_t   timeout_ms;    // a connection receiving nothing this long fails the download
+    bool     crc;           // crc32 of the body into download_result::crc
+    bool     verify_crc;    // fail unless the crc32 is expected_crc
+    uint32_t expected_crc;
+
+    download_options(void):
+        segments(4),
+        min_segment(4 << 20),
+        chunk(1 << 20),
+        timeout_ms(30000),
+        crc(false),
+        verify_crc(false),
+        expected_crc(0)
+    {
+    }
+};
+
+struct download_result
+{
+    string   error;     // empty if the file is complete
+    uint64_t size;      // bytes of the body written
+    uint32_t crc;       // crc32 of the body if asked for
+    size_t   segments;  // connections used
+    bool     ranges;    // the server answered the range request with one
+
+    download_result(void):size(0), crc(0), segments(0), ranges(false)
+    {
+    }
+};
+
+typedef boost::function<void(const string&, const download_result&)> download_handler;
+
+
+// GET of `url` into the file `path`, the body never goes to memory beyond a chunk per
+// connection. the first request asks for "bytes=0-": a server answering 206 tells the size,
+// the file is allocated in full and split into up to `segments` pieces, the first connection
+// keeps the first piece and one more connection is opened for each of the others, writing its
+// piece in place. a server answering 200 streams the whole body on the first connection.
+// the handler runs once, when all connections are done. a failed download leaves what was
+// written in the file. the io_service must not run a download on more than one thread at a time
+struct download: public boost::enable_shared_from_this<download>, public boost::noncopyable
+{
+    static const uint64_t UNKNOWN = UINT64_MAX;
+
+    download(asio_service& io_service, const string& url, const string& path, const download_handler& handler,
+             const download_options& opts):
+        __io(io_service),
+        __url(url),
+        __path(path),
+        __handler(handler),
+        __opts(opts),
+        __fd(-1),
+        __total(UNKNOWN),
+        __running(0)
+    {
+        __opts.segments = max<size_t>(__opts.segments, 1);
+        __opts.min_segment = max<size_t>(__opts.min_segment, 1);
+        __opts.chunk = (max<size_t>(__opts.chunk, 1) + PAGE - 1) / PAGE * PAGE;
+        __opts.crc = __opts.crc or __opts.verify_crc;
+    }
+
+    ~download(void)
+    {
+        if (__fd >= 0) {
+            ::close(__fd);
+        }
+    }
+
+    void start(void)
+    {
+        auto self = this->shared_from_this();
+        if (not parse_url(__url, __parts)) {
+            __result.error = "not a url";
+        }
+        else if ((__fd = ::open(__path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            __result.error = string("open: ") + strerror(errno);
+        }
+        if (not __result.error.empty()) {
+            __io.post([self]() { self->complete(); });
+            return;
+        }
+        __session_key = __parts.host + ":" + (__parts.port.empty() ? (__parts.https ? "443" : "80") : __parts.port);
+        launch(0, UNKNOWN);
+    }
+
+protected:
+    enum { PAGE = 4096 };
+
+    // one connection, fetching [begin, end) of the body
+    struct part: public boost::noncopyable
+    {
+        asio_socket socket;
+        boost::shared_ptr<asio_https> tls;  // null for http
+        boost::asio::deadline_timer   timer;
+        string   request;
+        boost::asio::streambuf head;        // the response head, and body bytes read along
+        byte*    buffer;                    // a chunk, page aligned
+        size_t   fill;                      // bytes in buffer
+        uint64_t begin;
+        uint64_t end;                       // UNKNOWN until the size is known
+        uint64_t written;                   // bytes from begin in the file
+        uint32_t crc;                       // of those
+        bool     timed_out;
+        bool     done;
+
+        part(asio_service& io_service, const size_t chunk, const uint64_t begin, const uint64_t end, const bool https):
+            socket(io_service),
+            timer(io_service),
+            buffer(nullptr),
+            fill(0),
+            begin(begin),
+            end(end),
+            written(0),
+            crc(0),
+            timed_out(false),
+            done(false)
+        {
+            if (https) {
+                tls.reset(new asio_https(io_service, client_tls::shared().context()));
+            }
+            if (posix_memalign(reinterpret_cast<void**>(&buffer), PAGE, chunk)) {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~part(void)
+        {
+            free(buffer);
+        }
+
+        inline asio_socket& tcp(void)
+        {
+            return tls ? tls->next_layer() : socket;
+        }
+
+        // file offset of the end of buffer
+        inline uint64_t position(void) const
+        {
+            return begin + written + fill;
+        }
+
+        template<typename Handler>
+        void write_request(Handler handler)
+        {
+            if (tls) {
+                boost::asio::async_write(*tls, boost::asio::buffer(request), handler);
+            }
+            else {
+                boost::asio::async_write(socket, boost::asio::buffer(request), handler);
+            }
+        }
+
+        template<typename Handler>
+        void read_head(Handler handler)
+        {
+            if (tls) {
+                boost::asio::async_read_until(*tls, head, "\r\n\r\n", handler);
+            }
+            else {
+                boost::asio::async_read_until(socket, head, "\r\n\r\n", handler);
+            }
+        }
+
+        template<typename Handler>
+        void read_some(const size_t n, Handler handler)
+        {
+            if (tls) {
+                tls->async_read_some(boost::asio::buffer(buffer + fill, n), handler);
+            }
+            else {
+                socket.async_read_some(boost::asio::buffer(buffer + fill, n), handler);
+            }
+        }
+    };
+
+    typedef boost::shared_ptr<part> part_ptr;
+
+    inline bool stopping(void) const
+    {
+        return not __result.error.empty();
+    }
+
+    void launch(const uint64_t begin, const uint64_t end)
+    {
+        part_ptr p(new part(__io, __opts.chunk, begin, end, __parts.https));
+        __pieces.push_back(p);
+        ++__running;
+        arm(p);
+        watch(p);
+        auto self = this->shared_from_this();
+        dns_cache::shared().resolve(__io, __parts.host, __parts.service(),
+            [self, p](const error_code& ec, const endpoint_list& endpoints) {
+                if (ec or self->stopping()) {
+                    self->finish(p, ec ? "resolve: " + ec.message() : "");
+                    return;
+                }
+                connect_race::start(p->tcp(), endpoints, client::CONNECT_STAGGER_MS, [self, p](const error_code& _ec) {
+                    if (_ec or self->stopping()) {
+                        self->finish(p, _ec ? "connect: " + self->reason(p, _ec) : "");
+                        return;
+                    }
+                    self->handshake(p);
+                });
+            });
+    }
+
+    // the deadline of `p` from now, a pending watch() sees it moved
+    inline void arm(const part_ptr& p)
+    {
+        p->timer.expires_from_now(boost::posix_time::milliseconds(__opts.timeout_ms));
+    }
+
+    void watch(const part_ptr& p)
+    {
+        auto self = this->shared_from_this();
+        p->timer.async_wait([self, p](const error_code&) {
+            if (p->done) {
+                return;
+            }
+            if (p->timer.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+                p->timed_out = true; //the pending operation fails on the closed socket
+                error_code ignored;
+                p->tcp().close(ignored);
+                return;
+            }
+            self->watch(p);
+        });
+    }
+
+    inline string reason(const part_ptr& p, const error_code& ec) const
+    {
+        return p->timed_out ? "timed out" : ec.message();
+    }
+
+    void handshake(const part_ptr& p)
+    {
+        if (not p->tls) {
+            send(p);
+            return;
+        }
+        client_tls::shared().prepare(*p->tls, __parts.host, &__session_key);
+        auto self = this->shared_from_this();
+        p->tls->async_handshake(boost::asio::ssl::stream_base::client, [self, p](const error_code& ec) {
+            if (ec) {
+                client_tls::shared().forget(self->__session_key);
+                self->finish(p, "handshake: " + self->reason(p, ec));
+                return;
+            }
+            client_tls::shared().handshaken(*p->tls);
+            self->send(p);
+        });
+    }
+
+    void send(const part_ptr& p)
+    {
+        const string host = __parts.port.empty() ? __parts.host : __parts.host + ":" + __parts.port;
+        const string range = dtos(p->begin) + "-" + (p->end == UNKNOWN ? string() : dtos(p->end - 1));
+        p->request = sreplace(templates::get_range, {"$path", __parts.path}, {"$host", host}, {"$range", range});
+        auto self = this->shared_from_this();
+        p->write_request([self, p](const error_code& ec, const size_t&) {
+            if (ec or self->stopping()) {
+                self->finish(p, ec ? self->reason(p, ec) : "");
+                return;
+            }
+            self->arm(p);
+            p->read_head([self, p](const error_code& _ec, const size_t& nbytes) {
+                if (_ec or self->stopping()) {
+                    self->finish(p, _ec ? self->reason(p, _ec) : "");
+                    return;
+                }
+                self->headed(p, nbytes);
+            });
+        });
+    }
+
+    // status line and headers of the response to `p`, then the body bytes read along with them
+    void headed(const part_ptr& p, const size_t nbytes)
+    {
+        auto data = p->head.data();
+        const string head(boost::asio::buffers_begin(data), boost::asio::buffers_begin(data) + nbytes);
+        p->head.consume(nbytes);
+
+        unsigned status = 0;
+        unsigned long long first = 0, last = 0, total = 0, length = UNKNOWN;
+        bool has_range = false, total_known = false;
+        if (sscanf(head.c_str(), "HTTP/%*u.%*u %u", &status) != 1) {
+            finish(p, "invalid response");
+            return;
+        }
+        std::vector<string> lines;
+        boost::split(lines, head, boost::is_any_of("\n"));
+        for (auto& line : lines) {
+            if (boost::istarts_with(line, "content-length:")) {
+                sscanf(line.c_str() + 15, "%llu", &length);
+            }
+            else if (boost::istarts_with(line, "content-range:")) {
+                const int got = sscanf(line.c_str() + 14, " bytes %llu-%llu/%llu", &first, &last, &total);
+                has_range = got >= 2 and first <= last;
+                total_known = got == 3;
+            }
+        }
+
+        const bool probe = p == __pieces.front();
+        if (status == 206 and has_range and first == p->begin) {
+            if (probe) {
+                __result.ranges = true;
+                sized(p, total_known ? total : UNKNOWN, total_known);
+                if (not total_known) {
+                    p->end = last + 1;  //the size is never told, what is sent is all
+                }
+            }
+            if (last + 1 < p->end) {
+                finish(p, "short range");
+                return;
+            }
+        }
+        else if (status == 200 and probe) {
+            sized(p, length, false);
+        }
+        else {
+            finish(p, status == 200 ? "range ignored" : "status " + dtos(status));
+            return;
+        }
+
+        // body bytes read along with the head
+        while (p->head.size() and p->position() < p->end) {
+            const size_t n = min<uint64_t>(min<size_t>(p->head.size(), __opts.chunk - p->fill), p->end - p->position());
+            p->head.sgetn(p->buffer + p->fill, n);
+            p->fill += n;
+            if (p->fill == __opts.chunk and not flush(p)) {
+                return;
+            }
+        }
+        p->head.consume(p->head.size());
+        receive(p);
+    }
+
+    // the first answer told the size of the body, or that it is not known. splits it if it can
+    void sized(const part_ptr& p, const uint64_t total, const bool ranges)
+    {
+        __total = total;
+        p->end = total;
+        if (total == UNKNOWN) {
+            return;
+        }
+        // reserve the file, the pieces are written into it in place
+        if (total and fallocate(__fd, 0, 0, total) != 0) {
+            if (ftruncate(__fd, total) != 0) {
+                std::cerr << __func__ << " Error: " << strerror(errno) << "\n";
+            }
+        }
+        const uint64_t n = min<uint64_t>(__opts.segments, total / __opts.min_segment);
+        if (not ranges or n < 2) {
+            return;
+        }
+        uint64_t size = (total + n - 1) / n;
+        size = (size + __opts.chunk - 1) / __opts.chunk * __opts.chunk;
+        p->end = min(size, total);
+        for (uint64_t begin = size; begin < total; begin += size) {
+            launch(begin, min(begin + size, total));
+        }
+    }
+
+    void receive(const part_ptr& p)
+    {
+        if (p->position() >= p->end) {
+            if (flush(p)) {
+                finish(p, "");
+            }
+            return;
+        }
+        const size_t n = min<uint64_t>(__opts.chunk - p->fill, p->end - p->position());
+        arm(p);
+        auto self = this->shared_from_this();
+        p->read_some(n, [self, p](const error_code& ec, const size_t nbytes) {
+            self->received(p, ec, nbytes);
+        });
+    }
+
+    void received(const part_ptr& p, const error_code& ec, const size_t nbytes)
+    {
+        p->fill += nbytes;
+        if (stopping()) {
+            finish(p, "");
+            return;
+        }
+        if (ec == boost::asio::error::eof or ec == boost::asio::ssl::error::stream_truncated) {
+            if (p->end != UNKNOWN) {
+                finish(p, "closed early");
+            }
+            else if (flush(p)) {
+                p->end = p->position();
+                finish(p, "");
+            }
+            return;
+        }
+        if (ec) {
+            finish(p, reason(p, ec));
+            return;
+        }
+        if (p->fill == __opts.chunk and not flush(p)) {
+            return;
+        }
+        receive(p);
+    }
+
+    // the buffer of `p` into the file
+    bool flush(const part_ptr& p)
+    {
+        for (size_t done = 0; done < p->fill; ) {
+            const ssize_t n = pwrite(__fd, p->buffer + done, p->fill - done, p->begin + p->written + done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                finish(p, string("write: ") + strerror(errno));
+                return false;
+            }
+            done += n;
+        }
+        if (__opts.crc) {
+            p->crc = __crc.crc32_update(p->crc, p->buffer, p->fill);
+        }
+        p->written += p->fill;
+        p->fill = 0;
+        return true;
+    }
+
+    // `p` stopped, because of `error` if not empty. the first error stops all other connections
+    void finish(const part_ptr& p, const string& error)
+    {
+        if (p->done) {
+            return;
+        }
+        p->done = true;
+        error_code ignored;
+        p->timer.cancel(ignored);
+        if (p->tls and error.empty()) {
+            // a connection closed on purpose, its session stays resumable
+            SSL_set_shutdown(p->tls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
+        p->tcp().close(ignored);
+        if (not error.empty() and not stopping()) {
+            __result.error = error;
+            for (auto& other : __pieces) {
+                if (not other->done) {
+                    other->tcp().close(ignored);
+                }
+            }
+        }
+        if (--__running == 0) {
+            complete();
+        }
+    }
+
+    void complete(void)
+    {
+        uint64_t size = 0;
+        uint32_t crc = 0;
+        for (auto& p : __pieces) {
+            size += p->written;
+            crc = __crc.crc32_combine(crc, p->crc, p->written);
+        }
+        __result.size = size;
+        __result.crc = __opts.crc ? crc : 0;
+        __result.segments = __pieces.size();
+        if (__result.error.empty() and __total != UNKNOWN and size != __total) {
+            __result.error = "size " + dtos(size) + " of " + dtos(__total);
+        }
+        if (__result.error.empty() and __opts.verify_crc and crc != __opts.expected_crc) {
+            __result.error = "crc mismatch";
+        }
+        if (__fd >= 0) {
+            ::close(__fd);
+            __fd = -1;
+        }
+        __pieces.clear();
+        __handler(__url, __result);
+    }
+
+    asio_service&    __io;
+    const string     __url;
+    const string     __path;
+    download_handler __handler;
+    download_options __opts;
+    url_parts        __parts;
+    string           __session_key;     // host:port, of the tls session to resume
+    int              __fd;
+    uint64_t         __total;           // size of the body, UNKNOWN until told
+    std::vector<part_ptr> __pieces;     // in file order, the first sent the probe
+    size_t           __running;
+    crc_calculator   __crc;
+    download_result  __result;
+};
+
+
+typedef boost::shared_ptr<download> download_ptr;
+
+// the download keeps itself alive until its handler ran, the pointer need not be held
+inline download_ptr create_download(asio_service& io_service,
+                                    const string& url,
+                                    const string& path,
+                                    download_handler handler,
+                                    const download_options& opts = download_options())
+{
+    download_ptr d(new download(io_service, url, path, handler, opts));
+    d->start();
+    return d;
+}
+
+
+inline int test_download(const string& url, const string& path, const size_t segments = 4)
+{
+    asio_service io_service;
+    download_options opts;
+    opts.segments = segments;
+    opts.crc = true;
+    int ret = 1;
+    create_download(io_service, url, path, [&ret](const string& url, const download_result& r) {
+        std::cout << url << "\n" << (r.error.empty() ? "ok" : r.error) << ", " << r.size << " bytes in "
+                  << r.segments << (r.ranges ? " ranges" : " piece") << ", crc32 " << std::hex << r.crc
+                  << std::dec << "\n";
+        ret = r.error.empty() ? 0 : 1;
+    }, opts);
+    io_service.run();
+    return ret;
+}
+
+}//basiohttp
+
+
+#endif//DOWNLOAD_HTTP_HPP
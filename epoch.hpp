@@ -0,0 +1,189 @@
+/**
+ * file   : epoch.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * epoch based reclamation: readers walk shared structures without locks, writers free what they
+ * unlinked once no reader can still see it
+ */
+#pragma once
+#ifndef EPOCH_HTTP_HPP
+#define EPOCH_HTTP_HPP
+#include <cstdint>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace basiohttp
+{
+
+// one per process. a reader thread owns a slot and writes the global epoch into it when it
+// enters a read section, 0 when it leaves, nobody else writes the slot, so readers share no
+// writable cache line. a writer unlinks an object, retire()s it with the current epoch and
+// bumps the epoch, the object is freed once every slot is 0 or newer than that
+struct epoch_domain: public boost::noncopyable
+{
+    struct slot
+    {
+        boost::atomic<uint64_t> epoch;  // 0 outside of a read section
+        boost::atomic<bool>     used;   // owned by a thread
+        slot* next;
+        char pad[64];                   // a line of its own
+
+        slot(void):epoch(0), used(true), next(nullptr)
+        {
+        }
+    };
+
+    static epoch_domain& instance(void)
+    {
+        static epoch_domain domain;
+        return domain;
+    }
+
+    ~epoch_domain(void)
+    {
+        for (auto& r : __retired) {
+            r.second();
+        }
+        for (slot* s = __slots.load(); s; ) {
+            slot* next = s->next;
+            delete s;
+            s = next;
+        }
+    }
+
+    // a free slot, or a new one, for the calling thread
+    slot* acquire(void)
+    {
+        for (slot* s = __slots.load(boost::memory_order_acquire); s; s = s->next) {
+            bool expected = false;
+            if (not s->used.load(boost::memory_order_relaxed) and s->used.compare_exchange_strong(expected, true)) {
+                return s;
+            }
+        }
+        slot* s = new slot;
+        slot* head = __slots.load(boost::memory_order_relaxed);
+        do {
+            s->next = head; //not published yet
+        } while (not __slots.compare_exchange_weak(head, s, boost::memory_order_release, boost::memory_order_relaxed));
+        return s;
+    }
+
+    void release(slot* s)
+    {
+        s->epoch.store(0, boost::memory_order_release);
+        s->used.store(false, boost::memory_order_release);
+    }
+
+    inline void enter(slot* s)
+    {
+        s->epoch.store(__epoch.load(boost::memory_order_acquire), boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_seq_cst); //pairs with the fence of retire()
+    }
+
+    inline void leave(slot* s)
+    {
+        s->epoch.store(0, boost::memory_order_release);
+    }
+
+    // `deleter` frees something that was unlinked before this call, it runs on some later
+    // retire() of any thread once all readers that may have seen the object have left
+    void retire(const boost::function<void()>& deleter)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        __retired.push_back(std::make_pair(__epoch.fetch_add(1), deleter));
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        const uint64_t oldest = oldest_reader();
+        size_t kept = 0;
+        for (size_t i = 0; i < __retired.size(); ++i) {
+            if (__retired[i].first < oldest) {
+                __retired[i].second();
+            }
+            else {
+                __retired[kept++].swap(__retired[i]);
+            }
+        }
+        __retired.resize(kept);
+    }
+
+    // objects retired but not freed yet, they wait for the next retire() of any thread
+    size_t pending(void)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        return __retired.size();
+    }
+
+protected:
+    epoch_domain(void):__epoch(1), __slots(nullptr)
+    {
+    }
+
+    // smallest epoch of a reader inside a read section, UINT64_MAX if there is none
+    uint64_t oldest_reader(void) const
+    {
+        uint64_t oldest = UINT64_MAX;
+        for (slot* s = __slots.load(boost::memory_order_acquire); s; s = s->next) {
+            const uint64_t e = s->epoch.load(boost::memory_order_acquire);
+            if (e and e < oldest) {
+                oldest = e;
+            }
+        }
+        return oldest;
+    }
+
+    boost::atomic<uint64_t> __epoch;
+    boost::atomic<slot*>    __slots;
+    boost::mutex            __mutex;
+    std::vector<std::pair<uint64_t, boost::function<void()>>> __retired;
+};
+
+
+// a read section of the calling thread, objects reachable from a shared root stay valid until
+// it ends. sections nest, the outermost counts
+struct epoch_guard: public boost::noncopyable
+{
+    epoch_guard(void):__reader(reader())
+    {
+        if (__reader.depth++ == 0) {
+            epoch_domain::instance().enter(__reader.slot);
+        }
+    }
+
+    ~epoch_guard(void)
+    {
+        if (--__reader.depth == 0) {
+            epoch_domain::instance().leave(__reader.slot);
+        }
+    }
+
+protected:
+    struct thread_reader
+    {
+        epoch_domain::slot* slot;
+        size_t depth;
+
+        thread_reader(void):slot(epoch_domain::instance().acquire()), depth(0)
+        {
+        }
+
+        ~thread_reader(void)
+        {
+            epoch_domain::instance().release(slot);
+        }
+    };
+
+    static thread_reader& reader(void)
+    {
+        static thread_local thread_reader r;
+        return r;
+    }
+
+    thread_reader& __reader;
+};
+
+}//basiohttp
+
+
+#endif//EPOCH_HTTP_HPP
@@ -0,0 +1,320 @@
+/**
+ * file   : filecache.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * open descriptors and stat results of static files, missing paths included
+ */
+#pragma once
+#ifndef FILE_CACHE_HTTP_HPP
+#define FILE_CACHE_HTTP_HPP
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "admission.hpp"
+#include "fileio.hpp"
+
+namespace basiohttp
+{
+
+struct file_cache_options
+{
+    size_t capacity;        // open files kept, least recently used are closed first
+    size_t ttl_ms;          // a file is stat()ed again once its entry is this old
+    size_t missing;         // missing paths remembered
+    size_t missing_ttl_ms;  // and for how long, a file created meanwhile shows up after it
+
+    file_cache_options(void):
+        capacity(1024),
+        ttl_ms(1000),
+        missing(1 << 16),
+        missing_ttl_ms(1000)
+    {
+    }
+};
+
+
+// an open regular file, the descriptor stays open while anybody holds the handle
+struct file_handle: public boost::noncopyable
+{
+    int    fd;
+    size_t size;
+    dev_t  dev;
+    ino_t  ino;
+    timespec mtime;
+
+    file_handle(const int fd, const struct stat& st):
+        fd(fd),
+        size(st.st_size),
+        dev(st.st_dev),
+        ino(st.st_ino),
+        mtime(st.st_mtim)
+    {
+    }
+
+    ~file_handle(void)
+    {
+        ::close(fd);
+    }
+
+    // still the file that `st` describes, unchanged
+    inline bool same(const struct stat& st) const
+    {
+        return dev == st.st_dev and ino == st.st_ino and size == static_cast<size_t>(st.st_size) and
+               mtime.tv_sec == st.st_mtim.tv_sec and mtime.tv_nsec == st.st_mtim.tv_nsec;
+    }
+};
+
+typedef boost::shared_ptr<file_handle> file_handle_ptr;
+
+
+struct file_cache_stats
+{
+    size_t hits;            // answered without a syscall
+    size_t missing_hits;    // of them the path is known to be missing
+    size_t revalidated;     // stat() of an expired entry found it unchanged
+    size_t opened;
+    size_t files;           // open right now
+
+    file_cache_stats(void):hits(0), missing_hits(0), revalidated(0), opened(0), files(0)
+    {
+    }
+};
+
+
+// lookup() is a replacement of file_check() plus the open and stat of a reader. entries are
+// spread over NUM_SHARDS shards by a 64 bit hash of the path, each shard with its own lock, lru
+// list and table of missing paths. the table keeps only hash and expiry of a path, 16 bytes
+// each in MISSING_WAYS way buckets, so a scanner's flood of random paths costs a bounded
+// amount of memory and pushes out the oldest of them, never the open files
+struct file_cache: public boost::noncopyable
+{
+    enum { NUM_SHARDS = 16, MISSING_WAYS = 4 };
+
+    explicit file_cache(const file_cache_options& opts = file_cache_options()):
+        __opts(opts),
+        __ttl_us(opts.ttl_ms * 1000),
+        __missing_ttl_us(opts.missing_ttl_ms * 1000)
+    {
+        __shard_capacity = max<size_t>(opts.capacity / NUM_SHARDS, 1);
+        size_t buckets = 1;
+        while (buckets * MISSING_WAYS * NUM_SHARDS < opts.missing) {
+            buckets <<= 1;
+        }
+        for (auto& s : __shards) {
+            s.missing.resize(buckets * MISSING_WAYS);
+        }
+    }
+
+    // the open file at `path`, null if there is none or it is not a regular file
+    file_handle_ptr lookup(const string& path)
+    {
+        const uint64_t h = path_hash(path);
+        shard& s = __shards[h % NUM_SHARDS];
+        const uint64_t now = steady_us();
+        file_handle_ptr stale;
+        {
+            boost::mutex::scoped_lock lock(s.mutex);
+            if (find_missing(s, h, now)) {
+                ++s.stats.hits;
+                ++s.stats.missing_hits;
+                return file_handle_ptr();
+            }
+            auto found = s.files.find(path);
+            if (found != s.files.end()) {
+                s.lru.splice(s.lru.begin(), s.lru, found->second.position);
+                if (now < found->second.expires) {
+                    ++s.stats.hits;
+                    return found->second.file;
+                }
+                stale = found->second.file;
+            }
+        }
+
+        // outside the lock, a slow disk stalls only the lookups of this path
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 or not S_ISREG(st.st_mode)) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            erase(s, path);
+            add_missing(s, h, now);
+            return file_handle_ptr();
+        }
+        if (stale and stale->same(st)) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            auto found = s.files.find(path);
+            if (found != s.files.end() and found->second.file == stale) {
+                found->second.expires = now + __ttl_us;
+            }
+            ++s.stats.revalidated;
+            return stale;
+        }
+
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            erase(s, path);
+            add_missing(s, h, now);
+            return file_handle_ptr();
+        }
+        if (::fstat(fd, &st) != 0 or not S_ISREG(st.st_mode)) { //replaced between stat and open
+            ::close(fd);
+            return file_handle_ptr();
+        }
+        file_handle_ptr file(new file_handle(fd, st));
+
+        boost::mutex::scoped_lock lock(s.mutex);
+        ++s.stats.opened;
+        auto found = s.files.find(path);
+        if (found != s.files.end()) {
+            found->second.file = file;
+            found->second.expires = now + __ttl_us;
+            return file;
+        }
+        if (s.files.size() >= __shard_capacity) {
+            s.files.erase(s.lru.back());
+            s.lru.pop_back();
+        }
+        s.lru.push_front(path);
+        s.files.emplace(path, entry{file, now + __ttl_us, s.lru.begin()});
+        return file;
+    }
+
+    // forget what is known of `path`, for files changed by the server itself
+    void invalidate(const string& path)
+    {
+        const uint64_t h = path_hash(path);
+        shard& s = __shards[h % NUM_SHARDS];
+        boost::mutex::scoped_lock lock(s.mutex);
+        erase(s, path);
+        missing_path* b = bucket(s, h);
+        for (size_t i = 0; i < MISSING_WAYS; ++i) {
+            if (b[i].hash == h) {
+                b[i].expires = 0;
+            }
+        }
+    }
+
+    void clear(void)
+    {
+        for (auto& s : __shards) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            s.files.clear();
+            s.lru.clear();
+            for (auto& m : s.missing) {
+                m.expires = 0;
+            }
+        }
+    }
+
+    file_cache_stats stats(void)
+    {
+        file_cache_stats total;
+        for (auto& s : __shards) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            total.hits += s.stats.hits;
+            total.missing_hits += s.stats.missing_hits;
+            total.revalidated += s.stats.revalidated;
+            total.opened += s.stats.opened;
+            total.files += s.files.size();
+        }
+        return total;
+    }
+
+protected:
+    struct entry
+    {
+        file_handle_ptr file;
+        uint64_t expires;
+        std::list<string>::iterator position;
+    };
+
+    struct missing_path
+    {
+        uint64_t hash;
+        uint64_t expires;   // steady_us, 0 is a free slot
+    };
+
+    struct shard
+    {
+        boost::mutex mutex;
+        boost::unordered_map<string, entry> files;
+        std::list<string> lru;      // most recently used first
+        std::vector<missing_path> missing;
+        file_cache_stats stats;
+        char pad[64];
+    };
+
+    // fnv-1a, the low bits pick the shard and the bits above them the bucket
+    static inline uint64_t path_hash(const string& path)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (const char c : path) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+        }
+        return h ^ (h >> 29);
+    }
+
+    inline missing_path* bucket(shard& s, const uint64_t h)
+    {
+        const size_t buckets = s.missing.size() / MISSING_WAYS;
+        return &s.missing[((h / NUM_SHARDS) & (buckets - 1)) * MISSING_WAYS];
+    }
+
+    inline bool find_missing(shard& s, const uint64_t h, const uint64_t now)
+    {
+        missing_path* b = bucket(s, h);
+        for (size_t i = 0; i < MISSING_WAYS; ++i) {
+            if (b[i].hash == h and now < b[i].expires) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // takes the slot of the same path, else the one expiring first
+    void add_missing(shard& s, const uint64_t h, const uint64_t now)
+    {
+        missing_path* b = bucket(s, h);
+        missing_path* slot = b;
+        for (size_t i = 0; i < MISSING_WAYS; ++i) {
+            if (b[i].hash == h) {
+                slot = b + i;
+                break;
+            }
+            if (b[i].expires < slot->expires) {
+                slot = b + i;
+            }
+        }
+        slot->hash = h;
+        slot->expires = now + __missing_ttl_us;
+    }
+
+    inline void erase(shard& s, const string& path)
+    {
+        auto found = s.files.find(path);
+        if (found != s.files.end()) {
+            s.lru.erase(found->second.position);
+            s.files.erase(found);
+        }
+    }
+
+    file_cache_options __opts;
+    uint64_t __ttl_us;
+    uint64_t __missing_ttl_us;
+    size_t   __shard_capacity;
+    shard    __shards[NUM_SHARDS];
+};
+
+}//basiohttp
+
+
+#endif//FILE_CACHE_HTTP_HPP
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <fstream>
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace basiohttp
 {
@@ -38,6 +39,7 @@ struct mmap_reader
 {
     string __fn;
     int    __fd;
+    int    __borrowed;  //descriptor opened by someone else, e.g. file_cache, not closed here
     byte*  __mapped;
     byte   __empty[2];
     size_t __fsize;
@@ -47,13 +49,25 @@ struct mmap_reader
     {
         __fn = filename;
         __fd = -1;
+        __borrowed = -1;
         __mapped = nullptr;
+        __fsize = 0;
         bzero(&__empty, sizeof(__empty));
         if (file_check(filename)) {
             __fsize = boost::filesystem::file_size(filename);
         }
     }
 
+    // maps an open file of known size, no stat and no open
+    mmap_reader(const int fd, const size_t size)
+    {
+        __fd = -1;
+        __borrowed = fd;
+        __mapped = nullptr;
+        __fsize = size;
+        bzero(&__empty, sizeof(__empty));
+    }
+
     ~mmap_reader(void)
     {
         if (__fd > 0) {
@@ -78,14 +92,17 @@ struct mmap_reader
             return __empty;
         }
 
-        __fd = ::open64(__fn.c_str(), O_RDONLY);
-        if (__fd <= 0) {
-            //std::cerr << "IO Error" << __fn << "\n";
-            return nullptr;
+        if (__borrowed < 0) {
+            __fd = ::open64(__fn.c_str(), O_RDONLY);
+            if (__fd <= 0) {
+                //std::cerr << "IO Error" << __fn << "\n";
+                return nullptr;
+            }
         }
 
-        __mapped = (byte*)::mmap64(0, __fsize, PROT_READ, MAP_PRIVATE, __fd, 0);
+        __mapped = (byte*)::mmap64(0, __fsize, PROT_READ, MAP_PRIVATE, __borrowed < 0 ? __fd : __borrowed, 0);
         if (__mapped == (byte*)(-1)) {
+            __mapped = nullptr;
             return nullptr;
         }
         assert(__mapped);
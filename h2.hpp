@@ -0,0 +1,1553 @@
+/**
+ * file   : h2.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * http/2 for server_base: frames, hpack and one multiplexed session per connection,
+ * entered by the h2c prior knowledge preface or by alpn "h2" on https
+ */
+#pragma once
+#ifndef H2_HTTP_HPP
+#define H2_HTTP_HPP
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_map.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "reply.hpp"
+#include "admission.hpp"
+#include "serverbase.hpp"
+
+namespace basiohttp
+{
+
+enum H2_FRAME_TYPE
+{
+    h2_data = 0,
+    h2_headers,
+    h2_priority,
+    h2_rst_stream,
+    h2_settings,
+    h2_push_promise,
+    h2_ping,
+    h2_goaway,
+    h2_window_update,
+    h2_continuation
+};
+
+enum H2_FLAG
+{
+    h2_end_stream   = 0x1,
+    h2_ack          = 0x1,
+    h2_end_headers  = 0x4,
+    h2_padded       = 0x8,
+    h2_priority_set = 0x20
+};
+
+enum H2_ERROR
+{
+    h2_no_error = 0,
+    h2_protocol_error,
+    h2_internal_error,
+    h2_flow_control_error,
+    h2_settings_timeout,
+    h2_stream_closed,
+    h2_frame_size_error,
+    h2_refused_stream,
+    h2_cancel,
+    h2_compression_error,
+    h2_connect_error,
+    h2_enhance_your_calm
+};
+
+enum H2_SETTING
+{
+    h2_header_table_size = 1,
+    h2_enable_push,
+    h2_max_concurrent_streams,
+    h2_initial_window_size,
+    h2_max_frame_size,
+    h2_max_header_list_size
+};
+
+const char    H2_PREFACE[]      = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t  H2_PREFACE_SIZE   = sizeof(H2_PREFACE) - 1;
+const size_t  H2_PREFACE_H1     = 18;           // "PRI * HTTP/2.0\r\n\r\n", parsed as an http/1 request
+const size_t  H2_FRAME_HEADER   = 9;
+const size_t  H2_DEFAULT_FRAME  = 16384;        // we never announce a larger SETTINGS_MAX_FRAME_SIZE
+const size_t  H2_MAX_HEADER_LIST = 1 << 16;     // SETTINGS_MAX_HEADER_LIST_SIZE we announce
+const size_t  H2_MAX_HEADER_BLOCK = H2_MAX_HEADER_LIST;   // compressed, a block beyond ends the connection
+const size_t  H2_TABLE_SIZE     = 4096;
+const int64_t H2_DEFAULT_WINDOW = 65535;
+const int64_t H2_MAX_WINDOW     = 0x7fffffff;
+const size_t  H2_MAX_STREAMS    = 128;          // SETTINGS_MAX_CONCURRENT_STREAMS we announce
+const int64_t H2_STREAM_WINDOW  = 1 << 20;      // receive window of every stream
+const int64_t H2_CONNECTION_WINDOW = 1 << 24;   // receive window of the connection
+
+typedef std::vector<std::pair<string, string>> header_list;
+
+
+//// hpack (rfc 7541) ////////////////////////////////////////////////////////////////////////////
+struct huffman_code
+{
+    uint32_t code;
+    uint8_t  bits;
+};
+
+// appendix b, symbol 256 is EOS
+inline const huffman_code* huffman_table(void)
+{
+    static const huffman_code table[257] = {
+        {0x00001ff8, 13}, {0x007fffd8, 23}, {0x0fffffe2, 28}, {0x0fffffe3, 28},
+        {0x0fffffe4, 28}, {0x0fffffe5, 28}, {0x0fffffe6, 28}, {0x0fffffe7, 28},
+        {0x0fffffe8, 28}, {0x00ffffea, 24}, {0x3ffffffc, 30}, {0x0fffffe9, 28},
+        {0x0fffffea, 28}, {0x3ffffffd, 30}, {0x0fffffeb, 28}, {0x0fffffec, 28},
+        {0x0fffffed, 28}, {0x0fffffee, 28}, {0x0fffffef, 28}, {0x0ffffff0, 28},
+        {0x0ffffff1, 28}, {0x0ffffff2, 28}, {0x3ffffffe, 30}, {0x0ffffff3, 28},
+        {0x0ffffff4, 28}, {0x0ffffff5, 28}, {0x0ffffff6, 28}, {0x0ffffff7, 28},
+        {0x0ffffff8, 28}, {0x0ffffff9, 28}, {0x0ffffffa, 28}, {0x0ffffffb, 28},
+        {0x00000014,  6}, {0x000003f8, 10}, {0x000003f9, 10}, {0x00000ffa, 12},
+        {0x00001ff9, 13}, {0x00000015,  6}, {0x000000f8,  8}, {0x000007fa, 11},
+        {0x000003fa, 10}, {0x000003fb, 10}, {0x000000f9,  8}, {0x000007fb, 11},
+        {0x000000fa,  8}, {0x00000016,  6}, {0x00000017,  6}, {0x00000018,  6},
+        {0x00000000,  5}, {0x00000001,  5}, {0x00000002,  5}, {0x00000019,  6},
+        {0x0000001a,  6}, {0x0000001b,  6}, {0x0000001c,  6}, {0x0000001d,  6},
+        {0x0000001e,  6}, {0x0000001f,  6}, {0x0000005c,  7}, {0x000000fb,  8},
+        {0x00007ffc, 15}, {0x00000020,  6}, {0x00000ffb, 12}, {0x000003fc, 10},
+        {0x00001ffa, 13}, {0x00000021,  6}, {0x0000005d,  7}, {0x0000005e,  7},
+        {0x0000005f,  7}, {0x00000060,  7}, {0x00000061,  7}, {0x00000062,  7},
+        {0x00000063,  7}, {0x00000064,  7}, {0x00000065,  7}, {0x00000066,  7},
+        {0x00000067,  7}, {0x00000068,  7}, {0x00000069,  7}, {0x0000006a,  7},
+        {0x0000006b,  7}, {0x0000006c,  7}, {0x0000006d,  7}, {0x0000006e,  7},
+        {0x0000006f,  7}, {0x00000070,  7}, {0x00000071,  7}, {0x00000072,  7},
+        {0x000000fc,  8}, {0x00000073,  7}, {0x000000fd,  8}, {0x00001ffb, 13},
+        {0x0007fff0, 19}, {0x00001ffc, 13}, {0x00003ffc, 14}, {0x00000022,  6},
+        {0x00007ffd, 15}, {0x00000003,  5}, {0x00000023,  6}, {0x00000004,  5},
+        {0x00000024,  6}, {0x00000005,  5}, {0x00000025,  6}, {0x00000026,  6},
+        {0x00000027,  6}, {0x00000006,  5}, {0x00000074,  7}, {0x00000075,  7},
+        {0x00000028,  6}, {0x00000029,  6}, {0x0000002a,  6}, {0x00000007,  5},
+        {0x0000002b,  6}, {0x00000076,  7}, {0x0000002c,  6}, {0x00000008,  5},
+        {0x00000009,  5}, {0x0000002d,  6}, {0x00000077,  7}, {0x00000078,  7},
+        {0x00000079,  7}, {0x0000007a,  7}, {0x0000007b,  7}, {0x00007ffe, 15},
+        {0x000007fc, 11}, {0x00003ffd, 14}, {0x00001ffd, 13}, {0x0ffffffc, 28},
+        {0x000fffe6, 20}, {0x003fffd2, 22}, {0x000fffe7, 20}, {0x000fffe8, 20},
+        {0x003fffd3, 22}, {0x003fffd4, 22}, {0x003fffd5, 22}, {0x007fffd9, 23},
+        {0x003fffd6, 22}, {0x007fffda, 23}, {0x007fffdb, 23}, {0x007fffdc, 23},
+        {0x007fffdd, 23}, {0x007fffde, 23}, {0x00ffffeb, 24}, {0x007fffdf, 23},
+        {0x00ffffec, 24}, {0x00ffffed, 24}, {0x003fffd7, 22}, {0x007fffe0, 23},
+        {0x00ffffee, 24}, {0x007fffe1, 23}, {0x007fffe2, 23}, {0x007fffe3, 23},
+        {0x007fffe4, 23}, {0x001fffdc, 21}, {0x003fffd8, 22}, {0x007fffe5, 23},
+        {0x003fffd9, 22}, {0x007fffe6, 23}, {0x007fffe7, 23}, {0x00ffffef, 24},
+        {0x003fffda, 22}, {0x001fffdd, 21}, {0x000fffe9, 20}, {0x003fffdb, 22},
+        {0x003fffdc, 22}, {0x007fffe8, 23}, {0x007fffe9, 23}, {0x001fffde, 21},
+        {0x007fffea, 23}, {0x003fffdd, 22}, {0x003fffde, 22}, {0x00fffff0, 24},
+        {0x001fffdf, 21}, {0x003fffdf, 22}, {0x007fffeb, 23}, {0x007fffec, 23},
+        {0x001fffe0, 21}, {0x001fffe1, 21}, {0x003fffe0, 22}, {0x001fffe2, 21},
+        {0x007fffed, 23}, {0x003fffe1, 22}, {0x007fffee, 23}, {0x007fffef, 23},
+        {0x000fffea, 20}, {0x003fffe2, 22}, {0x003fffe3, 22}, {0x003fffe4, 22},
+        {0x007ffff0, 23}, {0x003fffe5, 22}, {0x003fffe6, 22}, {0x007ffff1, 23},
+        {0x03ffffe0, 26}, {0x03ffffe1, 26}, {0x000fffeb, 20}, {0x0007fff1, 19},
+        {0x003fffe7, 22}, {0x007ffff2, 23}, {0x003fffe8, 22}, {0x01ffffec, 25},
+        {0x03ffffe2, 26}, {0x03ffffe3, 26}, {0x03ffffe4, 26}, {0x07ffffde, 27},
+        {0x07ffffdf, 27}, {0x03ffffe5, 26}, {0x00fffff1, 24}, {0x01ffffed, 25},
+        {0x0007fff2, 19}, {0x001fffe3, 21}, {0x03ffffe6, 26}, {0x07ffffe0, 27},
+        {0x07ffffe1, 27}, {0x03ffffe7, 26}, {0x07ffffe2, 27}, {0x00fffff2, 24},
+        {0x001fffe4, 21}, {0x001fffe5, 21}, {0x03ffffe8, 26}, {0x03ffffe9, 26},
+        {0x0ffffffd, 28}, {0x07ffffe3, 27}, {0x07ffffe4, 27}, {0x07ffffe5, 27},
+        {0x000fffec, 20}, {0x00fffff3, 24}, {0x000fffed, 20}, {0x001fffe6, 21},
+        {0x003fffe9, 22}, {0x001fffe7, 21}, {0x001fffe8, 21}, {0x007ffff3, 23},
+        {0x003fffea, 22}, {0x003fffeb, 22}, {0x01ffffee, 25}, {0x01ffffef, 25},
+        {0x00fffff4, 24}, {0x00fffff5, 24}, {0x03ffffea, 26}, {0x007ffff4, 23},
+        {0x03ffffeb, 26}, {0x07ffffe6, 27}, {0x03ffffec, 26}, {0x03ffffed, 26},
+        {0x07ffffe7, 27}, {0x07ffffe8, 27}, {0x07ffffe9, 27}, {0x07ffffea, 27},
+        {0x07ffffeb, 27}, {0x0ffffffe, 28}, {0x07ffffec, 27}, {0x07ffffed, 27},
+        {0x07ffffee, 27}, {0x07ffffef, 27}, {0x07fffff0, 27}, {0x03ffffee, 26},
+        {0x3fffffff, 30},
+    };
+    return table;
+}
+
+// binary tree of the code, a negative child is a leaf holding -(symbol + 1)
+struct huffman_tree
+{
+    struct node
+    {
+        int child[2];
+        node(void)
+        {
+            child[0] = child[1] = 0;
+        }
+    };
+
+    huffman_tree(void):nodes(1)
+    {
+        auto table = huffman_table();
+        for (int sym = 0; sym < 257; ++sym) {
+            int cur = 0;
+            for (int b = table[sym].bits - 1; b >= 0; --b) {
+                const int bit = (table[sym].code >> b) & 1;
+                if (b == 0) {
+                    nodes[cur].child[bit] = -(sym + 1);
+                    break;
+                }
+                if (nodes[cur].child[bit] == 0) {
+                    const int next = nodes.size();
+                    nodes.push_back(node());
+                    nodes[cur].child[bit] = next;
+                }
+                cur = nodes[cur].child[bit];
+            }
+        }
+    }
+
+    std::vector<node> nodes;
+};
+
+// false on EOS in the string or padding that is not a prefix of EOS
+inline bool huffman_decode(const uint8_t* p, const size_t n, string& out)
+{
+    static const huffman_tree tree;
+    int cur = 0;
+    unsigned depth = 0;
+    bool ones = true;
+    for (size_t i = 0; i < n; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            const int bit = (p[i] >> b) & 1;
+            const int next = tree.nodes[cur].child[bit];
+            ++depth;
+            ones = ones and bit;
+            if (next < 0) {
+                if (next == -257) {
+                    return false;
+                }
+                out.push_back(static_cast<char>(-next - 1));
+                cur = 0;
+                depth = 0;
+                ones = true;
+            }
+            else {
+                cur = next;
+            }
+        }
+    }
+    return depth <= 7 and ones;
+}
+
+inline bool hpack_decode_int(const uint8_t*& p, const uint8_t* end, const unsigned prefix, uint64_t& value)
+{
+    if (p == end) {
+        return false;
+    }
+    const uint64_t mask = (1u << prefix) - 1;
+    value = *p++ & mask;
+    if (value < mask) {
+        return true;
+    }
+    unsigned shift = 0;
+    uint8_t b = 0;
+    do {
+        if (p == end or shift > 28) {
+            return false;
+        }
+        b = *p++;
+        value += static_cast<uint64_t>(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return true;
+}
+
+inline void hpack_encode_int(string& out, uint64_t value, const unsigned prefix, const uint8_t first)
+{
+    const uint64_t mask = (1u << prefix) - 1;
+    if (value < mask) {
+        out.push_back(static_cast<char>(first | value));
+        return;
+    }
+    out.push_back(static_cast<char>(first | mask));
+    value -= mask;
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// static table (appendix a) plus the dynamic table, index 1 is the first static entry and
+// index 62 the newest dynamic one
+struct hpack_table
+{
+    enum { STATIC_SIZE = 61 };
+
+    explicit hpack_table(const size_t max_size):__size(0), __max(max_size)
+    {
+    }
+
+    static const std::pair<const char*, const char*>* static_table(void)
+    {
+        static const std::pair<const char*, const char*> table[STATIC_SIZE] = {
+            {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+            {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+            {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+            {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+            {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+            {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+            {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+            {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+            {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+            {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+            {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+            {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+            {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+            {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+            {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+            {"www-authenticate", ""}
+        };
+        return table;
+    }
+
+    bool get(const size_t index, string& name, string& value) const
+    {
+        if (index == 0) {
+            return false;
+        }
+        if (index <= STATIC_SIZE) {
+            name = static_table()[index - 1].first;
+            value = static_table()[index - 1].second;
+            return true;
+        }
+        if (index - STATIC_SIZE > __entries.size()) {
+            return false;
+        }
+        const auto& e = __entries[index - STATIC_SIZE - 1];
+        name = e.first;
+        value = e.second;
+        return true;
+    }
+
+    // name, value and 32 as the table and SETTINGS_MAX_HEADER_LIST_SIZE count a field, 0 if there
+    // is no field `index`
+    size_t field_size(const size_t index) const
+    {
+        if (index == 0) {
+            return 0;
+        }
+        if (index <= STATIC_SIZE) {
+            return strlen(static_table()[index - 1].first) + strlen(static_table()[index - 1].second) + 32;
+        }
+        if (index - STATIC_SIZE > __entries.size()) {
+            return 0;
+        }
+        const auto& e = __entries[index - STATIC_SIZE - 1];
+        return e.first.size() + e.second.size() + 32;
+    }
+
+    void add(const string& name, const string& value)
+    {
+        const size_t size = name.size() + value.size() + 32;
+        if (size > __max) {
+            __entries.clear(); //an entry larger than the table empties it
+            __size = 0;
+            return;
+        }
+        evict(__max - size);
+        __entries.emplace_front(name, value);
+        __size += size;
+    }
+
+    void resize(const size_t max_size)
+    {
+        __max = max_size;
+        evict(__max);
+    }
+
+    // exact match, or 0 and the index of the first entry with this name in `name_index`
+    size_t find(const string& name, const string& value, size_t& name_index) const
+    {
+        name_index = 0;
+        static const boost::unordered_map<string, size_t> statics = build_static_index();
+        auto exact = statics.find(name + '\0' + value);
+        if (exact != statics.end()) {
+            return exact->second;
+        }
+        auto named = statics.find(name);
+        if (named != statics.end()) {
+            name_index = named->second;
+        }
+        for (size_t i = 0; i < __entries.size(); ++i) {
+            if (__entries[i].first == name) {
+                if (__entries[i].second == value) {
+                    return STATIC_SIZE + 1 + i;
+                }
+                if (not name_index) {
+                    name_index = STATIC_SIZE + 1 + i;
+                }
+            }
+        }
+        return 0;
+    }
+
+    static boost::unordered_map<string, size_t> build_static_index(void)
+    {
+        boost::unordered_map<string, size_t> index;
+        for (size_t i = STATIC_SIZE; i > 0; --i) {
+            const auto& e = static_table()[i - 1];
+            index[e.first] = i;
+            if (*e.second) {
+                index[string(e.first) + '\0' + e.second] = i;
+            }
+        }
+        return index;
+    }
+
+    void evict(const size_t limit)
+    {
+        while (__size > limit and not __entries.empty()) {
+            __size -= __entries.back().first.size() + __entries.back().second.size() + 32;
+            __entries.pop_back();
+        }
+    }
+
+    std::deque<std::pair<string, string>> __entries; //newest first
+    size_t __size;
+    size_t __max;
+};
+
+
+struct hpack_decoder
+{
+    hpack_decoder(void):__table(H2_TABLE_SIZE)
+    {
+    }
+
+    // false on a malformed block, the connection cannot go on then (COMPRESSION_ERROR). once the
+    // fields add up to more than `limit`, counted as SETTINGS_MAX_HEADER_LIST_SIZE counts them,
+    // none is kept: `too_large` is set, `out` left empty, the rest of the block is decoded only to
+    // keep the dynamic table in sync and indexed fields are not even copied
+    bool decode(const uint8_t* p, const size_t n, header_list& out, bool& too_large,
+                const size_t limit = H2_MAX_HEADER_LIST)
+    {
+        const uint8_t* end = p + n;
+        size_t total = 0;
+        too_large = false;
+        std::pair<string, string> field;
+        while (p < end) {
+            const uint8_t b = *p;
+            uint64_t index = 0;
+            if (b & 0x80) {
+                if (not hpack_decode_int(p, end, 7, index)) {
+                    return false;
+                }
+                const size_t size = __table.field_size(index);
+                if (not size) {
+                    return false;
+                }
+                total += size;
+                too_large = too_large or total > limit;
+                if (not too_large) {
+                    out.push_back(std::pair<string, string>());
+                    __table.get(index, out.back().first, out.back().second);
+                }
+                continue;
+            }
+            if (b & 0x40) {
+                if (not literal(p, end, 6, field)) {
+                    return false;
+                }
+                __table.add(field.first, field.second);
+            }
+            else if (b & 0x20) {
+                if (not hpack_decode_int(p, end, 5, index) or index > H2_TABLE_SIZE) {
+                    return false;
+                }
+                __table.resize(index);
+                continue;
+            }
+            else if (not literal(p, end, 4, field)) { //without indexing and never indexed
+                return false;
+            }
+            total += field.first.size() + field.second.size() + 32;
+            too_large = too_large or total > limit;
+            if (not too_large) {
+                out.push_back(field);
+            }
+        }
+        if (too_large) {
+            out.clear();
+        }
+        return true;
+    }
+
+    bool literal(const uint8_t*& p, const uint8_t* end, const unsigned prefix, std::pair<string, string>& h)
+    {
+        uint64_t index = 0;
+        if (not hpack_decode_int(p, end, prefix, index)) {
+            return false;
+        }
+        if (index) {
+            string ignored;
+            if (not __table.get(index, h.first, ignored)) {
+                return false;
+            }
+        }
+        else if (not decode_string(p, end, h.first)) {
+            return false;
+        }
+        return decode_string(p, end, h.second);
+    }
+
+    static bool decode_string(const uint8_t*& p, const uint8_t* end, string& out)
+    {
+        if (p == end) {
+            return false;
+        }
+        const bool huffman = *p & 0x80;
+        uint64_t length = 0;
+        if (not hpack_decode_int(p, end, 7, length) or length > static_cast<uint64_t>(end - p)) {
+            return false;
+        }
+        if (huffman) {
+            if (not huffman_decode(p, length, out)) {
+                return false;
+            }
+        }
+        else {
+            out.assign(reinterpret_cast<const char*>(p), length);
+        }
+        p += length;
+        return true;
+    }
+
+    hpack_table __table;
+};
+
+
+// no huffman, repeated response headers (server, content-type, date...) go into the dynamic table
+struct hpack_encoder
+{
+    hpack_encoder(void):__table(H2_TABLE_SIZE), __resized(false)
+    {
+    }
+
+    // SETTINGS_HEADER_TABLE_SIZE of the peer, we never use more than the default
+    void set_max_size(const size_t size)
+    {
+        const size_t use = min(size, H2_TABLE_SIZE);
+        if (use != __table.__max) {
+            __table.resize(use);
+            __resized = true;
+        }
+    }
+
+    void encode(const header_list& headers, string& out)
+    {
+        if (__resized) {
+            hpack_encode_int(out, __table.__max, 5, 0x20);
+            __resized = false;
+        }
+        for (auto& h : headers) {
+            size_t name_index = 0;
+            const size_t index = __table.find(h.first, h.second, name_index);
+            if (index) {
+                hpack_encode_int(out, index, 7, 0x80);
+                continue;
+            }
+            const bool indexing = h.second.size() <= 128 and h.first != "content-length" and h.first != "set-cookie";
+            hpack_encode_int(out, name_index, indexing ? 6 : 4, indexing ? 0x40 : 0x00);
+            if (not name_index) {
+                encode_string(out, h.first);
+            }
+            encode_string(out, h.second);
+            if (indexing) {
+                __table.add(h.first, h.second);
+            }
+        }
+    }
+
+    static void encode_string(string& out, const string& s)
+    {
+        hpack_encode_int(out, s.size(), 7, 0x00);
+        out.append(s);
+    }
+
+    hpack_table __table;
+    bool __resized;
+};
+
+
+//// mapping to the http/1 view of handlers //////////////////////////////////////////////////////
+
+// "content-type" -> "Content-Type", handlers look headers up the way http/1.1 clients send them
+inline string h1_header_name(const string& name)
+{
+    string out(name);
+    bool upper = true;
+    for (auto& c : out) {
+        if (upper and c >= 'a' and c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        upper = c == '-';
+    }
+    return out;
+}
+
+// pseudo headers become method, path and Host, false if the request is malformed
+inline bool h2_fill_request(const header_list& headers, _request& r)
+{
+    for (auto& h : headers) {
+        if (h.first.empty()) {
+            return false;
+        }
+        if (h.first[0] == ':') {
+            if (h.first == ":method") {
+                r.method = h.second;
+            }
+            else if (h.first == ":path") {
+                r.path = h.second;
+            }
+            else if (h.first == ":authority") {
+                r.header["Host"] = h.second;
+            }
+            else if (h.first != ":scheme") {
+                return false;
+            }
+            continue;
+        }
+        const string name = h1_header_name(h.first);
+        auto found = r.header.find(name);
+        if (found == r.header.end()) {
+            r.header[name] = h.second;
+        }
+        else {
+            found->second += (name == "Cookie" ? "; " : ", ") + h.second;
+        }
+    }
+    r.version = "2.0";
+    return not r.method.empty() and not r.path.empty();
+}
+
+// a response as handlers write it (http/1.x status line, headers, body) as :status and headers
+// without the connection specific ones, `body` gets the offset of the body
+inline bool h2_split_response(const char* data, const size_t size, header_list& headers, size_t& body)
+{
+    static const char crlf2[] = "\r\n\r\n";
+    const char* end = data + size;
+    const char* head_end = std::search(data, end, crlf2, crlf2 + 4);
+    if (head_end == end or size < 12 or memcmp(data, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    body = head_end + 4 - data;
+    headers.push_back(std::make_pair(string(":status"), string(data + 9, 3)));
+
+    const char* line = std::find(data, head_end, '\n') + 1;
+    while (line < head_end) {
+        const char* eol = std::find(line, head_end, '\r');
+        const char* colon = std::find(line, eol, ':');
+        if (colon != eol) {
+            string name(line, colon);
+            boost::to_lower(name);
+            const char* value = colon + 1;
+            while (value < eol and *value == ' ') {
+                ++value;
+            }
+            if (name != "connection" and name != "keep-alive" and name != "proxy-connection" and
+                name != "transfer-encoding" and name != "upgrade") {
+                headers.push_back(std::make_pair(name, string(value, eol)));
+            }
+        }
+        line = eol + 2;
+    }
+    return true;
+}
+
+inline void h2_append_frame(string& out, const uint8_t type, const uint8_t flags, const uint32_t stream,
+                            const char* payload, const size_t size)
+{
+    const char header[H2_FRAME_HEADER] = {
+        static_cast<char>(size >> 16), static_cast<char>(size >> 8), static_cast<char>(size),
+        static_cast<char>(type), static_cast<char>(flags),
+        static_cast<char>((stream >> 24) & 0x7f), static_cast<char>(stream >> 16),
+        static_cast<char>(stream >> 8), static_cast<char>(stream)
+    };
+    out.append(header, H2_FRAME_HEADER);
+    out.append(payload, size);
+}
+
+inline uint32_t h2_read32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+inline void h2_write32(char* p, const uint32_t v)
+{
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+
+//// session /////////////////////////////////////////////////////////////////////////////////////
+
+// one http/2 connection. everything but handlers runs on the session strand, streams go
+// through the same route/admission/offload path as http/1 requests and their responses are
+// converted back from what the handler wrote
+template<typename socket_type>
+struct h2_session: public boost::enable_shared_from_this<h2_session<socket_type>>
+{
+    typedef server_base<socket_type> server_type;
+    typedef boost::shared_ptr<socket_type> socket_ptr;
+    typedef boost::shared_ptr<h2_session> pointer;
+
+    struct stream: public boost::enable_shared_from_this<stream>
+    {
+        stream(const uint32_t id, const int64_t send_window):
+            id(id), request(new _request), response(new boost::asio::streambuf),
+            send_window(send_window), recv_window(H2_STREAM_WINDOW), consumed(0), started(0),
+            dispatched(0), limit(nullptr),
+            remote_closed(false), in_handler(false), deferred(false), admitted(false), reset(false),
+            headers_sent(false), pending(0)
+        {
+        }
+
+        uint32_t      id;
+        request_ptr   request;
+        streambuf_ptr response;
+        int64_t       send_window;
+        int64_t       recv_window;
+        int64_t       consumed;     // received since the last WINDOW_UPDATE
+        uint64_t      started;      // steady_us() of the headers read, for the access log
+        uint64_t      dispatched;   // and of the handler dispatched, 0 if none ran
+
+        boost::smatch      matched;
+        handler_for_server handler;
+        route_limit*       limit;
+
+        bool remote_closed;
+        bool in_handler;
+        bool deferred;
+        bool admitted;
+        bool reset;
+        bool headers_sent;
+        boost::atomic<int> pending;
+    };
+    typedef boost::shared_ptr<stream> stream_ptr;
+
+    // `pending` holds bytes read already, h2c has its first 18 preface bytes parsed as http/1
+    static void start(server_type* server, socket_ptr socket, boost::asio::streambuf& pending, const bool h2c)
+    {
+        pointer session(new h2_session(server, socket));
+        session->__in.assign(boost::asio::buffer_cast<const char*>(pending.data()), pending.size());
+        session->__preface = h2c ? H2_PREFACE_H1 : 0;
+        session->__strand.post([session]() { session->begin(); });
+    }
+
+    h2_session(server_type* server, socket_ptr socket):
+        __server(server),
+        __socket(socket),
+        __strand(server->__ioservice),
+        __timer(server->__ioservice),
+        __preface(0),
+        __send_window(H2_DEFAULT_WINDOW),
+        __recv_window(H2_CONNECTION_WINDOW),
+        __consumed(0),
+        __peer_window(H2_DEFAULT_WINDOW),
+        __peer_frame(H2_DEFAULT_FRAME),
+        __last_stream(0),
+        __header_stream(0),
+        __header_end_stream(false),
+        __read_at(0),
+        __writing(false),
+        __closing(false),
+        __closed(false),
+        __peer_goaway(false)
+    {
+    }
+
+protected:
+    void begin(void)
+    {
+        error_code ec;
+        auto address = __socket->lowest_layer().remote_endpoint(ec).address();
+        if (not ec) {
+            __address = address.to_string();
+            __peer = make_ip_key(address);
+        }
+
+        char settings[18];
+        settings[0] = 0;
+        settings[1] = h2_max_concurrent_streams;
+        h2_write32(settings + 2, H2_MAX_STREAMS);
+        settings[6] = 0;
+        settings[7] = h2_initial_window_size;
+        h2_write32(settings + 8, H2_STREAM_WINDOW);
+        settings[12] = 0;
+        settings[13] = h2_max_header_list_size;
+        h2_write32(settings + 14, H2_MAX_HEADER_LIST);
+        h2_append_frame(__out, h2_settings, 0, 0, settings, sizeof(settings));
+        window_update(0, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+
+        __read_at = steady_us();
+        process();
+        flush();
+        if (not __closing) {
+            arm_timer();
+            read();
+        }
+    }
+
+    void read(void)
+    {
+        pointer self = this->shared_from_this();
+        __socket->async_read_some(boost::asio::buffer(__rbuf),
+            __strand.wrap([self](const error_code& ec, const size_t nbytes) {
+                self->on_read(ec, nbytes);
+            })
+        );
+    }
+
+    void on_read(const error_code& ec, const size_t nbytes)
+    {
+        if (ec or __closed) {
+            close_now();
+            return;
+        }
+        __in.append(__rbuf, nbytes);
+        __read_at = steady_us();
+        process();
+        flush();
+        if (not __closing) {
+            arm_timer();
+            read();
+        }
+    }
+
+    // idle connections (no stream in flight) are closed after the connection timeout
+    void arm_timer(void)
+    {
+        if (not __server->__con_timeout) {
+            return;
+        }
+        pointer self = this->shared_from_this();
+        __timer.expires_after(std::chrono::seconds(__server->__con_timeout));
+        __timer.async_wait(__strand.wrap([self](const error_code& ec) {
+            if (ec or self->__closed or self->__timer.expiry() > boost::asio::steady_timer::clock_type::now()) {
+                return;
+            }
+            if (self->__streams.empty()) {
+                self->goaway(h2_no_error);
+                self->flush();
+            }
+            else {
+                self->arm_timer();
+            }
+        }));
+    }
+
+    void flush(void)
+    {
+        if (__writing or __closed) {
+            return;
+        }
+        if (__out.empty()) {
+            if (__closing) {
+                close_now();
+            }
+            return;
+        }
+        __writing = true;
+        __wbuf.swap(__out);
+        __out.clear();
+        pointer self = this->shared_from_this();
+        boost::asio::async_write(*__socket, boost::asio::buffer(__wbuf),
+            __strand.wrap([self](const error_code& ec, const size_t) {
+                self->__writing = false;
+                self->__wbuf.clear();
+                if (ec) {
+                    self->close_now();
+                    return;
+                }
+                self->flush();
+            })
+        );
+    }
+
+    void close_now(void)
+    {
+        if (__closed) {
+            return;
+        }
+        __closed = true;
+        __closing = true;
+        __timer.cancel();
+        error_code ignored;
+        __socket->lowest_layer().shutdown(asio_socket::shutdown_both, ignored);
+        __socket->lowest_layer().close(ignored);
+        for (auto it = __streams.begin(); it != __streams.end(); ) {
+            if (not it->second->in_handler) {
+                release(*it->second);
+                it = __streams.erase(it);
+            }
+            else {
+                ++it; //completed() releases it
+            }
+        }
+    }
+
+    void goaway(const H2_ERROR code)
+    {
+        if (__closing) {
+            return;
+        }
+        char payload[8];
+        h2_write32(payload, __last_stream);
+        h2_write32(payload + 4, code);
+        h2_append_frame(__out, h2_goaway, 0, 0, payload, sizeof(payload));
+        __closing = true;
+        if (code != h2_no_error) {
+            __server->__loger.commit("h2_session", "goaway " + dtos(static_cast<int>(code)), "ERROR");
+        }
+    }
+
+    void window_update(const uint32_t id, const int64_t increment)
+    {
+        char payload[4];
+        h2_write32(payload, increment);
+        h2_append_frame(__out, h2_window_update, 0, id, payload, sizeof(payload));
+    }
+
+    void process(void)
+    {
+        size_t pos = 0;
+        if (__preface < H2_PREFACE_SIZE) {
+            const size_t have = min(H2_PREFACE_SIZE - __preface, __in.size());
+            if (memcmp(__in.data(), H2_PREFACE + __preface, have) != 0) {
+                goaway(h2_protocol_error);
+                return;
+            }
+            __preface += have;
+            pos = have;
+        }
+        while (not __closing and __in.size() - pos >= H2_FRAME_HEADER) {
+            auto h = reinterpret_cast<const uint8_t*>(__in.data() + pos);
+            const size_t length = (h[0] << 16) | (h[1] << 8) | h[2];
+            if (length > H2_DEFAULT_FRAME) {
+                goaway(h2_frame_size_error);
+                break;
+            }
+            if (__in.size() - pos - H2_FRAME_HEADER < length) {
+                break;
+            }
+            on_frame(h[3], h[4], h2_read32(h + 5) & 0x7fffffff, h + H2_FRAME_HEADER, length);
+            pos += H2_FRAME_HEADER + length;
+        }
+        __in.erase(0, pos);
+    }
+
+    void on_frame(const uint8_t type, const uint8_t flags, const uint32_t id, const uint8_t* p, const size_t n)
+    {
+        if (__header_stream and (type != h2_continuation or id != __header_stream)) {
+            goaway(h2_protocol_error); //a header block must not be interleaved
+            return;
+        }
+        switch (type) {
+        case h2_data:          on_data(flags, id, p, n); break;
+        case h2_headers:       on_headers(flags, id, p, n); break;
+        case h2_priority:      break;
+        case h2_rst_stream:    on_rst_stream(id, p, n); break;
+        case h2_settings:      on_settings(flags, id, p, n); break;
+        case h2_push_promise:  goaway(h2_protocol_error); break;
+        case h2_ping:          on_ping(flags, id, p, n); break;
+        case h2_goaway:        on_goaway(id); break;
+        case h2_window_update: on_window_update(id, p, n); break;
+        case h2_continuation:  on_continuation(flags, id, p, n); break;
+        default: break; //unknown frame types are ignored
+        }
+    }
+
+    // strips padding, false on a protocol error
+    bool unpad(const uint8_t flags, const uint8_t*& p, size_t& n, const size_t skip)
+    {
+        size_t pad = 0;
+        if (flags & h2_padded) {
+            if (n < 1) {
+                return false;
+            }
+            pad = p[0];
+            ++p;
+            --n;
+        }
+        if (skip + pad > n) {
+            return false;
+        }
+        p += skip;
+        n -= skip + pad;
+        return true;
+    }
+
+    void on_headers(const uint8_t flags, const uint32_t id, const uint8_t* p, size_t n)
+    {
+        if (id == 0 or not unpad(flags, p, n, (flags & h2_priority_set) ? 5 : 0)) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        __header_block.assign(reinterpret_cast<const char*>(p), n);
+        __header_stream = id;
+        __header_end_stream = flags & h2_end_stream;
+        if (flags & h2_end_headers) {
+            on_header_block();
+        }
+    }
+
+    void on_continuation(const uint8_t flags, const uint32_t id, const uint8_t* p, const size_t n)
+    {
+        if (not __header_stream or id != __header_stream) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        __header_block.append(reinterpret_cast<const char*>(p), n);
+        if (__header_block.size() > H2_MAX_HEADER_BLOCK) {
+            goaway(h2_enhance_your_calm);
+            return;
+        }
+        if (flags & h2_end_headers) {
+            on_header_block();
+        }
+    }
+
+    void on_header_block(void)
+    {
+        const uint32_t id = __header_stream;
+        __header_stream = 0;
+        header_list headers;
+        bool too_large = false;
+        // the block is decoded even for streams we refuse, the table has to stay in sync
+        if (not __decoder.decode(reinterpret_cast<const uint8_t*>(__header_block.data()), __header_block.size(),
+                                 headers, too_large)) {
+            goaway(h2_compression_error);
+            return;
+        }
+
+        auto found = __streams.find(id);
+        if (found != __streams.end()) {
+            // trailers
+            auto& st = *found->second;
+            if (too_large) {
+                reset_stream(id, h2_enhance_your_calm);
+                return;
+            }
+            if (st.remote_closed or not __header_end_stream) {
+                reset_stream(id, st.remote_closed ? h2_stream_closed : h2_protocol_error);
+                return;
+            }
+            for (auto& h : headers) {
+                st.request->header[h1_header_name(h.first)] = h.second;
+            }
+            st.remote_closed = true;
+            dispatch(st);
+            return;
+        }
+        if (id % 2 == 0 or id <= __last_stream) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        __last_stream = id;
+        if (__peer_goaway) {
+            return;
+        }
+        // over the SETTINGS_MAX_HEADER_LIST_SIZE we announced, only this stream goes
+        if (too_large) {
+            reset_stream(id, h2_enhance_your_calm);
+            return;
+        }
+        if (__streams.size() >= H2_MAX_STREAMS) {
+            reset_stream(id, h2_refused_stream);
+            return;
+        }
+        stream_ptr st(new stream(id, __peer_window));
+        st->started = __read_at;
+        if (not h2_fill_request(headers, *st->request)) {
+            reset_stream(id, h2_protocol_error);
+            return;
+        }
+        stream* raw = st.get();
+        h2_session* session = this;
+        st->request->__defer = [session, raw]() { return session->defer(*raw); };
+        __streams[id] = st;
+        if (__header_end_stream) {
+            st->remote_closed = true;
+            dispatch(*st);
+        }
+    }
+
+    void on_data(const uint8_t flags, const uint32_t id, const uint8_t* p, size_t n)
+    {
+        const size_t length = n;
+        if (id == 0 or not unpad(flags, p, n, 0)) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        // flow control counts the whole payload, padding included
+        if (static_cast<int64_t>(length) > __recv_window) {
+            goaway(h2_flow_control_error);
+            return;
+        }
+        __recv_window -= length;
+        __consumed += length;
+        if (__consumed >= H2_CONNECTION_WINDOW / 2) {
+            window_update(0, __consumed);
+            __recv_window += __consumed;
+            __consumed = 0;
+        }
+
+        auto found = __streams.find(id);
+        if (found == __streams.end() or found->second->remote_closed) {
+            if (id > __last_stream) {
+                goaway(h2_protocol_error);
+            }
+            else if (found != __streams.end()) {
+                reset_stream(id, h2_stream_closed);
+            }
+            return;
+        }
+        auto& st = *found->second;
+        if (static_cast<int64_t>(length) > st.recv_window) {
+            reset_stream(id, h2_flow_control_error);
+            return;
+        }
+        st.recv_window -= length;
+        auto& buf = st.request->content_buffer;
+        buf.commit(boost::asio::buffer_copy(buf.prepare(n), boost::asio::buffer(p, n)));
+
+        if (flags & h2_end_stream) {
+            st.remote_closed = true;
+            dispatch(st);
+            return;
+        }
+        st.consumed += length;
+        if (st.consumed >= H2_STREAM_WINDOW / 2) {
+            window_update(id, st.consumed);
+            st.recv_window += st.consumed;
+            st.consumed = 0;
+        }
+    }
+
+    void on_rst_stream(const uint32_t id, const uint8_t*, const size_t n)
+    {
+        if (n != 4) {
+            goaway(h2_frame_size_error);
+            return;
+        }
+        if (id == 0 or id > __last_stream) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        drop_stream(id);
+    }
+
+    void on_settings(const uint8_t flags, const uint32_t id, const uint8_t* p, const size_t n)
+    {
+        if (id != 0) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        if (flags & h2_ack) {
+            if (n) {
+                goaway(h2_frame_size_error);
+            }
+            return;
+        }
+        if (n % 6) {
+            goaway(h2_frame_size_error);
+            return;
+        }
+        for (size_t i = 0; i < n; i += 6) {
+            const unsigned key = (p[i] << 8) | p[i + 1];
+            const uint32_t value = h2_read32(p + i + 2);
+            switch (key) {
+            case h2_header_table_size:
+                __encoder.set_max_size(value);
+                break;
+            case h2_enable_push:
+                if (value > 1) {
+                    goaway(h2_protocol_error);
+                    return;
+                }
+                break;
+            case h2_initial_window_size:
+                if (value > H2_MAX_WINDOW) {
+                    goaway(h2_flow_control_error);
+                    return;
+                }
+                for (auto& it : __streams) {
+                    it.second->send_window += static_cast<int64_t>(value) - __peer_window;
+                }
+                __peer_window = value;
+                break;
+            case h2_max_frame_size:
+                if (value < H2_DEFAULT_FRAME or value > 16777215) {
+                    goaway(h2_protocol_error);
+                    return;
+                }
+                __peer_frame = value;
+                break;
+            default:
+                break;
+            }
+        }
+        h2_append_frame(__out, h2_settings, h2_ack, 0, nullptr, 0);
+        flush_blocked();
+    }
+
+    void on_ping(const uint8_t flags, const uint32_t id, const uint8_t* p, const size_t n)
+    {
+        if (n != 8) {
+            goaway(h2_frame_size_error);
+            return;
+        }
+        if (id != 0) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        if (not (flags & h2_ack)) {
+            h2_append_frame(__out, h2_ping, h2_ack, 0, reinterpret_cast<const char*>(p), n);
+        }
+    }
+
+    // the peer sends no new streams, finish the ones we have and close
+    void on_goaway(const uint32_t id)
+    {
+        if (id != 0) {
+            goaway(h2_protocol_error);
+            return;
+        }
+        __peer_goaway = true;
+        if (__streams.empty()) {
+            __closing = true;
+        }
+    }
+
+    void on_window_update(const uint32_t id, const uint8_t* p, const size_t n)
+    {
+        if (n != 4) {
+            goaway(h2_frame_size_error);
+            return;
+        }
+        const int64_t increment = h2_read32(p) & 0x7fffffff;
+        if (id == 0) {
+            if (increment == 0) {
+                goaway(h2_protocol_error);
+                return;
+            }
+            if (__send_window + increment > H2_MAX_WINDOW) {
+                goaway(h2_flow_control_error);
+                return;
+            }
+            __send_window += increment;
+            flush_blocked();
+            return;
+        }
+        auto found = __streams.find(id);
+        if (found == __streams.end()) {
+            return;
+        }
+        auto& st = *found->second;
+        if (increment == 0 or st.send_window + increment > H2_MAX_WINDOW) {
+            reset_stream(id, increment ? h2_flow_control_error : h2_protocol_error);
+            return;
+        }
+        st.send_window += increment;
+        if (st.headers_sent) {
+            send_data(st);
+        }
+    }
+
+    void reset_stream(const uint32_t id, const H2_ERROR code)
+    {
+        char payload[4];
+        h2_write32(payload, code);
+        h2_append_frame(__out, h2_rst_stream, 0, id, payload, sizeof(payload));
+        drop_stream(id);
+    }
+
+    // a stream whose handler still runs is only marked, completed() drops it
+    void drop_stream(const uint32_t id)
+    {
+        auto found = __streams.find(id);
+        if (found == __streams.end()) {
+            return;
+        }
+        auto& st = *found->second;
+        st.reset = true;
+        if (not st.in_handler) {
+            release(st);
+            __streams.erase(found);
+            last_stream_done();
+        }
+    }
+
+    void last_stream_done(void)
+    {
+        if (__peer_goaway and __streams.empty()) {
+            __closing = true;
+        }
+    }
+
+    inline void release(stream& st)
+    {
+        if (st.admitted) {
+            __server->release_request(st.limit);
+            st.admitted = false;
+        }
+    }
+
+    boost::function<void(void)> defer(stream& st)
+    {
+        st.deferred = true;
+        st.pending.store(2); //the handler returning and the done call, whichever comes last resumes
+        pointer self = this->shared_from_this();
+        stream_ptr keep = st.shared_from_this();
+        return [self, keep]() {
+            if (keep->pending.fetch_sub(1) == 1) {
+                self->__strand.post([self, keep]() { self->completed(keep); });
+            }
+        };
+    }
+
+    void reject(stream& st)
+    {
+        __server->__admission_stats.rejected.fetch_add(1, boost::memory_order_relaxed);
+        refuse(st, templates::service_unavailable);
+    }
+
+    void too_many(stream& st)
+    {
+        __server->__admission_stats.limited.fetch_add(1, boost::memory_order_relaxed);
+        refuse(st, templates::too_many_requests);
+    }
+
+    void refuse(stream& st, const string& response)
+    {
+        st.response->consume(st.response->size());
+        ostream(st.response.get()) << response;
+        respond(st);
+    }
+
+    void dispatch(stream& st)
+    {
+        server_type& s = *__server;
+        if (s.__admission.codel_target_us) {
+            const uint64_t now = steady_us();
+            if (not s.__shedder.admit(now - __read_at, now, s.__admission)) {
+                reject(st);
+                return;
+            }
+        }
+
+        const string* route = nullptr;
+        const bool valid = s.valid_request(st.request, st.matched, st.handler, &route);
+        st.limit = s.find_route_limit(route);
+        if (not s.rate_allowed(route, __peer)) {
+            too_many(st);
+            return;
+        }
+        if (not s.admit_request(st.limit)) {
+            reject(st);
+            return;
+        }
+        st.admitted = true;
+        st.request->address = __address;
+        st.request->set_body(st.request->content_buffer.size());
+        if (s.__access) {
+            st.dispatched = steady_us();
+        }
+
+        if (valid) {
+            st.request->match1.assign(st.matched[1]);
+            st.request->match2.assign(st.matched[2]);
+            st.request->match3.assign(st.matched[3]);
+
+            if (s.__offload and s.is_blocking(route, st.request->method)) {
+                offload(st);
+                return;
+            }
+            s.run_handler(st.handler, st.response, st.request);
+            if (st.deferred and st.pending.fetch_sub(1) != 1) {
+                st.in_handler = true; //completed() resumes
+                return;
+            }
+        }
+        else {
+            ostream response(st.response.get());
+            response << templates::bad_request;
+        }
+        respond(st);
+    }
+
+    void offload(stream& st)
+    {
+        pointer self = this->shared_from_this();
+        stream_ptr keep = st.shared_from_this();
+        st.in_handler = true;
+        bool queued = __server->__offload->submit([self, keep]() {
+            self->__server->run_handler(keep->handler, keep->response, keep->request);
+            if (not keep->deferred or keep->pending.fetch_sub(1) == 1) {
+                self->__strand.post([self, keep]() { self->completed(keep); });
+            }
+        });
+        if (not queued) {
+            st.in_handler = false;
+            release(st);
+            reject(st);
+        }
+    }
+
+    void completed(const stream_ptr& st)
+    {
+        st->in_handler = false;
+        if (st->reset or __closed) {
+            release(*st);
+            __streams.erase(st->id);
+            last_stream_done();
+            flush();
+            return;
+        }
+        respond(*st);
+        flush();
+    }
+
+    void respond(stream& st)
+    {
+        auto data = st.response->data();
+        const char* ptr = boost::asio::buffer_cast<const char*>(data);
+        const size_t size = boost::asio::buffer_size(data);
+        header_list headers;
+        size_t body = 0;
+        uint16_t status = response_status(*st.response);
+        if (not h2_split_response(ptr, size, headers, body)) {
+            headers.assign(1, std::make_pair(string(":status"), string("500")));
+            body = size;
+            status = internal_server_error;
+        }
+        st.response->consume(body);
+        if (st.request->method == "HEAD") {
+            st.response->consume(st.response->size());
+        }
+
+        string block;
+        __encoder.encode(headers, block);
+        const bool end = st.response->size() == 0;
+        // HEADERS and as many CONTINUATIONs as the peer frame size needs
+        size_t offset = 0;
+        do {
+            const size_t n = min(block.size() - offset, __peer_frame);
+            const bool last = offset + n == block.size();
+            uint8_t flags = last ? h2_end_headers : 0;
+            if (offset == 0 and end) {
+                flags |= h2_end_stream;
+            }
+            h2_append_frame(__out, offset == 0 ? h2_headers : h2_continuation, flags, st.id, block.data() + offset, n);
+            offset += n;
+        } while (offset < block.size());
+        st.headers_sent = true;
+        if (__server->__access) {
+            const uint64_t now = steady_us();
+            __server->__access->commit(__peer, st.request->method, st.request->path, status,
+                                       block.size() + st.response->size(), now - st.started,
+                                       st.dispatched ? now - st.dispatched : 0);
+        }
+
+        if (end) {
+            finish_stream(st);
+        }
+        else {
+            send_data(st);
+        }
+    }
+
+    // as much of the body as both windows allow, the rest waits for WINDOW_UPDATE
+    void send_data(stream& st)
+    {
+        while (st.response->size() > 0) {
+            const int64_t window = min(__send_window, st.send_window);
+            if (window <= 0) {
+                return;
+            }
+            auto data = st.response->data();
+            const size_t size = boost::asio::buffer_size(data);
+            const size_t n = min(min(size, static_cast<size_t>(window)), __peer_frame);
+            h2_append_frame(__out, h2_data, n == size ? h2_end_stream : 0, st.id,
+                            boost::asio::buffer_cast<const char*>(data), n);
+            st.response->consume(n);
+            __send_window -= n;
+            st.send_window -= n;
+        }
+        finish_stream(st);
+    }
+
+    void flush_blocked(void)
+    {
+        std::vector<uint32_t> blocked;
+        for (auto& it : __streams) {
+            if (it.second->headers_sent and it.second->response->size() > 0) {
+                blocked.push_back(it.first);
+            }
+        }
+        for (auto id : blocked) {
+            auto found = __streams.find(id);
+            if (found != __streams.end()) {
+                send_data(*found->second);
+            }
+        }
+    }
+
+    void finish_stream(stream& st)
+    {
+        release(st);
+        __streams.erase(st.id);
+        last_stream_done();
+    }
+
+    server_type* __server;
+    socket_ptr   __socket;
+    asio_service::strand __strand;
+    boost::asio::steady_timer __timer;
+    string       __address;
+    ip_key       __peer;
+
+    char   __rbuf[16384];
+    string __in;            // read, not yet parsed
+    string __out;           // frames waiting for the running write
+    string __wbuf;          // frames being written
+    size_t __preface;       // preface bytes seen so far
+
+    hpack_decoder __decoder;
+    hpack_encoder __encoder;
+    std::map<uint32_t, stream_ptr> __streams;
+
+    int64_t  __send_window;
+    int64_t  __recv_window;
+    int64_t  __consumed;    // received since the last connection WINDOW_UPDATE
+    int64_t  __peer_window; // SETTINGS_INITIAL_WINDOW_SIZE of the peer
+    size_t   __peer_frame;  // SETTINGS_MAX_FRAME_SIZE of the peer
+    uint32_t __last_stream;
+
+    string   __header_block;
+    uint32_t __header_stream;   // not 0 while CONTINUATION frames are expected
+    bool     __header_end_stream;
+
+    uint64_t __read_at;
+    bool __writing;
+    bool __closing;         // no more reads, close once the output is written
+    bool __closed;
+    bool __peer_goaway;
+};
+
+
+}//basiohttp
+
+
+#endif//H2_HTTP_HPP
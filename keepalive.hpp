@@ -0,0 +1,130 @@
+/**
+ * file   : keepalive.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * persistent connections: what the client asks for, what the response announces
+ */
+#pragma once
+#ifndef KEEP_ALIVE_HTTP_HPP
+#define KEEP_ALIVE_HTTP_HPP
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+struct keep_alive_options
+{
+    size_t max_requests;    // responses on one connection, the last says close, 0 no limit
+    size_t idle_timeout;    // seconds a connection waits for its next request, 0 uses the
+                            // request timeout of the server
+    bool   http10;          // HTTP/1.0 clients sending "Connection: keep-alive" keep theirs
+
+    keep_alive_options(void):
+        max_requests(0),
+        idle_timeout(0),
+        http10(true)
+    {
+    }
+};
+
+
+// the Connection header of a request, either spelling
+inline const string* request_connection(const _request& r)
+{
+    auto found = r.header.find("Connection");
+    if (found == r.header.end()) {
+        found = r.header.find("connection");
+    }
+    return found != r.header.end() ? &found->second : nullptr;
+}
+
+// HTTP/1.1 keeps the connection unless the client says close, HTTP/1.0 only if it says keep-alive
+inline bool client_keeps_alive(const _request& r, const bool http10)
+{
+    const string* connection = request_connection(r);
+    if (r.version == "1.0") {
+        return http10 and connection and boost::ifind_first(*connection, "keep-alive");
+    }
+    return r.version == "1.1" and not (connection and boost::ifind_first(*connection, "close"));
+}
+
+
+// settles whether the connection stays open after `response`, the `served`-th response on it,
+// and makes its head say so. a Connection header the handler wrote wins if it says close and is
+// rewritten otherwise. without one the header is put after the status line only where the
+// client would assume the wrong thing: a HTTP/1.1 client that is going to be closed on, a
+// HTTP/1.0 client that is kept, or a request that could not be parsed. that copies the response, the common case of a HTTP/1.1
+// keep-alive only scans the head
+inline bool settle_keep_alive(const _request& r, boost::asio::streambuf& response, const size_t served,
+                              const keep_alive_options& opts)
+{
+    const bool parsed = not r.method.empty();
+    bool keep = parsed and client_keeps_alive(r, opts.http10) and
+                (not opts.max_requests or served < opts.max_requests);
+    // what the client assumes of a response without the header. one whose request line did
+    // not parse may assume anything, its 400 says close
+    const bool implied = not parsed or r.version == "1.1";
+
+    auto data = response.data();
+    const char* begin = boost::asio::buffer_cast<const char*>(data);
+    const char* end = begin + boost::asio::buffer_size(data);
+    const char* status_end = static_cast<const char*>(memmem(begin, end - begin, "\r\n", 2));
+    if (not status_end) {
+        return false;   //not a response we understand
+    }
+
+    // the Connection line of the head, [line, line_end) without its crlf
+    static const char name[] = "connection:";
+    const char* line = nullptr;
+    const char* line_end = nullptr;
+    for (const char* p = status_end + 2; p < end; ) {
+        const char* eol = static_cast<const char*>(memmem(p, end - p, "\r\n", 2));
+        if (not eol or eol == p) {
+            break;
+        }
+        if (static_cast<size_t>(eol - p) >= sizeof(name) - 1 and strncasecmp(p, name, sizeof(name) - 1) == 0) {
+            line = p;
+            line_end = eol;
+            break;
+        }
+        p = eol + 2;
+    }
+
+    if (line) {
+        const string value(line + sizeof(name) - 1, line_end);
+        const bool says_close = boost::ifind_first(value, "close");
+        if (says_close) {
+            return false;
+        }
+        if (keep and (boost::ifind_first(value, "keep-alive") or implied)) {
+            return true;
+        }
+    }
+    else if (keep == implied) {
+        return keep;
+    }
+
+    static const char alive[] = "Connection: keep-alive";
+    static const char close[] = "Connection: close";
+    const char* replace_begin = line ? line : status_end + 2;
+    const char* replace_end = line ? line_end + 2 : status_end + 2;
+    string copy(begin, end);
+    const size_t from = replace_begin - begin;
+    const size_t to = replace_end - begin;
+    response.consume(response.size());
+    std::ostream out(&response);
+    out.write(copy.data(), from);
+    out.write(keep ? alive : close, keep ? sizeof(alive) - 1 : sizeof(close) - 1);
+    out.write("\r\n", 2);
+    out.write(copy.data() + to, copy.size() - to);
+    return keep;
+}
+
+}//basiohttp
+
+
+#endif//KEEP_ALIVE_HTTP_HPP
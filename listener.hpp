@@ -0,0 +1,121 @@
+/**
+ * file   : listener.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * options of the listening socket and of the accept stage of server_base
+ */
+#pragma once
+#ifndef LISTENER_HTTP_HPP
+#define LISTENER_HTTP_HPP
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <boost/system/system_error.hpp>
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+struct listener_options
+{
+    size_t pending_accepts; // async_accepts kept outstanding, 0 means one per io thread
+    size_t backlog;         // listen() backlog, 0 keeps SOMAXCONN
+    size_t defer_accept;    // TCP_DEFER_ACCEPT seconds: accept only once the request arrived, 0 off
+    size_t fast_open;       // TCP_FASTOPEN queue length, 0 off (needs net.ipv4.tcp_fastopen & 2)
+    bool   nodelay;         // TCP_NODELAY on accepted sockets
+    size_t rcvbuf;          // SO_RCVBUF / SO_SNDBUF of the listener, inherited by accepted
+    size_t sndbuf;          // sockets, 0 keeps the kernel autotuning
+    size_t busy_poll;       // SO_BUSY_POLL microseconds, inherited by accepted sockets, 0 keeps
+                            // net.core.busy_read (raising it needs CAP_NET_ADMIN)
+
+    listener_options(void):
+        pending_accepts(0),
+        backlog(0),
+        defer_accept(0),
+        fast_open(0),
+        nodelay(true),
+        rcvbuf(0),
+        sndbuf(0),
+        busy_poll(0)
+    {
+    }
+};
+
+
+inline void set_listener_option(const int fd, const int level, const int name, const int value, const char* what)
+{
+    if (::setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        throw boost::system::system_error(error_code(errno, boost::system::system_category()), what);
+    }
+}
+
+// socket options of a listening socket, throws boost::system::system_error
+inline void apply_listener_options(const int fd, const listener_options& opts)
+{
+    if (opts.rcvbuf) {
+        set_listener_option(fd, SOL_SOCKET, SO_RCVBUF, opts.rcvbuf, "SO_RCVBUF");
+    }
+    if (opts.sndbuf) {
+        set_listener_option(fd, SOL_SOCKET, SO_SNDBUF, opts.sndbuf, "SO_SNDBUF");
+    }
+#ifdef SO_BUSY_POLL
+    if (opts.busy_poll) {
+        set_listener_option(fd, SOL_SOCKET, SO_BUSY_POLL, opts.busy_poll, "SO_BUSY_POLL");
+    }
+#endif
+    // linux copies it to accepted sockets, the io_uring backend has no fd to set it on
+    set_listener_option(fd, IPPROTO_TCP, TCP_NODELAY, opts.nodelay ? 1 : 0, "TCP_NODELAY");
+#ifdef TCP_DEFER_ACCEPT
+    set_listener_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts.defer_accept, "TCP_DEFER_ACCEPT");
+#endif
+#ifdef TCP_FASTOPEN
+    if (opts.fast_open) {
+        set_listener_option(fd, IPPROTO_TCP, TCP_FASTOPEN, opts.fast_open, "TCP_FASTOPEN");
+    }
+#endif
+}
+
+// on an open, bound acceptor, throws boost::system::system_error
+inline void apply_listener_options(asio_acceptor& acceptor, const listener_options& opts)
+{
+    apply_listener_options(acceptor.native_handle(), opts);
+    if (opts.backlog) {
+        acceptor.listen(opts.backlog); //listen() again only changes the backlog
+    }
+}
+
+// a listener of its own for one io thread: all of them bind `endpoint` with SO_REUSEPORT and the
+// kernel hands a connection to the one whose SO_INCOMING_CPU is the cpu that received it.
+// throws boost::system::system_error
+inline int open_steered_listener(const asio_endpoint& endpoint, const listener_options& opts, const int cpu)
+{
+    const int fd = ::socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw boost::system::system_error(error_code(errno, boost::system::system_category()), "socket");
+    }
+    try {
+        set_listener_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+        set_listener_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+#ifdef SO_INCOMING_CPU
+        set_listener_option(fd, SOL_SOCKET, SO_INCOMING_CPU, cpu, "SO_INCOMING_CPU");
+#endif
+        apply_listener_options(fd, opts);
+        if (::bind(fd, endpoint.data(), endpoint.size()) != 0) {
+            throw boost::system::system_error(error_code(errno, boost::system::system_category()), "bind");
+        }
+        if (::listen(fd, opts.backlog ? opts.backlog : SOMAXCONN) != 0) {
+            throw boost::system::system_error(error_code(errno, boost::system::system_category()), "listen");
+        }
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    return fd;
+}
+
+}//basiohttp
+
+
+#endif//LISTENER_HTTP_HPP
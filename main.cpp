@@ -10,13 +10,68 @@
 #include <iterator>
 #include <boost/algorithm/string.hpp>
 #include <boost/timer.hpp>
+#include <boost/scoped_ptr.hpp>
 #include "fileio.hpp"
 #include "reply.hpp"
 #include "client.hpp"
+#include "download.hpp"
 #include "server.hpp"
 #include "crc.hpp"
+#include "assetpack.hpp"
+#include "shmcache.hpp"
+#include "singleflight.hpp"
 
 
+// files under web/, a hit is written from the cache of `loads`, a burst of misses for one file,
+// e.g. after a restart, loads it once
+template<typename Cache>
+basiohttp::handler_for_server get_files(basiohttp::single_flight<Cache>& loads,
+                                       basiohttp::node_local<basiohttp::file_cache>& files)
+{
+    using namespace basiohttp;
+    return [&loads, &files](streambuf_ptr resbuf, request_ptr r) {
+        ostream response(resbuf.get());
+        string filename = "web/";
+        string path = r->match1;
+        size_t pos = 0;
+        while((pos = path.find("..")) != string::npos) {
+            path.erase(pos, 1);
+        }
+        filename += path;
+        if (filename.find('.') == string::npos) {
+            if(*filename.rbegin() != '/') {
+                filename += '/';
+            }
+            filename += "index.html";
+        }
+        auto file = files.local().lookup(filename);
+        if (not file) {
+            const string ct = "<html><h1>404 Not Found</h1>\n<h3>Your IP: " + r->address + "</h3></html>";
+            header_builder(*resbuf).status(not_found).content_type(mime_html).content_length(ct.size()).end();
+            response << ct;
+            return;
+        }
+        // cached head holds the entity headers only, status line and Date are written per response
+        if (loads.join(filename, resbuf, r) != flight_lead) {
+            return;
+        }
+        ring_reader mr(file);
+        auto buf = mr.read();
+        if (not buf) {
+            loads.land(filename, response_ptr());
+            header_builder(*resbuf).status(internal_server_error).content_length(0).end();
+            return;
+        }
+        response_ptr pres(new _response);
+        pres->head = "Content-Type: " + path_to_type(filename) + "\r\n"
+                     "Content-Length: " + dtos(mr.size()) + "\r\n\r\n";
+        pres->content.assign(buf, mr.size());
+        loads.land(filename, pres);
+        header_builder(*resbuf).status(ok).write(pres->head);
+        response << pres->content;
+    };
+}
+
 
 int main(int argc, char* argv[])
 {
@@ -28,67 +83,111 @@ int main(int argc, char* argv[])
     ipv4_address addr;
     addr.from_string("0.0.0.0");
     server<asio_http> webserver1(addr, 8888, 16, 30, 300);
+    size_t workers = 0; // --workers N: pre-fork mode with N processes
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--uring") {
+            webserver1.set_backend(backend_uring); //http/1 only, no h2c and no websockets (/chat)
+        }
+        else if (string(argv[i]) == "--workers" and i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        }
+        else if (string(argv[i]) == "--pin") {
+            webserver1.set_affinity(affinity_options(affinity_scatter));
+        }
+        else if (string(argv[i]) == "--spin" and i + 1 < argc) {
+            webserver1.set_busy_poll(atoi(argv[++i]));
+        }
+        else if (string(argv[i]) == "--max-requests" and i + 1 < argc) {
+            keep_alive_options keep;
+            keep.max_requests = atoi(argv[++i]);
+            webserver1.set_keep_alive(keep);
+        }
+        else if (string(argv[i]) == "--download" and i + 2 < argc) {
+            return test_download(argv[i + 1], argv[i + 2]); //--download URL FILE, then exit
+        }
+        else if (string(argv[i]) == "--trace" and i + 1 < argc) {
+            webserver1.tracer().enable(atoi(argv[++i])); //one in N requests, dumped on exit
+        }
+    }
 
     test_client("www.baidu.com");
 
-    auto sighandler = [](const error_code& err, const int& sig) {
+    auto sighandler = [&webserver1](const error_code& err, const int& sig) {
         std::cerr << " catch signal " << sig << "\n";
+        if (webserver1.tracer().enabled()) {
+            webserver1.tracer().disable();
+            webserver1.tracer().dump("trace.json");
+        }
         exit(sig);
     };
 
     webserver1.set_signal_handler(SIGINT, sighandler);
     webserver1.set_signal_handler(SIGQUIT, sighandler);
 
-    auto& cache1 = webserver1.cache();
-
     auto post_specific = [](streambuf_ptr resbuf, request_ptr r) {
-        ostream response(resbuf.get());
-        stringstream ss;
-        r->content >> ss.rdbuf();
-        string content = ss.str();
-        response << sreplace(templates::ok, {"$length", dtos(content.size())}, {"$content", content});
+        // the body straight from the connection buffer into the response
+        auto body = r->body();
+        auto ctype = r->header.find("Content-Type");
+        header_builder(*resbuf).status(ok)
+                               .content_type(ctype != r->header.end() ? ctype->second : mime_table()[mime_default])
+                               .content_length(boost::asio::buffer_size(body))
+                               .end();
+        header_builder(*resbuf).write(boost::asio::buffer_cast<const char*>(body), boost::asio::buffer_size(body));
     };
 
-    auto get_default1 = [&cache1](streambuf_ptr resbuf, request_ptr r) {
-        std::cerr << r->address << " : " << r->path << "\n";
-        ostream response(resbuf.get());
-        string filename = "web/";
-        string path = r->match1;
-        size_t pos = 0;
-        while((pos = path.find("..")) != string::npos) {
-            path.erase(pos, 1);
-        }
-        filename += path;
-        if (filename.find('.') == string::npos) {
-            if(*filename.rbegin() != '/') {
-                filename += '/';
-            }
-            filename += "index.html";
-        }
-        if (not file_check(filename)) {
-            const string ct = "<html><h1>404 Not Found</h1>\n<h3>Your IP: " + r->address + "</h3></html>";
-            response << sreplace(templates::not_found, {"$content", ct}, {"$length", dtos(ct.size())});
-            return;
-        }
-        auto pres = cache1.get(filename);
-        if (pres) {
-            response << pres->head << pres->content;
-        }
-        else {
-            mmap_reader mr(filename.c_str());
-            auto buf = mr.read();
-            string ct = sreplace(templates::ok, {"$length", dtos(mr.size())}, {"$content", buf});
-            response << ct;
-            response_ptr pres(new _response);
-            auto range = boost::find_first(ct, "\r\n\r\n");
-            pres->head.assign(ct.begin(), range.end());
-            pres->content.assign(range.end(), ct.end());
-            cache1.set(filename, pres);
-        }
+    // repeated hits and repeated 404s of the static path cost no syscalls, one cache per numa node
+    node_local<file_cache> files;
+
+    // one process reads the files from the lock free cache of the server, the workers of
+    // pre-fork mode share one copy in shared memory instead, made before they fork
+    single_flight<response_cache<>> loads1(webserver1.cache());
+    boost::scoped_ptr<shared_response_cache> shared1;
+    boost::scoped_ptr<single_flight<shared_response_cache>> shared_loads1;
+    handler_for_server get_default1 = get_files(loads1, files);
+    if (workers) {
+        shared1.reset(new shared_response_cache(64 << 20));
+        shared_loads1.reset(new single_flight<shared_response_cache>(*shared1));
+        get_default1 = get_files(*shared_loads1, files);
+    }
+
+    // build with: mkpack web web.pack --gzip
+    asset_store assets;
+    if (assets.reload("web.pack")) {
+        webserver1.set_specific_logical("^/static/(.*)$", "GET", pack_handler(assets));
+    }
+
+    // every message of a client goes to all clients connected to /chat
+    websocket_group<asio_http> chat;
+    websocket_endpoint<asio_http> chat_endpoint;
+    chat_endpoint.on_open = [&chat](websocket_group<asio_http>::pointer ws) {
+        chat.join(ws);
     };
+    chat_endpoint.on_message = [&chat](websocket_group<asio_http>::pointer, const char* data, size_t size, WS_OPCODE) {
+        chat.broadcast(ws_encode_frame(ws_text, data, size));
+    };
+    chat_endpoint.on_close = [&chat](websocket_group<asio_http>::pointer ws, uint16_t) {
+        chat.leave(ws);
+    };
+    // asio backend only: with --uring there is no /chat, set_websocket() logs an error
+    webserver1.set_websocket("^/chat$", chat_endpoint);
+
+    // dynamic, but the same for everybody within a second: the handler runs once a second at most
+    webserver1.set_specific_logical("^/now$", "GET", [](streambuf_ptr resbuf, request_ptr) {
+        const string ct = "<html>" + dtos(time(nullptr)) + "</html>";
+        header_builder(*resbuf).status(ok).content_type(mime_html).content_length(ct.size()).end();
+        ostream(resbuf.get()) << ct;
+    });
+    micro_cache_options micro;
+    micro.ttl_ms = 1000;
+    webserver1.set_micro_cache("^/now$", micro);
 
     webserver1.set_specific_logical("^/?(.*)$", "POST", post_specific);
     webserver1.set_default_logical("^/?123(.*)$", "GET", get_default1);
+    webserver1.set_access_log(access_log_options("access.log"));
+
+    if (workers) {
+        return webserver1.start_workers(prefork_options(workers));
+    }
 
     boost::thread server_thread1( [&webserver1](){webserver1.start();} );
 
@@ -0,0 +1,406 @@
+/**
+ * file   : microcache.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * short lived cache of the responses of a dynamic route, see server_base::set_micro_cache
+ */
+#pragma once
+#ifndef MICRO_CACHE_HTTP_HPP
+#define MICRO_CACHE_HTTP_HPP
+#include <list>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/algorithm/string.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "reply.hpp"
+#include "admission.hpp"
+#include "accesslog.hpp"
+
+namespace basiohttp
+{
+
+struct micro_cache_options
+{
+    size_t ttl_ms;              // a response is served as is this long
+    size_t stale_ms;            // and this much longer while one refresh runs in the background
+    size_t max_bytes;           // of all responses, the oldest go first
+    std::vector<string> vary;   // request headers that are part of the key besides method and path
+
+    micro_cache_options(void):
+        ttl_ms(1000),
+        stale_ms(2000),
+        max_bytes(16 << 20)
+    {
+    }
+};
+
+struct micro_cache_stats
+{
+    boost::atomic<size_t> hits;
+    boost::atomic<size_t> stale;        // served stale, a hit too
+    boost::atomic<size_t> misses;       // ran the handler
+    boost::atomic<size_t> coalesced;    // waited for the handler run of an identical request
+    boost::atomic<size_t> refreshes;    // background runs of the handler
+
+    micro_cache_stats(void):hits(0), stale(0), misses(0), coalesced(0), refreshes(0)
+    {
+    }
+};
+
+
+// responses of GET and HEAD requests of one route, by method, path with the query, and the
+// `vary` headers, header names in any case. the entity headers and the body are kept, status
+// line and Date are written per response. only 200s without Set-Cookie or a Cache-Control of private, no-cache or
+// no-store are kept, requests with an Authorization header not in `vary` always go to the
+// handler. a miss runs the handler, identical requests meanwhile defer and get a copy of its
+// response. past ttl_ms the stale response is still served and the first such request starts
+// a refresh through `spawn`, on a copy of the request that is not tied to a connection
+struct micro_cache: public boost::enable_shared_from_this<micro_cache>, public boost::noncopyable
+{
+    typedef boost::function<void(const boost::function<void()>&)> spawn_type;
+
+    micro_cache(const micro_cache_options& opts, const spawn_type& spawn):
+        __opts(opts),
+        __spawn(spawn),
+        __bytes(0)
+    {
+    }
+
+    // in place of `handler`, for `r`
+    void serve(const handler_for_server& handler, const streambuf_ptr& response, const request_ptr& r)
+    {
+        if (bypass(*r)) {
+            handler(response, r);
+            return;
+        }
+        const string key = make_key(*r);
+        const uint64_t now = steady_us();
+        response_ptr cached;
+        bool stale = false;
+        bool refresh = false;
+        {
+            boost::mutex::scoped_lock lock(__mutex);
+            auto found = __entries.find(key);
+            if (found != __entries.end()) {
+                entry& e = found->second;
+                if (e.response and now < e.expires + __opts.stale_ms * 1000) {
+                    cached = e.response;
+                    stale = now >= e.expires;
+                    if (stale and not e.busy) {
+                        e.busy = refresh = true;
+                    }
+                }
+                else if (e.busy) {
+                    boost::function<void(void)> done = r->defer();
+                    if (done) {
+                        e.waiters.push_back(waiter{handler, response, r, done});
+                        ++__stats.coalesced;
+                        return;
+                    }
+                }
+            }
+            if (not cached) {
+                __entries[key].busy = true;
+            }
+        }
+
+        if (cached) {
+            ++__stats.hits;
+            header_builder(*response).status(ok).write(cached->head).write(cached->content);
+            if (stale) {
+                ++__stats.stale;
+            }
+            if (refresh) {
+                ++__stats.refreshes;
+                refresh_in_background(handler, key, *r);
+            }
+            return;
+        }
+        ++__stats.misses;
+        run(handler, key, response, r);
+    }
+
+    const micro_cache_stats& stats(void) const
+    {
+        return __stats;
+    }
+
+    // bytes of the responses kept
+    size_t bytes(void)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        return __bytes;
+    }
+
+protected:
+    struct waiter
+    {
+        handler_for_server handler;
+        streambuf_ptr      response;
+        request_ptr        request;
+        boost::function<void(void)> done;
+    };
+
+    struct entry
+    {
+        response_ptr response;                      // entity headers and body, null until one is kept
+        uint64_t expires;                           // steady_us, fresh until
+        bool     busy;                              // the handler runs for it
+        std::vector<waiter> waiters;                // identical requests waiting for that
+        std::list<string>::iterator age;            // in __order while there is a response
+
+        entry(void):expires(0), busy(false)
+        {
+        }
+    };
+
+    inline const string* header_of(const _request& r, const string& name) const
+    {
+        auto found = r.header.find(name);
+        if (found != r.header.end()) {
+            return &found->second;
+        }
+        for (auto& h : r.header) {
+            if (boost::iequals(h.first, name)) {
+                return &h.second;
+            }
+        }
+        return nullptr;
+    }
+
+    inline bool bypass(const _request& r) const
+    {
+        if (not header_of(r, "Authorization")) {
+            return false;
+        }
+        for (auto& name : __opts.vary) {
+            if (boost::iequals(name, "Authorization")) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    string make_key(const _request& r) const
+    {
+        string key = r.method + ' ' + r.path;
+        for (auto& name : __opts.vary) {
+            const string* value = header_of(r, name);
+            key += '\n';
+            if (value) {
+                key += *value;
+            }
+        }
+        return key;
+    }
+
+    // whether the response in `response` may be kept and shared
+    static bool cacheable(const boost::asio::streambuf& response)
+    {
+        if (response_status(response) != 200) {
+            return false;
+        }
+        auto data = response.data();
+        const char* begin = boost::asio::buffer_cast<const char*>(data);
+        const size_t size = boost::asio::buffer_size(data);
+        const char* end = static_cast<const char*>(memmem(begin, size, "\r\n\r\n", 4));
+        const boost::iterator_range<const char*> head(begin, end ? end : begin + size);
+        if (boost::ifind_first(head, "\nset-cookie:")) {
+            return false;
+        }
+        auto control = boost::ifind_first(head, "\ncache-control:");
+        if (control) {
+            const char* eol = std::find(control.end(), head.end(), '\r');
+            const boost::iterator_range<const char*> value(control.end(), eol);
+            return not (boost::ifind_first(value, "private") or boost::ifind_first(value, "no-cache") or
+                        boost::ifind_first(value, "no-store"));
+        }
+        return true;
+    }
+
+    // `handler` for `key`, its response is kept when it is complete, also if the handler defers it
+    void run(const handler_for_server& handler, const string& key, const streambuf_ptr& response, const request_ptr& r)
+    {
+        auto self = this->shared_from_this();
+        const boost::function<boost::function<void(void)>(void)> inner = r->__defer;
+        bool deferred = false;
+        r->__defer = [self, inner, key, response, &deferred]() {
+            boost::function<void(void)> done = inner ? inner() : boost::function<void(void)>();
+            if (not done) {
+                return done;
+            }
+            deferred = true;
+            return boost::function<void(void)>([self, key, response, done]() {
+                self->land(key, response.get());
+                done();
+            });
+        };
+        try {
+            handler(response, r);
+        }
+        catch (...) {
+            r->__defer = inner;
+            if (not deferred) {
+                land(key, nullptr);
+            }
+            throw;
+        }
+        r->__defer = inner;
+        if (not deferred) {
+            land(key, response.get());
+        }
+    }
+
+    void refresh_in_background(const handler_for_server& handler, const string& key, const _request& r)
+    {
+        request_ptr copy(new _request);
+        copy->method = r.method;
+        copy->path = r.path;
+        copy->version = r.version;
+        copy->match1 = r.match1;
+        copy->match2 = r.match2;
+        copy->match3 = r.match3;
+        copy->address = r.address;
+        copy->header = r.header;
+        copy->__defer = []() { return boost::function<void(void)>([]() {}); }; //nobody waits
+        auto self = this->shared_from_this();
+        __spawn([self, handler, key, copy]() {
+            streambuf_ptr response(new boost::asio::streambuf);
+            try {
+                self->run(handler, key, response, copy);
+            }
+            catch (...) {
+                //landed already, the stale response stays until it expires
+            }
+        });
+    }
+
+    // what of a complete 200 is kept: the headers but Date and Server, which status() writes
+    // again for each response, and the body
+    static response_ptr entity_of(const boost::asio::streambuf& response)
+    {
+        auto data = response.data();
+        const char* begin = boost::asio::buffer_cast<const char*>(data);
+        const char* end = begin + boost::asio::buffer_size(data);
+        const char* head = static_cast<const char*>(memmem(begin, end - begin, "\r\n\r\n", 4));
+        if (not head) {
+            return response_ptr();
+        }
+        response_ptr res(new _response);
+        const char* line = static_cast<const char*>(memmem(begin, head + 2 - begin, "\r\n", 2)) + 2;
+        while (line < head + 2) {
+            const char* eol = static_cast<const char*>(memmem(line, head + 4 - line, "\r\n", 2)) + 2;
+            const boost::iterator_range<const char*> name(line, std::find(line, eol, ':'));
+            if (not boost::iequals(name, "Date") and not boost::iequals(name, "Server")) {
+                res->head.append(line, eol);
+            }
+            line = eol;
+        }
+        res->head += "\r\n";
+        res->content.assign(head + 4, end);
+        return res;
+    }
+
+    // the handler run for `key` is done, `response` is what it wrote, null if it threw
+    void land(const string& key, const boost::asio::streambuf* response)
+    {
+        response_ptr kept;
+        if (response and cacheable(*response) and response->size() + key.size() <= __opts.max_bytes) {
+            kept = entity_of(*response);
+        }
+        std::vector<waiter> waiters;
+        {
+            boost::mutex::scoped_lock lock(__mutex);
+            entry& e = __entries[key];
+            e.busy = false;
+            waiters.swap(e.waiters);
+            if (kept) {
+                if (e.response) {
+                    __bytes -= size_of(key, *e.response);
+                    __order.erase(e.age);
+                }
+                e.response = kept;
+                e.expires = steady_us() + __opts.ttl_ms * 1000;
+                e.age = __order.insert(__order.end(), key);
+                __bytes += size_of(key, *kept);
+                evict();
+            }
+            else if (not e.response) {
+                __entries.erase(key);
+            }
+        }
+        for (auto& w : waiters) {
+            if (kept) {
+                header_builder(*w.response).status(ok).write(kept->head).write(kept->content);
+                w.done();
+                continue;
+            }
+            // not to be shared, each one gets a response of its own
+            ++__stats.misses;
+            __spawn([w]() {
+                bool deferred = false;
+                const boost::function<void(void)> done = w.done;
+                const boost::function<boost::function<void(void)>(void)> inner = w.request->__defer;
+                w.request->__defer = [&deferred, done]() {
+                    deferred = true;
+                    return done;
+                };
+                try {
+                    w.handler(w.response, w.request);
+                }
+                catch (...) {
+                    w.response->consume(w.response->size());
+                    header_builder(*w.response).status(internal_server_error).content_length(0).end();
+                }
+                w.request->__defer = inner; //the connection is deferred already, done() resumes it
+                if (not deferred) {
+                    done();
+                }
+            });
+        }
+    }
+
+    static inline size_t size_of(const string& key, const _response& res)
+    {
+        return key.size() + res.head.size() + res.content.size();
+    }
+
+    // oldest responses first, i.e. those expiring first, until the rest fits
+    void evict(void)
+    {
+        while (__bytes > __opts.max_bytes and not __order.empty()) {
+            const string key = __order.front();
+            __order.pop_front();
+            auto found = __entries.find(key);
+            __bytes -= size_of(key, *found->second.response);
+            found->second.response.reset();
+            if (not found->second.busy) {
+                __entries.erase(found);
+            }
+        }
+    }
+
+    micro_cache_options __opts;
+    spawn_type          __spawn;
+    micro_cache_stats   __stats;
+    boost::mutex        __mutex;
+    boost::unordered_map<string, entry> __entries;
+    std::list<string>   __order;    // keys of the entries with a response, oldest first
+    size_t              __bytes;
+};
+
+typedef boost::shared_ptr<micro_cache> micro_cache_ptr;
+
+}//basiohttp
+
+
+#endif//MICRO_CACHE_HTTP_HPP
@@ -0,0 +1,34 @@
+/**
+ * file   : mkpack.cpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * packs a directory into an asset pack for the server, see assetpack.hpp
+ * usage  : mkpack <directory> <output.pack> [--gzip]
+ * build  : g++ -std=c++11 -O2 mkpack.cpp -o mkpack -lboost_filesystem -lboost_system -lcrypto -lz
+ *          a tool of its own, .cproject keeps it out of the server
+ */
+#include <iostream>
+#include <cstring>
+#include "assetpack.hpp"
+
+
+int main(int argc, char* argv[])
+{
+    using namespace basiohttp;
+
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <directory> <output.pack> [--gzip]\n";
+        return 1;
+    }
+    const bool precompress = argc > 3 and strcmp(argv[3], "--gzip") == 0;
+
+    try {
+        size_t n = build_asset_pack(argv[1], argv[2], precompress);
+        std::cout << n << " assets packed into " << argv[2] << "\n";
+    }
+    catch (const std::exception& e) {
+        std::cerr << "mkpack: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
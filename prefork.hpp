@@ -0,0 +1,237 @@
+/**
+ * file   : prefork.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * master process of the pre-fork mode: forks workers, restarts them when they die
+ */
+#pragma once
+#ifndef PREFORK_HTTP_HPP
+#define PREFORK_HTTP_HPP
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "admission.hpp"
+
+namespace basiohttp
+{
+
+enum FORK_EVENT
+{
+    fork_prepare,   // in the master, right before fork()
+    fork_parent,    // in the master, after fork()
+    fork_child      // in the new worker, before it runs
+};
+
+struct prefork_options
+{
+    size_t workers;         // processes serving requests, 0 means one per cpu
+    size_t restart_ms;      // delay before a dead worker is forked again
+    size_t max_restart_ms;  // the delay doubles up to this while workers keep dying young
+    size_t stop_timeout;    // seconds workers get to exit after SIGTERM, then SIGKILL
+
+    prefork_options(const size_t workers = 0):
+        workers(workers),
+        restart_ms(100),
+        max_restart_ms(5000),
+        stop_timeout(10)
+    {
+    }
+};
+
+
+// run() forks the workers and supervises them from the calling thread: signals are taken with
+// sigtimedwait(), so the master must not have other threads, and neither must the process when
+// it forks. a worker that dies is forked again after restart_ms, a worker that dies within a
+// second of being forked doubles that delay (a crash at startup must not turn into a fork
+// loop). SIGINT, SIGTERM or SIGQUIT to the master stops all workers and makes run() return
+struct prefork_master: public boost::noncopyable
+{
+    typedef boost::function<int(const size_t)> worker_type;         // index -> exit status
+    typedef boost::function<void(const FORK_EVENT)> notify_type;
+    typedef boost::function<void(const string&, const char*)> log_type;
+
+    prefork_master(const prefork_options& opts, const log_type& log):
+        __opts(opts),
+        __log(log),
+        __restarts(0),
+        __delay_ms(opts.restart_ms)
+    {
+        if (not __opts.workers) {
+            __opts.workers = max<size_t>(boost::thread::hardware_concurrency(), 1);
+        }
+    }
+
+    int run(const worker_type& worker, const notify_type& notify)
+    {
+        sigset_t signals, old;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGQUIT);
+        pthread_sigmask(SIG_BLOCK, &signals, &old);
+
+        __slots.assign(__opts.workers, slot());
+        for (size_t i = 0; i < __slots.size(); ++i) {
+            spawn(i, worker, notify, old);
+        }
+
+        bool stopping = false;
+        uint64_t deadline = 0;
+        while (not stopping or alive()) {
+            timespec wait = {0, 100 * 1000 * 1000};
+            siginfo_t info;
+            const int sig = sigtimedwait(&signals, &info, &wait);
+            if (sig > 0 and sig != SIGCHLD and not stopping) {
+                __log("stopping workers on signal " + dtos(sig), "INFO");
+                stopping = true;
+                deadline = steady_us() + __opts.stop_timeout * 1000000;
+                signal_all(SIGTERM);
+            }
+            reap(stopping);
+
+            const uint64_t now = steady_us();
+            if (stopping) {
+                if (now > deadline and alive()) {
+                    signal_all(SIGKILL);
+                    deadline = now + 1000000;
+                }
+                continue;
+            }
+            for (size_t i = 0; i < __slots.size(); ++i) {
+                if (__slots[i].pid == 0 and now >= __slots[i].restart_at) {
+                    spawn(i, worker, notify, old);
+                }
+            }
+        }
+
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        return 0;
+    }
+
+    inline size_t workers(void) const
+    {
+        return __opts.workers;
+    }
+
+    // workers forked again after they died
+    inline size_t restarts(void) const
+    {
+        return __restarts;
+    }
+
+protected:
+    struct slot
+    {
+        pid_t    pid;           // 0 if not running
+        uint64_t forked;        // steady_us
+        uint64_t restart_at;
+
+        slot(void):pid(0), forked(0), restart_at(0)
+        {
+        }
+    };
+
+    void spawn(const size_t index, const worker_type& worker, const notify_type& notify, const sigset_t& mask)
+    {
+        notify(fork_prepare);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+            notify(fork_child);
+            int status = 1;
+            try {
+                status = worker(index);
+            }
+            catch (const std::exception& e) {
+                __log("worker " + dtos(index) + ": " + e.what(), "ERROR");
+            }
+            _exit(status); //nothing of the master is torn down in a worker
+        }
+        notify(fork_parent);
+        if (pid < 0) {
+            __log(string("fork failed: ") + strerror(errno), "ERROR");
+            __slots[index].restart_at = steady_us() + __delay_ms * 1000;
+            return;
+        }
+        __slots[index].pid = pid;
+        __slots[index].forked = steady_us();
+    }
+
+    void reap(const bool stopping)
+    {
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (size_t i = 0; i < __slots.size(); ++i) {
+                slot& s = __slots[i];
+                if (s.pid != pid) {
+                    continue;
+                }
+                s.pid = 0;
+                if (stopping) {
+                    break;
+                }
+                const uint64_t now = steady_us();
+                if (now - s.forked < 1000000) {
+                    __delay_ms = min(__delay_ms * 2, __opts.max_restart_ms);
+                }
+                else {
+                    __delay_ms = __opts.restart_ms;
+                }
+                s.restart_at = now + __delay_ms * 1000;
+                ++__restarts;
+                __log("worker " + dtos(i) + " (pid " + dtos(pid) + ") " + describe(status) +
+                      ", restart in " + dtos(__delay_ms) + "ms", "ERROR");
+                break;
+            }
+        }
+    }
+
+    static string describe(const int status)
+    {
+        if (WIFSIGNALED(status)) {
+            return "killed by signal " + dtos(WTERMSIG(status));
+        }
+        return "exited with " + dtos(WEXITSTATUS(status));
+    }
+
+    void signal_all(const int sig)
+    {
+        for (auto& s : __slots) {
+            if (s.pid > 0) {
+                ::kill(s.pid, sig);
+            }
+        }
+    }
+
+    bool alive(void) const
+    {
+        for (auto& s : __slots) {
+            if (s.pid > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    prefork_options   __opts;
+    log_type          __log;
+    std::vector<slot> __slots;
+    size_t            __restarts;
+    size_t            __delay_ms;
+};
+
+}//basiohttp
+
+
+#endif//PREFORK_HTTP_HPP
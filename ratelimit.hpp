@@ -0,0 +1,193 @@
+/**
+ * file   : ratelimit.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * per client ip token buckets for server_base, one table per limited route
+ */
+#pragma once
+#ifndef RATE_LIMIT_HTTP_HPP
+#define RATE_LIMIT_HTTP_HPP
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+// binary client address, ipv4 is kept as an ipv4 mapped ipv6 address
+struct ip_key
+{
+    uint64_t hi;
+    uint64_t lo;
+
+    ip_key(void):hi(0), lo(0)
+    {
+    }
+
+    inline bool operator==(const ip_key& other) const
+    {
+        return hi == other.hi and lo == other.lo;
+    }
+};
+
+inline size_t hash_value(const ip_key& key)
+{
+    uint64_t h = (key.hi ^ (key.lo * 0x9e3779b97f4a7c15ULL));
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+inline ip_key make_ip_key(const unsigned char bytes[16])
+{
+    ip_key key;
+    memcpy(&key.hi, bytes, 8);
+    memcpy(&key.lo, bytes + 8, 8);
+    return key;
+}
+
+inline ip_key make_ip_key(const ip_address& address)
+{
+    if (address.is_v4()) {
+        return make_ip_key(ipv6_address::v4_mapped(address.to_v4()).to_bytes().data());
+    }
+    return make_ip_key(address.to_v6().to_bytes().data());
+}
+
+inline ip_key make_ip_key(const sockaddr_storage& ss)
+{
+    if (ss.ss_family == AF_INET) {
+        unsigned char bytes[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        memcpy(bytes + 12, &reinterpret_cast<const sockaddr_in*>(&ss)->sin_addr, 4);
+        return make_ip_key(bytes);
+    }
+    return make_ip_key(reinterpret_cast<const sockaddr_in6*>(&ss)->sin6_addr.s6_addr);
+}
+
+
+struct rate_limit_options
+{
+    double rate;            // requests per second a client may sustain
+    double burst;           // requests a client may send at once after being idle
+    size_t idle_expiry;     // seconds after which a silent client is forgotten
+
+    rate_limit_options(const double rate = 100, const double burst = 200):
+        rate(rate),
+        burst(burst),
+        idle_expiry(60)
+    {
+    }
+};
+
+
+// token buckets in a striped table: a client maps to one of NUM_SHARDS shards, each with its
+// own lock and map, so concurrent requests of different clients rarely meet on a lock.
+// a bucket untouched for burst / rate seconds is full again, forgetting it later than that
+// changes nothing, so expired entries are swept from a shard every SWEEP_EVERY calls
+struct ip_rate_limiter: public boost::noncopyable
+{
+    enum { NUM_SHARDS = 64, SWEEP_EVERY = 4096 };
+
+    explicit ip_rate_limiter(const rate_limit_options& opts):
+        __opts(opts),
+        __rate_per_us(opts.rate / 1e6),
+        __expiry_us(static_cast<uint64_t>(max(static_cast<double>(opts.idle_expiry), opts.burst / opts.rate) * 1e6)),
+        __limited(0)
+    {
+    }
+
+    // takes a token of the client, false if it has none left
+    bool allow(const ip_key& key, const uint64_t now_us)
+    {
+        shard& s = __shards[hash_value(key) % NUM_SHARDS];
+        boost::mutex::scoped_lock lock(s.mutex);
+        if (++s.calls % SWEEP_EVERY == 0) {
+            sweep(s, now_us);
+        }
+        auto found = s.buckets.find(key);
+        if (found == s.buckets.end()) {
+            bucket& b = s.buckets[key];
+            b.tokens = __opts.burst - 1;
+            b.last_us = now_us;
+            return true;
+        }
+        bucket& b = found->second;
+        if (now_us > b.last_us) { //another thread may have come in with a later clock
+            b.tokens = min(__opts.burst, b.tokens + (now_us - b.last_us) * __rate_per_us);
+            b.last_us = now_us;
+        }
+        if (b.tokens < 1) {
+            __limited.fetch_add(1, boost::memory_order_relaxed);
+            return false;
+        }
+        b.tokens -= 1;
+        return true;
+    }
+
+    // clients being tracked
+    size_t size(void)
+    {
+        size_t n = 0;
+        for (auto& s : __shards) {
+            boost::mutex::scoped_lock lock(s.mutex);
+            n += s.buckets.size();
+        }
+        return n;
+    }
+
+    inline size_t limited(void) const
+    {
+        return __limited.load(boost::memory_order_relaxed);
+    }
+
+protected:
+    struct bucket
+    {
+        double   tokens;
+        uint64_t last_us;
+    };
+
+    struct shard
+    {
+        boost::mutex mutex;
+        boost::unordered_map<ip_key, bucket> buckets;
+        size_t calls;
+        char   pad[64];     // keeps neighbouring locks off one cache line
+
+        shard(void):calls(0)
+        {
+        }
+    };
+
+    void sweep(shard& s, const uint64_t now_us)
+    {
+        for (auto it = s.buckets.begin(); it != s.buckets.end(); ) {
+            if (now_us > it->second.last_us + __expiry_us) {
+                it = s.buckets.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    rate_limit_options __opts;
+    double   __rate_per_us;
+    uint64_t __expiry_us;
+    shard    __shards[NUM_SHARDS];
+    boost::atomic<size_t> __limited;
+};
+
+typedef boost::shared_ptr<ip_rate_limiter> ip_rate_limiter_ptr;
+
+}//basiohttp
+
+
+#endif//RATE_LIMIT_HTTP_HPP
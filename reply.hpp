@@ -1,41 +1,143 @@
 #pragma once
 #ifndef HTTP_REPLY_HPP
 #define HTTP_REPLY_HPP
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
 
 namespace basiohttp
 {
 
 using std::string;
-// Convert a file extension into a MIME type.
-struct mimetypes
+
+//// compile-time hashing ////////////////////////////////////////////////////////////////////////
+// FNV-1a, c++11 constexpr so it can be used in case labels
+constexpr uint32_t fnv1a(const char* s, uint32_t h = 2166136261u)
 {
-  const char* extension;
-  const char* mime_type;
-};
+    return *s ? fnv1a(s + 1, (h ^ uint8_t(*s)) * 16777619u) : h;
+}
+
+// runtime twin of fnv1a, folds ascii to lower case so "PNG" and "png" hash the same
+inline uint32_t fnv1a_lower(const char* s, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t c = uint8_t(s[i]);
+        if (c >= 'A' and c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+
+//// mime types //////////////////////////////////////////////////////////////////////////////////
+// X(name, extension, mime type), every type is interned once in mime_table()
+#define BASIOHTTP_MIME_TYPES(X) \
+    X(html,  "html",  "text/html; charset=utf-8") \
+    X(htm,   "htm",   "text/html; charset=utf-8") \
+    X(css,   "css",   "text/css; charset=utf-8") \
+    X(js,    "js",    "application/javascript; charset=utf-8") \
+    X(mjs,   "mjs",   "application/javascript; charset=utf-8") \
+    X(json,  "json",  "application/json") \
+    X(map,   "map",   "application/json") \
+    X(xml,   "xml",   "application/xml") \
+    X(txt,   "txt",   "text/plain; charset=utf-8") \
+    X(csv,   "csv",   "text/csv; charset=utf-8") \
+    X(md,    "md",    "text/markdown; charset=utf-8") \
+    X(gif,   "gif",   "image/gif") \
+    X(jpg,   "jpg",   "image/jpeg") \
+    X(jpeg,  "jpeg",  "image/jpeg") \
+    X(png,   "png",   "image/png") \
+    X(webp,  "webp",  "image/webp") \
+    X(avif,  "avif",  "image/avif") \
+    X(svg,   "svg",   "image/svg+xml") \
+    X(ico,   "ico",   "image/x-icon") \
+    X(bmp,   "bmp",   "image/bmp") \
+    X(woff,  "woff",  "font/woff") \
+    X(woff2, "woff2", "font/woff2") \
+    X(ttf,   "ttf",   "font/ttf") \
+    X(otf,   "otf",   "font/otf") \
+    X(mp3,   "mp3",   "audio/mpeg") \
+    X(ogg,   "ogg",   "audio/ogg") \
+    X(wav,   "wav",   "audio/wav") \
+    X(mp4,   "mp4",   "video/mp4") \
+    X(webm,  "webm",  "video/webm") \
+    X(pdf,   "pdf",   "application/pdf") \
+    X(zip,   "zip",   "application/zip") \
+    X(gz,    "gz",    "application/gzip") \
+    X(tar,   "tar",   "application/x-tar") \
+    X(wasm,  "wasm",  "application/wasm") \
+    X(bin,   "bin",   "application/octet-stream")
 
-static const mimetypes mappings[] =
+enum MIME_TYPE
 {
-    { "gif",  "image/gif" },
-    { "htm",  "text/html" },
-    { "html", "text/html" },
-    { "jpg",  "image/jpeg" },
-    { "png",  "image/png" }
+#define BASIOHTTP_MIME_ENUM(name, ext, type) mime_##name,
+    BASIOHTTP_MIME_TYPES(BASIOHTTP_MIME_ENUM)
+#undef BASIOHTTP_MIME_ENUM
+    mime_default,   // "text/plain", for unknown extensions
+    mime_count
 };
 
+inline const string* mime_table(void)
+{
+    static const string table[mime_count] = {
+#define BASIOHTTP_MIME_TYPE(name, ext, type) type,
+        BASIOHTTP_MIME_TYPES(BASIOHTTP_MIME_TYPE)
+#undef BASIOHTTP_MIME_TYPE
+        "text/plain"
+    };
+    return table;
+}
 
-inline string extension_to_type(const string& extension)
+inline bool __same_extension(const char* ext, size_t n, const char* lit)
 {
-    for (auto& m : mappings) {
-        if (m.extension == extension) {
-            return m.mime_type;
+    for (size_t i = 0; i < n; ++i, ++lit) {
+        char c = ext[i];
+        if (c >= 'A' and c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (*lit != c) {
+            return false;
         }
     }
-    return "text/plain";
+    return *lit == 0;
 }
 
+// extension without the dot, e.g. "png", never allocates
+inline MIME_TYPE extension_to_mime(const char* ext, size_t n)
+{
+    switch (fnv1a_lower(ext, n)) {
+#define BASIOHTTP_MIME_CASE(name, ext_lit, type) \
+    case fnv1a(ext_lit): \
+        return __same_extension(ext, n, ext_lit) ? mime_##name : mime_default;
+    BASIOHTTP_MIME_TYPES(BASIOHTTP_MIME_CASE)
+#undef BASIOHTTP_MIME_CASE
+    default:
+        return mime_default;
+    }
+}
+
+inline const string& extension_to_type(const string& extension)
+{
+    return mime_table()[extension_to_mime(extension.data(), extension.size())];
+}
+
+// mime type of a file path by its last extension, "text/plain" if it has none
+inline const string& path_to_type(const string& path)
+{
+    auto dot = path.find_last_of("./");
+    if (dot == string::npos or path[dot] != '.') {
+        return mime_table()[mime_default];
+    }
+    return mime_table()[extension_to_mime(path.data() + dot + 1, path.size() - dot - 1)];
+}
 
 
 enum STATUS_TYPE
@@ -52,6 +154,7 @@ enum STATUS_TYPE
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    too_many_requests = 429,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -59,6 +162,205 @@ enum STATUS_TYPE
 };
 
 
+//// status lines ////////////////////////////////////////////////////////////////////////////////
+namespace status_lines
+{
+const string ok                    = "HTTP/1.1 200 OK\r\n";
+const string created               = "HTTP/1.1 201 Created\r\n";
+const string accepted              = "HTTP/1.1 202 Accepted\r\n";
+const string no_content            = "HTTP/1.1 204 No Content\r\n";
+const string multiple_choices      = "HTTP/1.1 300 Multiple Choices\r\n";
+const string moved_permanently     = "HTTP/1.1 301 Moved Permanently\r\n";
+const string moved_temporarily     = "HTTP/1.1 302 Moved Temporarily\r\n";
+const string not_modified          = "HTTP/1.1 304 Not Modified\r\n";
+const string bad_request           = "HTTP/1.1 400 Bad Request\r\n";
+const string unauthorized          = "HTTP/1.1 401 Unauthorized\r\n";
+const string forbidden             = "HTTP/1.1 403 Forbidden\r\n";
+const string not_found             = "HTTP/1.1 404 Not Found\r\n";
+const string too_many_requests     = "HTTP/1.1 429 Too Many Requests\r\n";
+const string internal_server_error = "HTTP/1.1 500 Internal Server Error\r\n";
+const string not_implemented       = "HTTP/1.1 501 Not Implemented\r\n";
+const string bad_gateway           = "HTTP/1.1 502 Bad Gateway\r\n";
+const string service_unavailable   = "HTTP/1.1 503 Service Unavailable\r\n";
+} //status_lines
+
+inline const string& status_line(const STATUS_TYPE status)
+{
+    switch (status) {
+    case ok:                    return status_lines::ok;
+    case created:               return status_lines::created;
+    case accepted:              return status_lines::accepted;
+    case no_content:            return status_lines::no_content;
+    case multiple_choices:      return status_lines::multiple_choices;
+    case moved_permanently:     return status_lines::moved_permanently;
+    case moved_temporarily:     return status_lines::moved_temporarily;
+    case not_modified:          return status_lines::not_modified;
+    case bad_request:           return status_lines::bad_request;
+    case unauthorized:          return status_lines::unauthorized;
+    case forbidden:             return status_lines::forbidden;
+    case not_found:             return status_lines::not_found;
+    case too_many_requests:     return status_lines::too_many_requests;
+    case not_implemented:       return status_lines::not_implemented;
+    case bad_gateway:           return status_lines::bad_gateway;
+    case service_unavailable:   return status_lines::service_unavailable;
+    default:                    return status_lines::internal_server_error;
+    }
+}
+
+const string SERVER_NAME = "lasioserver";
+
+
+//// cached Date header //////////////////////////////////////////////////////////////////////////
+// rfc 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT", formatted at most once per second
+// and shared by all threads. the writer fills a spare slot and then publishes its index, so
+// readers never see a half written string and never take a lock.
+struct date_cache
+{
+    enum { DATE_SIZE = 29, NUM_SLOTS = 4 };
+
+    date_cache(void):__second(0), __current(0)
+    {
+        bzero(__slots, sizeof(__slots));
+        refresh(time(0));
+    }
+
+    // copies exactly DATE_SIZE bytes into dst
+    inline void copy_to(char* dst)
+    {
+        const time_t now = time(0);
+        if (__second.load(boost::memory_order_relaxed) != now) {
+            refresh(now);
+        }
+        memcpy(dst, __slots[__current.load(boost::memory_order_acquire)], DATE_SIZE);
+    }
+
+    void refresh(const time_t now)
+    {
+        time_t last = __second.load(boost::memory_order_relaxed);
+        if (last == now or not __second.compare_exchange_strong(last, now)) {
+            return; //another thread won this second
+        }
+        static const char days[][4] = {"Sun","Mon","Tue","Wed","Thu","Fri","Sat"};
+        static const char months[][4] = {"Jan","Feb","Mar","Apr","May","Jun",
+                                          "Jul","Aug","Sep","Oct","Nov","Dec"};
+        struct tm gmt;
+        gmtime_r(&now, &gmt);
+        const unsigned next = (__current.load(boost::memory_order_relaxed) + 1) % NUM_SLOTS;
+        snprintf(__slots[next], sizeof(__slots[next]), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                 days[gmt.tm_wday], gmt.tm_mday, months[gmt.tm_mon], gmt.tm_year + 1900,
+                 gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
+        __current.store(next, boost::memory_order_release);
+    }
+
+    char __slots[NUM_SLOTS][32];
+    boost::atomic<time_t> __second;
+    boost::atomic<unsigned> __current;
+};
+
+inline date_cache& shared_date(void)
+{
+    static date_cache dc;
+    return dc;
+}
+
+
+//// response header builder /////////////////////////////////////////////////////////////////////
+// writes headers straight into the output streambuf, no temporary strings:
+//     header_builder(*resbuf).status(ok).content_type(mime_html).content_length(n).end();
+//     ostream(resbuf.get()) << body;
+// status() always emits the status line, Date and Server, so call it first.
+struct header_builder
+{
+    explicit header_builder(boost::asio::streambuf& buf):__buf(buf)
+    {
+    }
+
+    inline header_builder& status(const STATUS_TYPE st)
+    {
+        static const char date_name[] = "Date: ";
+        static const char server_line[] = "\r\nServer: ";
+        char date[date_cache::DATE_SIZE];
+        shared_date().copy_to(date);
+
+        write(status_line(st));
+        write(date_name, sizeof(date_name) - 1);
+        write(date, sizeof(date));
+        write(server_line, sizeof(server_line) - 1);
+        write(SERVER_NAME);
+        return crlf();
+    }
+
+    inline header_builder& content_type(const MIME_TYPE mt)
+    {
+        return content_type(mime_table()[mt]);
+    }
+
+    inline header_builder& content_type(const string& type)
+    {
+        return header("Content-Type", type);
+    }
+
+    inline header_builder& content_length(const size_t length)
+    {
+        static const char name[] = "Content-Length: ";
+        char digits[24];
+        char* p = digits + sizeof(digits);
+        size_t n = length;
+        do {
+            *--p = char('0' + n % 10);
+            n /= 10;
+        } while (n);
+        write(name, sizeof(name) - 1);
+        write(p, digits + sizeof(digits) - p);
+        return crlf();
+    }
+
+    inline header_builder& keep_alive(const bool keep)
+    {
+        static const char alive[] = "Connection: keep-alive\r\n";
+        static const char close[] = "Connection: close\r\n";
+        if (keep) {
+            write(alive, sizeof(alive) - 1);
+        } else {
+            write(close, sizeof(close) - 1);
+        }
+        return *this;
+    }
+
+    inline header_builder& header(const char* name, const string& value)
+    {
+        write(name, strlen(name));
+        write(": ", 2);
+        write(value);
+        return crlf();
+    }
+
+    // blank line which terminates the head
+    inline void end(void)
+    {
+        crlf();
+    }
+
+    inline header_builder& crlf(void)
+    {
+        return write("\r\n", 2);
+    }
+
+    inline header_builder& write(const string& s)
+    {
+        return write(s.data(), s.size());
+    }
+
+    inline header_builder& write(const char* p, const size_t n)
+    {
+        __buf.sputn(p, n);
+        return *this;
+    }
+
+    boost::asio::streambuf& __buf;
+};
+
+
 namespace templates
 {
 const string ok = "HTTP/1.1 200 OK\r\n"
@@ -68,8 +370,8 @@ const string ok = "HTTP/1.1 200 OK\r\n"
                   "\r\n\r\n"
                   "$content";
 
-const string not_found = "HTTP/1.0 404 Not Found\r\n"
-                         "Connection: Close\r\n"
+// the server adds a Connection header where the connection is not kept as HTTP/1.1 implies
+const string not_found = "HTTP/1.1 404 Not Found\r\n"
                          "Content-Length: $length"
                          "\r\n\r\n"
                          "$content";
@@ -80,17 +382,38 @@ const string get  = "GET $path HTTP/1.0\r\n"
                     "User-Agent: Mozilla/5.0 (Linux x86_64) Gecko Firefox\r\n"
                     "Connection: close\r\n\r\n";
 
+// a piece of the resource, $range is "first-last" or "first-" in bytes
+const string get_range = "GET $path HTTP/1.0\r\n"
+                         "Host: $host\r\n"
+                         "Accept: */*\r\n"
+                         "User-Agent: Mozilla/5.0 (Linux x86_64) Gecko Firefox\r\n"
+                         "Range: bytes=$range\r\n"
+                         "Connection: close\r\n\r\n";
+
 const string head = "HEAD $path HTTP/1.0\r\n"
                     "Host: $host \r\n"
                     "User-Agent: Mozilla/5.0 (Linux x86_64) Gecko Firefox\r\n"
                     "Connection: close\r\n\r\n";
 
-const string bad_request = "HTTP/1.0 400 Bad Request\r\n"
-                           "Connection: Close\r\n"
+const string bad_request = "HTTP/1.1 400 Bad Request\r\n"
                            "Content-Length: 24"
                            "\r\n\r\n"
                            "<html>Bad Request</html>";
 
+// sent by admission control without running any handler, connection is closed afterwards
+const string service_unavailable = "HTTP/1.1 503 Service Unavailable\r\n"
+                                   "Connection: close\r\n"
+                                   "Retry-After: 1\r\n"
+                                   "Content-Length: 0"
+                                   "\r\n\r\n";
+
+// sent when a client ran out of tokens of its rate limit, connection is closed afterwards
+const string too_many_requests = "HTTP/1.1 429 Too Many Requests\r\n"
+                                 "Connection: close\r\n"
+                                 "Retry-After: 1\r\n"
+                                 "Content-Length: 0"
+                                 "\r\n\r\n";
+
 
 
 
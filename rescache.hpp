@@ -11,7 +11,12 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "utils.hpp"
 #include "typedefs.hpp"
+#include "reply.hpp"
+#include "epoch.hpp"
 
 namespace basiohttp
 {
@@ -38,7 +43,15 @@ struct atom_lock
 };
 
 
-template<typename LockType = boost::shared_mutex>
+// picks the lock free specialization of response_cache below
+struct lockfree_reads
+{
+};
+
+
+// response_cache<boost::shared_mutex> locks per lookup, every reader writes the cache line of
+// the mutex. the default response_cache<lockfree_reads> does not
+template<typename LockType = lockfree_reads>
 struct response_cache
 {
     typedef boost::shared_lock<LockType> reads_lock;
@@ -77,11 +90,237 @@ struct response_cache
         return ret;
     }
 
+    // status line, head and content of `key` into `response`, false if there is no such entry
+    bool write(const string& key, boost::asio::streambuf& response, const STATUS_TYPE st = ok)
+    {
+        reads_lock lock(__mutex);
+        auto iter = __cache.find(key);
+        if (iter == __cache.end()) {
+            return false;
+        }
+        header_builder(response).status(st).write(iter->second->head).write(iter->second->content);
+        return true;
+    }
+
     LockType __mutex;
     cache_type __cache;
 };
 
 
+// readers walk a hash table of immutable nodes inside an epoch_guard, they take no lock and
+// write nothing shared. writers serialize on a mutex: a set() links a new node in place of the
+// old one, a table that grows is copied and published whole, what is unlinked goes to
+// epoch_domain::retire(). get() still copies the response_ptr, i.e. bumps the count of that
+// entry, write() copies the response out and leaves even that alone
+template<>
+struct response_cache<lockfree_reads>: public boost::noncopyable
+{
+    response_cache(void):__table(new table(16)), __size(0)
+    {
+    }
+
+    ~response_cache(void)
+    {
+        destroy(__table.load());
+    }
+
+    // true if an entry of `key` was replaced
+    bool set(const string& key, response_ptr res)
+    {
+        const size_t h = boost::hash<string>()(key);
+        boost::mutex::scoped_lock lock(__writer);
+        table* t = __table.load(boost::memory_order_relaxed);
+        boost::atomic<node*>* link = &t->bucket(h);
+        for (node* n = link->load(boost::memory_order_relaxed); n; n = n->next.load(boost::memory_order_relaxed)) {
+            if (n->hash == h and n->key == key) {
+                link->store(new node(key, h, res, n->next.load(boost::memory_order_relaxed)), boost::memory_order_release);
+                epoch_domain::instance().retire([n]() { delete n; });
+                return true;
+            }
+            link = &n->next;
+        }
+        node* head = t->bucket(h).load(boost::memory_order_relaxed);
+        t->bucket(h).store(new node(key, h, res, head), boost::memory_order_release);
+        if (++__size > t->buckets.size() * 2) {
+            grow(t);
+        }
+        return false;
+    }
+
+    // null if there is no entry of `key`
+    response_ptr get(const string& key)
+    {
+        epoch_guard guard;
+        const node* n = find(key);
+        return n ? n->value : response_ptr();
+    }
+
+    // status line, head and content of `key` into `response`, false if there is no such entry
+    bool write(const string& key, boost::asio::streambuf& response, const STATUS_TYPE st = ok)
+    {
+        epoch_guard guard;
+        const node* n = find(key);
+        if (not n) {
+            return false;
+        }
+        header_builder(response).status(st).write(n->value->head).write(n->value->content);
+        return true;
+    }
+
+    bool remove(const string& key)
+    {
+        const size_t h = boost::hash<string>()(key);
+        boost::mutex::scoped_lock lock(__writer);
+        boost::atomic<node*>* link = &__table.load(boost::memory_order_relaxed)->bucket(h);
+        for (node* n = link->load(boost::memory_order_relaxed); n; n = n->next.load(boost::memory_order_relaxed)) {
+            if (n->hash == h and n->key == key) {
+                link->store(n->next.load(boost::memory_order_relaxed), boost::memory_order_release);
+                epoch_domain::instance().retire([n]() { delete n; });
+                --__size;
+                return true;
+            }
+            link = &n->next;
+        }
+        return false;
+    }
+
+    size_t size(void)
+    {
+        boost::mutex::scoped_lock lock(__writer);
+        return __size;
+    }
+
+protected:
+    struct node: public boost::noncopyable
+    {
+        const string       key;
+        const size_t       hash;
+        const response_ptr value;
+        boost::atomic<node*> next;
+
+        node(const string& key, const size_t hash, const response_ptr& value, node* next):
+            key(key), hash(hash), value(value), next(next)
+        {
+        }
+    };
+
+    struct table: public boost::noncopyable
+    {
+        std::vector<boost::atomic<node*>> buckets;  // a power of 2
+
+        explicit table(const size_t n):buckets(n)
+        {
+            for (auto& b : buckets) {
+                b.store(nullptr, boost::memory_order_relaxed);
+            }
+        }
+
+        inline boost::atomic<node*>& bucket(const size_t h)
+        {
+            return buckets[h & (buckets.size() - 1)];
+        }
+    };
+
+    // inside an epoch_guard
+    inline const node* find(const string& key) const
+    {
+        const size_t h = boost::hash<string>()(key);
+        table* t = __table.load(boost::memory_order_acquire);
+        for (const node* n = t->bucket(h).load(boost::memory_order_acquire); n; n = n->next.load(boost::memory_order_acquire)) {
+            if (n->hash == h and n->key == key) {
+                return n;
+            }
+        }
+        return nullptr;
+    }
+
+    // the nodes of the old table are reachable by readers still inside it, so they are copied
+    // rather than relinked, and the old table goes away with them
+    void grow(table* old)
+    {
+        table* t = new table(old->buckets.size() * 4);
+        for (auto& b : old->buckets) {
+            for (node* n = b.load(boost::memory_order_relaxed); n; n = n->next.load(boost::memory_order_relaxed)) {
+                node* head = t->bucket(n->hash).load(boost::memory_order_relaxed);
+                t->bucket(n->hash).store(new node(n->key, n->hash, n->value, head), boost::memory_order_relaxed);
+            }
+        }
+        __table.store(t, boost::memory_order_release);
+        epoch_domain::instance().retire([old]() { destroy(old); });
+    }
+
+    static void destroy(table* t)
+    {
+        for (auto& b : t->buckets) {
+            for (node* n = b.load(boost::memory_order_relaxed); n; ) {
+                node* next = n->next.load(boost::memory_order_relaxed);
+                delete n;
+                n = next;
+            }
+        }
+        delete t;
+    }
+
+    boost::atomic<table*> __table;
+    size_t       __size;
+    boost::mutex __writer;
+};
+
+
+// lookups/sec of `threads` threads writing random ones of `keys` entries into a response buffer
+// for `ms` milliseconds, while one more thread replaces an entry every `write_us` microseconds (0
+// for none). through write(), as the server does, get() would bump the count of the entry on
+// every lookup. compares the response_cache variants, e.g. for threads 1..64
+template<typename Cache>
+inline double bench_cache_lookups(Cache& cache, const size_t threads, const size_t keys,
+                                  const size_t ms, const size_t write_us = 0)
+{
+    std::vector<string> names;
+    for (size_t i = 0; i < keys; ++i) {
+        names.push_back("/static/file" + dtos(i) + ".html");
+        response_ptr res(new _response);
+        res->content.assign(1024, 'x');
+        cache.set(names.back(), res);
+    }
+
+    boost::atomic<bool> stop(false);
+    boost::atomic<size_t> lookups(0);
+    std::vector<boost::thread> readers;
+    for (size_t i = 0; i < threads; ++i) {
+        readers.emplace_back([&, i]() {
+            uint64_t x = 0x9e3779b97f4a7c15ULL * (i + 1);
+            size_t n = 0;
+            boost::asio::streambuf response;
+            while (not stop.load(boost::memory_order_relaxed)) {
+                for (size_t k = 0; k < 256; ++k, ++n) {
+                    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                    cache.write(names[x % keys], response);
+                    response.consume(response.size());
+                }
+            }
+            lookups.fetch_add(n);
+        });
+    }
+    boost::thread writer([&]() {
+        response_ptr res(new _response);
+        for (size_t i = 0; write_us and not stop.load(boost::memory_order_relaxed); ++i) {
+            cache.set(names[i % keys], res);
+            boost::this_thread::sleep_for(boost::chrono::microseconds(write_us));
+        }
+    });
+
+    auto start = boost::posix_time::microsec_clock::universal_time();
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
+    stop.store(true);
+    for (auto& t : readers) {
+        t.join();
+    }
+    writer.join();
+    auto elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    return lookups.load() * 1e6 / max<double>(elapsed.total_microseconds(), 1);
+}
+
+
 }
 
 
@@ -10,6 +10,9 @@
 #include <cstdlib>
 #include "serverbase.hpp"
 #include "rescache.hpp"
+#include "tls.hpp"
+#include "uring.hpp"
+#include "h2.hpp"
 #include <boost/asio/ssl.hpp>
 #include <boost/noncopyable.hpp>
 
@@ -35,25 +38,89 @@ struct server<asio_http>: public server_base<asio_http>
     {
     }
 
+    ~server(void)
+    {
+        if (__uring) {
+            __uring->stop();
+        }
+    }
+
     response_cache<>& cache(void)
     {
         return __rescache;
     }
 
+    bool websockets_supported(void) const
+    {
+        return not __uring;
+    }
+
+    // pick the io backend before start(), false if this kernel cannot run io_uring with these
+    // options or websocket routes are set, the asio backend is kept then. the ring serves
+    // http/1 only, it does not hand upgraded sockets over to websockets or h2c
+    bool set_backend(const IO_BACKEND backend, const uring_options& opts = uring_options())
+    {
+        __uring.reset();
+        if (backend == backend_uring) {
+            if (not __websockets.empty()) {
+                __loger.commit(__func__, "websocket routes need the asio backend, staying with asio", "ERROR");
+                return false;
+            }
+            if (not uring_backend::supported(*this, opts)) {
+                __loger.commit(__func__, "io_uring not usable, staying with asio", "ERROR");
+                return false;
+            }
+            __uring.reset(new uring_backend(*this, opts));
+        }
+        __loger.commit(__func__, backend == backend_uring ? "io_uring backend" : "asio backend");
+        return true;
+    }
+
+    // zeros with the asio backend
+    uring_stats io_stats(void)
+    {
+        return __uring ? __uring->stats() : uring_stats();
+    }
+
+    void stop(void)
+    {
+        server_base<asio_http>::stop();  //drains the offload pool into the rings first
+        if (__uring) {
+            __uring->stop();
+        }
+    }
+
 protected:
     response_cache<> __rescache;
+    boost::shared_ptr<uring_backend> __uring;
+    boost::shared_ptr<asio_service::work> __uring_work;
 
     void accept(void)
     {
+        if (__uring) {
+            // the rings accept on their own threads, the io_service keeps signals and timers
+            if (not __uring_work) {
+                __uring_work.reset(new asio_service::work(__ioservice));
+                __uring->start(__num_threads);
+            }
+            return;
+        }
+        if (not reserve_connection()) {
+            return; //resumed by connection_closed()
+        }
         //create new socket for this connection
         //shared_ptr is used to pass temporary objects to the asynchronous functions
-        boost::shared_ptr<asio_http> asocket(new asio_http(__ioservice));
+        auto asocket = make_connection(new asio_http(__ioservice));
 
         __acceptor.async_accept(*asocket,
             [this, asocket](const error_code& ec) {
+                // timed here, traced under the first request of the connection
+                trace_setup setup;
+                setup.accept_begin = __tracer.enabled() ? trace_clock() : 0;
                 accept();   //immediately start accepting a new connection
                 if(!ec) {
-                    read_request_and_content(asocket);
+                    setup.accept_end = setup.accept_begin ? trace_clock() : 0;
+                    read_request_and_content(asocket, setup);
                 }
             }
         );
@@ -73,28 +140,45 @@ struct server<asio_https>: public server_base<asio_https>
            const std::string& private_key_file,
            size_t timeout_request = 5,
            size_t timeout_content = 300,
-           const std::string& verify_file = std::string()):
+           const std::string& verify_file = std::string(),
+           const tls_options& tls = tls_options()):
        /* different from server<asio_http> */
        server_base<asio_https>::server_base(addr, port, num_threads, timeout_request, timeout_content),
-       context(boost::asio::ssl::context::sslv23)
+       context(boost::asio::ssl::context::sslv23),
+       __tls(tls),
+       __ticket_timer(__ioservice)
     {
+        configure_tls_context(context, __tls, &__keyring);
         context.use_certificate_chain_file(cert_file);
         context.use_private_key_file(private_key_file, boost::asio::ssl::context::pem);
         if (verify_file.size() > 0) {
             context.load_verify_file(verify_file);
         }
+        if (__tls.session_tickets and __tls.ticket_rotation > 0) {
+            rotate_ticket_keys();
+        }
     }
 
     boost::asio::ssl::context context;
 
+    const tls_stats& handshake_stats(void) const
+    {
+        return __stats;
+    }
+
     void accept(void)
     {
+        if (not reserve_connection()) {
+            return; //resumed by connection_closed()
+        }
         //Create new socket for this connection
         //Shared_ptr is used to pass temporary objects to the asynchronous functions
-        boost::shared_ptr<asio_https> socket(new asio_https(__ioservice, context));
+        auto socket = make_connection(new asio_https(__ioservice, context));
 
         __acceptor.async_accept((*socket).lowest_layer(),
             [this, socket](const error_code& ec) {
+                trace_setup setup;
+                setup.accept_begin = __tracer.enabled() ? trace_clock() : 0;
                 accept();
                 if (!ec) {
                     //Set timeout on the following boost::asio::ssl::stream::async_handshake
@@ -102,13 +186,33 @@ struct server<asio_https>: public server_base<asio_https>
                     if (__req_timeout > 0) {
                         timer = set_timeout_on_socket(socket, __req_timeout);
                     }
+                    if (setup.accept_begin) {
+                        setup.accept_end = setup.handshake_begin = trace_clock();
+                    }
                     (*socket).async_handshake(boost::asio::ssl::stream_base::server,
-                        [this, socket, timer] (const error_code& ec) {
+                        [this, socket, timer, setup] (const error_code& ec) mutable {
                             if (__req_timeout > 0) {
                                 timer->cancel();
                                 }
+                            setup.handshake_end = setup.handshake_begin ? trace_clock() : 0;
                             if(!ec) {
-                                read_request_and_content(socket);
+                                if (SSL_session_reused(socket->native_handle())) {
+                                    __stats.resumed.fetch_add(1, boost::memory_order_relaxed);
+                                } else {
+                                    __stats.full.fetch_add(1, boost::memory_order_relaxed);
+                                }
+                                const unsigned char* proto = nullptr;
+                                unsigned int length = 0;
+                                SSL_get0_alpn_selected(socket->native_handle(), &proto, &length);
+                                if (length == 2 and memcmp(proto, "h2", 2) == 0) {
+                                    boost::asio::streambuf none;
+                                    h2_session<asio_https>::start(this, socket, none, false);
+                                }
+                                else {
+                                    read_request_and_content(socket, setup);
+                                }
+                            } else {
+                                __stats.failed.fetch_add(1, boost::memory_order_relaxed);
                             }
                         }
                     );
@@ -117,6 +221,24 @@ struct server<asio_https>: public server_base<asio_https>
         );
     }
 
+protected:
+    tls_options    __tls;
+    tls_stats      __stats;
+    ticket_keyring __keyring;
+    boost::asio::deadline_timer __ticket_timer;
+
+    void rotate_ticket_keys(void)
+    {
+        __ticket_timer.expires_from_now(boost::posix_time::seconds(__tls.ticket_rotation));
+        __ticket_timer.async_wait([this](const error_code& ec) {
+            if (not ec) {
+                __keyring.rotate();
+                __loger.commit("rotate_ticket_keys", "session ticket key rotated");
+                rotate_ticket_keys();
+            }
+        });
+    }
+
 };
 
 }
@@ -9,19 +9,41 @@
 #define SERVER_BASE_HTTP_HPP
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <new>
+#include <set>
+#include <functional>
 #include <boost/regex.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/thread.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include "utils.hpp"
 #include "typedefs.hpp"
 #include "log.hpp"
+#include "reply.hpp"
+#include "admission.hpp"
+#include "listener.hpp"
+#include "ratelimit.hpp"
+#include "accesslog.hpp"
+#include "prefork.hpp"
+#include "affinity.hpp"
+#include "busypoll.hpp"
+#include "keepalive.hpp"
+#include "trace.hpp"
+#include "workpool.hpp"
+#include "microcache.hpp"
+#include "ws.hpp"
 
 namespace basiohttp
 {
 
 const string DEFAULT_LOG_FILE = "bas.log";
 const size_t MAX_THREADS = 64;
+const size_t DEFAULT_OFFLOAD_THREADS = 8;
+
+template<typename socket_type> struct h2_session; //h2.hpp
 
 template<typename socket_type>
 struct server_base
@@ -39,10 +61,14 @@ struct server_base
                 const size_t timeout_send_or_receive)
                 /* response timeout for communicate with clients */
     try:
+        __accept_paused(0),
+        __spin_us(0),
         __endpoint(addrv4, port),
         __acceptor(__ioservice, __endpoint),
         __sigset(__ioservice),
         __num_threads(min(num_threads, MAX_THREADS)),
+        __offload_workers(0),
+        __offload_queued(0),
         __req_timeout(req_timeout),
         __con_timeout(timeout_send_or_receive),
         __loger(DEFAULT_LOG_FILE, 512)
@@ -59,6 +85,12 @@ struct server_base
     // the only method should be implemented by sub classes
     virtual void accept(void) = 0;
 
+    // whether the io backend can hand an upgraded socket to a websocket, see set_websocket
+    virtual bool websockets_supported(void) const
+    {
+        return true;
+    }
+
     // for client using...
     inline asio_service& get_io_service(void)
     {
@@ -85,12 +117,17 @@ struct server_base
     // handler_for_server like void fun(streambuf_ptr, request_ptr)
     // which will be callbacked in asnyc routines
     // note streambuf_ptr should be wrapped into ostream in handler_for_server
-    bool set_specific_logical(const string& sre, const string& method, const handler_for_server& rh)
+    // a blocking handler (disk io, backend calls...) runs in the offload pool, not on io threads
+    bool set_specific_logical(const string& sre, const string& method, const handler_for_server& rh,
+                            const bool blocking = false)
     {
         auto flag = boost::regex::perl|boost::regex::optimize;
         try {
             __user_logical[sre][method] = rh;
             __sredict[sre] = boost::regex(sre, flag);
+            if (blocking) {
+                __blocking_routes[sre].insert(method);
+            }
         }
         catch (const std::exception& e) {
             __loger.commit(__func__, e.what(), "ERROR");
@@ -101,12 +138,16 @@ struct server_base
     }
 
     // same as set_specific_logical, but priority level is lower than set_specific_logical
-    bool set_default_logical(const string& sre, const string& method, const handler_for_server& rh)
+    bool set_default_logical(const string& sre, const string& method, const handler_for_server& rh,
+                           const bool blocking = false)
     {
         auto flag = boost::regex::perl|boost::regex::optimize;
         try {
             __default_logical[sre][method] = rh;
             __sredict[sre] = boost::regex(sre, flag);
+            if (blocking) {
+                __blocking_routes[sre].insert(method);
+            }
         }
         catch (const std::exception& e) {
             __loger.commit(__func__, e.what(), "ERROR");
@@ -116,6 +157,193 @@ struct server_base
         return true;
     }
 
+    // GET requests of `sre` asking for "Upgrade: websocket" switch protocols and are handed to
+    // the handlers of `endpoint`, other requests of the path go the usual way. asio backend
+    // only, false with the io_uring one
+    bool set_websocket(const string& sre, const websocket_endpoint<socket_type>& endpoint)
+    {
+        if (not websockets_supported()) {
+            __loger.commit(__func__, "websockets need the asio backend: "+sre, "ERROR");
+            return false;
+        }
+        auto flag = boost::regex::perl|boost::regex::optimize;
+        try {
+            __sredict[sre] = boost::regex(sre, flag);
+            __websockets[sre] = endpoint;
+        }
+        catch (const std::exception& e) {
+            __loger.commit(__func__, e.what(), "ERROR");
+            return false;
+        }
+        __loger.commit(__func__, "WEBSOCKET "+sre+" registed!");
+        return true;
+    }
+
+    // limits on connections, in flight requests and queue delay, call before start()
+    void set_admission(const admission_options& opts)
+    {
+        __admission = opts;
+    }
+
+    // at most `limit` requests of route `sre` are handled at once, others get a 503
+    bool set_route_limit(const string& sre, const size_t limit)
+    {
+        if (not __sredict.count(sre)) {
+            __loger.commit(__func__, "no such route: "+sre, "ERROR");
+            return false;
+        }
+        __route_limits[sre].reset(new route_limit(limit));
+        return true;
+    }
+
+    // token bucket per client ip for the requests of route `sre`, or of all routes if `sre` is
+    // empty. a client out of tokens gets a 429 before any handler runs, call before start()
+    bool set_rate_limit(const string& sre, const rate_limit_options& opts)
+    {
+        if (opts.rate <= 0 or opts.burst < 1) {
+            __loger.commit(__func__, "bad rate limit for: "+sre, "ERROR");
+            return false;
+        }
+        if (sre.empty()) {
+            __global_rate.reset(new ip_rate_limiter(opts));
+            return true;
+        }
+        if (not __sredict.count(sre)) {
+            __loger.commit(__func__, "no such route: "+sre, "ERROR");
+            return false;
+        }
+        __rate_limits[sre].reset(new ip_rate_limiter(opts));
+        return true;
+    }
+
+    // GET and HEAD responses of route `sre` are cached for opts.ttl_ms and served stale while a
+    // refresh runs, see micro_cache. call after the handlers of the route are set and before
+    // start(). a refresh runs in the offload pool if the route is blocking, else on an io thread
+    bool set_micro_cache(const string& sre, const micro_cache_options& opts)
+    {
+        micro_cache_ptr cache(new micro_cache(opts, [this, sre](const boost::function<void()>& task) {
+            if (__offload and is_blocking(&sre, "GET") and __offload->submit(task)) {
+                return;
+            }
+            __ioservice.post(task);
+        }));
+        size_t wrapped = 0;
+        for (logical_dict* dict : {&__user_logical, &__default_logical}) {
+            auto found = dict->find(sre);
+            if (found == dict->end()) {
+                continue;
+            }
+            for (auto& m : found->second) {
+                if (m.first == "GET" or m.first == "HEAD") {
+                    const handler_for_server handler = m.second;
+                    m.second = [cache, handler](streambuf_ptr response, request_ptr r) {
+                        cache->serve(handler, response, r);
+                    };
+                    ++wrapped;
+                }
+            }
+        }
+        if (not wrapped) {
+            __loger.commit(__func__, "no GET or HEAD route: "+sre, "ERROR");
+            return false;
+        }
+        __micro_caches[sre] = cache;
+        return true;
+    }
+
+    // null if route `sre` has none
+    micro_cache_ptr micro_cache_of(const string& sre) const
+    {
+        auto found = __micro_caches.find(sre);
+        return found != __micro_caches.end() ? found->second : micro_cache_ptr();
+    }
+
+    // backlog, accept options and the number of pending accepts, call before start()
+    void set_listener(const listener_options& opts)
+    {
+        __listener = opts;
+    }
+
+    // spans of request phases, switched on and off at runtime with tracer().enable(sample_every)
+    // and disable(), written out with tracer().dump(path)
+    request_tracer& tracer(void)
+    {
+        return __tracer;
+    }
+
+    // requests per connection, idle timeout and HTTP/1.0 keep-alive, call before start()
+    void set_keep_alive(const keep_alive_options& opts)
+    {
+        __keep_alive = opts;
+    }
+
+    // an idle io thread keeps polling for `spin_us` before it blocks in the kernel, which saves
+    // the wakeup latency at the price of a busy core, 0 turns it off. meant for dedicated cores,
+    // best with set_affinity(). SO_BUSY_POLL is listener_options::busy_poll. call before start()
+    void set_busy_poll(const size_t spin_us)
+    {
+        __spin_us = spin_us;
+    }
+
+    const busy_poll_stats& busy_poll(void) const
+    {
+        return __busy_stats;
+    }
+
+    // pinning of the io threads to cores / numa nodes, call before start(). the topology is
+    // read here, while the calling thread still has the cpu mask of the process
+    bool set_affinity(const affinity_options& opts)
+    {
+        const cpu_topology& topology = cpu_topology::system();
+        for (const int cpu : opts.cpus) {
+            if (cpu < 0 or static_cast<size_t>(cpu) >= topology.node_of.size() or topology.node_of[cpu] < 0) {
+                __loger.commit(__func__, "cpu not available: "+dtos(cpu), "ERROR");
+                return false;
+            }
+        }
+        __affinity = opts;
+        return true;
+    }
+
+    // one record per response, written by a thread of the log that start() creates (so it
+    // exists in every worker of start_workers()), call before start()
+    bool set_access_log(const access_log_options& opts)
+    {
+        const int fd = ::open(opts.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            __loger.commit(__func__, "cannot open access log "+opts.path+": "+strerror(errno), "ERROR");
+            return false;
+        }
+        ::close(fd);
+        __access_opts.reset(new access_log_options(opts));
+        return true;
+    }
+
+    // null before start()
+    access_logger_ptr access_log(void) const
+    {
+        return __access;
+    }
+
+    const admission_stats& admission(void) const
+    {
+        return __admission_stats;
+    }
+
+    // pool for handlers registered as blocking, created at start() with DEFAULT_OFFLOAD_THREADS
+    // if not set. max_queued 0 means unbounded, otherwise a full queue answers 503
+    void set_offload_pool(const size_t num_workers, const size_t max_queued)
+    {
+        __offload_workers = max<size_t>(num_workers, 1);
+        __offload_queued = max_queued;
+    }
+
+    // null before start()
+    work_pool_ptr offload_pool(void) const
+    {
+        return __offload;
+    }
+
     // run http server forever!
     void start(void)
     {
@@ -128,27 +356,128 @@ struct server_base
             __logical_list.push_back(it);
         }
 
-        this->accept(); //impl by sub class
+        // threads are made here, not when set, so none exists yet when start_workers() forks
+        if (not __offload and (__offload_workers or not __blocking_routes.empty())) {
+            __offload.reset(new work_pool(__offload_workers ? __offload_workers : DEFAULT_OFFLOAD_THREADS,
+                                          __offload_queued));
+        }
+        if (__access_opts and not __access) {
+            try {
+                __access.reset(new access_logger(*__access_opts));
+            }
+            catch (const std::exception& e) {
+                __loger.commit(__func__, e.what(), "ERROR");
+            }
+        }
+
+        try {
+            apply_listener_options(__acceptor, __listener);
+        }
+        catch (const std::exception& e) {
+            __loger.commit(__func__, e.what(), "ERROR");
+        }
 
+        // every accept() keeps one async_accept outstanding and re-arms it on completion
+        const size_t pending = __listener.pending_accepts ? __listener.pending_accepts : max<size_t>(__num_threads, 1);
+        for (size_t i = 0; i < pending; ++i) {
+            this->accept(); //impl by sub class
+        }
+
+        // thread c on plan[c], the calling thread is io thread 0
+        const std::vector<int> plan = plan_affinity(__affinity, max<size_t>(__num_threads, 1));
         __threads.clear();
         for (size_t c = 1; c < __num_threads; ++c) {
-            __threads.emplace_back( [this](){__ioservice.run();} ); //not push_back
+            const int cpu = plan[c];
+            __threads.emplace_back( [this, cpu](){ pin_thread(cpu); run_io(); } ); //not push_back
         }
+        pin_thread(plan[0]);
 
         __loger.commit(__func__, "server, number threads: "+dtos(__num_threads));
         __loger.flush();
 
-        __ioservice.run();
+        run_io();
 
         for (auto& t : __threads) {
             t.join();
         }
     }
 
+    // pre-fork mode instead of start(): this process becomes the master of opts.workers processes
+    // that run start() on the listening socket bound already, and forks a worker again when one
+    // dies. call it before anything has started threads, from the main thread; worker i writes
+    // its access log to <path>.<i>. returns in the master once SIGINT, SIGTERM or SIGQUIT
+    // stopped all workers
+    int start_workers(const prefork_options& opts)
+    {
+        prefork_master master(opts, [this](const string& msg, const char* level) {
+            __loger.commit("prefork", msg, level);
+            __loger.flush();
+        });
+        __loger.commit(__func__, "pre-fork, number workers: "+dtos(master.workers()));
+        __loger.flush();
+
+        return master.run(
+            [this](const size_t index) {
+                if (__access_opts) {
+                    __access_opts->path += "." + dtos(index);
+                }
+                asio_signals term(__ioservice, SIGTERM);
+                term.async_wait([this](const error_code& ec, int) {
+                    if (not ec) {
+                        stop();
+                    }
+                });
+                start();
+                __access.reset(); //flushes
+                __loger.flush();
+                return 0;
+            },
+            [this](const FORK_EVENT event) {
+                if (event == fork_prepare) {
+                    __loger.flush(); //or workers write the master's buffered lines again
+                    __ioservice.notify_fork(asio_service::fork_prepare);
+                }
+                else {
+                    __ioservice.notify_fork(event == fork_child ? asio_service::fork_child : asio_service::fork_parent);
+                }
+            });
+    }
+
+    // io_service::run() of one io thread, or with busy polling: poll() while it finds handlers or
+    // the thread has been idle less than __spin_us, run_one() blocking otherwise
+    void run_io(void)
+    {
+        if (not __spin_us) {
+            __ioservice.run();
+            return;
+        }
+        busy_poll_meter meter(__busy_stats, __spin_us);
+        for (;;) {
+            const uint64_t begin = steady_us();
+            const size_t n = __ioservice.poll();
+            const uint64_t end = steady_us();
+            meter.polled(begin, end, n);
+            if (n or meter.spinning(end)) {
+                if (__ioservice.stopped()) {
+                    break;
+                }
+                continue;
+            }
+            meter.blocking();
+            if (not __ioservice.run_one()) {
+                break;
+            }
+            meter.woken(steady_us());
+        }
+    }
+
     // just a tag...
     void stop(void)
     {
         __ioservice.stop();
+        if (__offload) {
+            __offload->stop();
+        }
         __loger.flush();
     }
 
@@ -170,55 +499,519 @@ struct server_base
         return timer;
     }
 
-    void read_request_and_content(socket_type_ptr socket)
+    // called by accept() before it allocates a socket, takes a connection slot or returns false,
+    // that accept is paused then until a connection closes
+    bool reserve_connection(void)
+    {
+        auto& open = __admission_stats.connections;
+        if (not __admission.max_connections) {
+            open.fetch_add(1, boost::memory_order_relaxed);
+            return true;
+        }
+        for (;;) {
+            size_t n = open.load();
+            while (n < __admission.max_connections) {
+                if (open.compare_exchange_weak(n, n + 1)) {
+                    return true;
+                }
+            }
+            __accept_paused.fetch_add(1);
+            // a connection may have closed before it could see this accept paused
+            if (open.load() >= __admission.max_connections or not resume_paused()) {
+                return false;
+            }
+        }
+    }
+
+    // takes one paused accept off the count, true if there was one
+    bool resume_paused(void)
     {
-        request_ptr r(new _request());
-        async_timer_ptr timer;
+        size_t paused = __accept_paused.load();
+        while (paused > 0) {
+            if (__accept_paused.compare_exchange_weak(paused, paused - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        if (__req_timeout > 0) {
-            timer = set_timeout_on_socket(socket, __req_timeout);
+    // the socket owns the slot of reserve_connection() until it is destroyed
+    socket_type_ptr make_connection(socket_type* socket)
+    {
+        return socket_type_ptr(socket, [this](socket_type* s) {
+            delete s;
+            this->connection_closed();
+        });
+    }
+
+    void connection_closed(void)
+    {
+        __admission_stats.connections.fetch_sub(1);
+        if (__accept_paused.load() and not __ioservice.stopped() and resume_paused()) {
+            __ioservice.post([this]() { this->accept(); });
         }
+    }
 
-        auto read_header_callback = [this,timer,r,socket](const error_code& ec, size_t bytes_transferred) {
-            if (__req_timeout > 0) {
-                timer->cancel();
+    inline bool admit_request(route_limit* limit)
+    {
+        auto inflight = __admission_stats.inflight.fetch_add(1, boost::memory_order_relaxed);
+        if (__admission.max_inflight and inflight >= __admission.max_inflight) {
+            __admission_stats.inflight.fetch_sub(1, boost::memory_order_relaxed);
+            return false;
+        }
+        if (limit and not limit->acquire()) {
+            __admission_stats.inflight.fetch_sub(1, boost::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    inline void release_request(route_limit* limit)
+    {
+        if (limit) {
+            limit->release();
+        }
+        __admission_stats.inflight.fetch_sub(1, boost::memory_order_relaxed);
+    }
+
+    // seconds a kept connection may wait for its next request
+    inline size_t idle_timeout(void) const
+    {
+        return __keep_alive.idle_timeout ? __keep_alive.idle_timeout : __req_timeout;
+    }
+
+    // one per connection: the request loop is a stackless coroutine (boost::asio::coroutine),
+    // socket, request, response buffer and timer live here for the whole connection and the
+    // only reference is moved from one completion handler to the next
+    struct connection: public boost::asio::coroutine,
+                       public boost::enable_shared_from_this<connection>
+    {
+        typedef boost::shared_ptr<connection> pointer;
+
+        // completion handler of every step
+        struct resume
+        {
+            pointer self;
+
+            void operator()(const error_code& ec = error_code(), const size_t nbytes = 0)
+            {
+                connection& c = *self;
+                c.step(std::move(self), ec, nbytes);
             }
+        };
+
+        struct timeout
+        {
+            pointer self;
+
+            void operator()(const error_code& ec)
+            {
+                // a re-armed timer may have fired already, only its current expiry counts
+                if (not ec and self->__timer.expiry() <= boost::asio::steady_timer::clock_type::now()) {
+                    self->__server->__loger.commit("connection", "time out!");
+                    self->close();
+                }
+            }
+        };
+
+        connection(server_base* server, socket_type_ptr socket, const trace_setup& setup):
+            __server(server),
+            __socket(socket),
+            __timer(server->__ioservice),
+            __response(new boost::asio::streambuf),
+            __body_size(0),
+            __unread(0),
+            __served(0),
+            __queued(0),
+            __started(0),
+            __dispatched(0),
+            __trace(0),
+            __trace_start(0),
+            __trace_phase(0),
+            __setup(setup),
+            __limit(nullptr),
+            __route(nullptr),
+            __valid(false),
+            __keep(false),
+            __reject(false),
+            __limited(false),
+            __deferred(false),
+            __pending(0)
+        {
+        }
+
+        void start(void)
+        {
+            // the peer is looked up once, requests copy the text and rate limits use the key
+            error_code ec;
+            auto address = __socket->lowest_layer().remote_endpoint(ec).address();
             if (not ec) {
-                // r->streambuf.size() is not necessarily the same as bytes_transferred, so calc it!
-                auto num_additional_bytes = r->content_buffer.size() - bytes_transferred;
+                __address = address.to_string();
+                __peer = make_ip_key(address);
+            }
+            step(this->shared_from_this(), error_code(), 0);
+        }
+
+        void close(void)
+        {
+            error_code ignored;
+            __socket->lowest_layer().shutdown(asio_socket::shutdown_both, ignored);
+            __socket->lowest_layer().close(ignored);
+        }
+
+        void arm_timer(const pointer& self, const size_t seconds)
+        {
+            if (seconds > 0) {
+                __timer.expires_after(std::chrono::seconds(seconds));
+                __timer.async_wait(timeout{self});
+            }
+        }
+
+        // requests and buffers are reused unless a handler still holds on to them
+        void next_request(void)
+        {
+            if (not __request or __request.use_count() > 1) {
+                request_ptr fresh(new _request);
+                if (__request and __request->content_buffer.size()) {
+                    // pipelined bytes of the next request
+                    auto& from = __request->content_buffer;
+                    auto n = boost::asio::buffer_copy(fresh->content_buffer.prepare(from.size()), from.data());
+                    fresh->content_buffer.commit(n);
+                }
+                connection* raw = this;
+                fresh->__defer = [raw]() { return raw->defer(); };
+                __request.swap(fresh);
+            }
+            else {
+                auto& r = *__request;
+                r.path.clear();
+                r.method.clear();
+                r.version.clear();
+                r.match1.clear();
+                r.match2.clear();
+                r.match3.clear();
+                r.header.clear();
+                r.content.clear();
+            }
+            if (__response.use_count() > 1) {
+                __response.reset(new boost::asio::streambuf);
+            }
+            __body_size = 0;
+            __limit = nullptr;
+            __route = nullptr;
+            __deferred = false;
+            __reject = false;
+            __limited = false;
+        }
+
+        boost::function<void(void)> defer(void)
+        {
+            __deferred = true;
+            __pending.store(2); //the handler returning and the done call, whichever comes last resumes
+            pointer self = this->shared_from_this();
+            return [self]() {
+                if (self->__pending.fetch_sub(1) == 1) {
+                    self->__server->__ioservice.post(resume{self});
+                }
+            };
+        }
+
+        bool run_handler(void)
+        {
+            return __server->run_handler(__handler, __response, __request);
+        }
+
+        void log_access(const uint16_t status, const size_t bytes)
+        {
+            const uint64_t now = steady_us();
+            __server->__access->commit(__peer, __request->method, __request->path, status, bytes,
+                                       now - __started, __dispatched ? now - __dispatched : 0);
+        }
+
+        // trace_clock() if this request is traced, 0 otherwise
+        inline uint64_t trace_mark(void) const
+        {
+            return __trace ? trace_clock() : 0;
+        }
 
-                this->parse_request(r, r->content);
+        // a span from `begin` to now
+        inline void trace(const TRACE_PHASE phase, const uint64_t begin)
+        {
+            if (__trace) {
+                __server->__tracer.span(__trace, phase, begin, trace_clock(), __route);
+            }
+        }
 
-                // if content, read that as well
-                if (r->header.count("Content-Length") > 0) {
-                    // set timeout on the following boost::asio::async-read or write function
-                    async_timer_ptr next_timer;
-                    if (__con_timeout > 0) {
-                        next_timer = this->set_timeout_on_socket(socket, __con_timeout);
+        void offload(pointer self)
+        {
+            pointer keep(self);
+            bool queued = __server->__offload->submit([keep]() {
+                const uint64_t begin = keep->trace_mark();
+                keep->run_handler();
+                keep->trace(trace_handler, begin);
+                if (not keep->__deferred or keep->__pending.fetch_sub(1) == 1) {
+                    keep->__server->__ioservice.post(resume{keep});
+                }
+            });
+            if (not queued) {
+                __server->__ioservice.post(std::bind(resume{std::move(self)},
+                                                     boost::asio::error::no_buffer_space, 0));
+            }
+        }
+
+        void step(pointer self, const error_code& ec, const size_t)
+        {
+            server_base& s = *__server;
+
+            BOOST_ASIO_CORO_REENTER (this) {
+                for (;;) {
+                    next_request();
+                    __trace = s.__tracer.begin_request();
+                    __trace_start = __trace_phase = trace_mark();
+                    if (__setup.accept_begin) {
+                        s.__tracer.span(__trace, trace_accept, __setup.accept_begin, __setup.accept_end);
+                        if (__setup.handshake_begin) {
+                            s.__tracer.span(__trace, trace_handshake, __setup.handshake_begin, __setup.handshake_end);
+                        }
+                        __setup = trace_setup();
+                    }
+                    arm_timer(self, __served ? s.idle_timeout() : s.__req_timeout);
+                    BOOST_ASIO_CORO_YIELD boost::asio::async_read_until(*__socket, __request->content_buffer,
+                                                                        "\r\n\r\n", resume{std::move(self)});
+                    if (ec) {
+                        break;
+                    }
+                    if (s.__access) {
+                        __started = steady_us();
+                        __dispatched = 0;
                     }
+                    trace(trace_read_head, __trace_phase);
+                    __trace_phase = trace_mark();
+                    s.parse_request(__request, __request->content);
+                    trace(trace_parse, __trace_phase);
 
-                    auto read_body_callback = [this,next_timer,r,socket](const error_code& ec, size_t bytes_transferred) {
-                        if (__con_timeout > 0) {
-                            next_timer->cancel();
+                    // h2c with prior knowledge, the preface reads as a "PRI * HTTP/2.0" request.
+                    // the session owns the socket from here, the coroutine ends unfinished
+                    if (__request->method == "PRI" and __request->version == "2.0") {
+                        __timer.cancel();
+                        h2_session<socket_type>::start(__server, __socket, __request->content_buffer, true);
+                        return;
+                    }
+                    if (not s.__websockets.empty() and ws_upgrade_requested(*__request) and
+                        s.start_websocket(__socket, __request)) {
+                        __timer.cancel();
+                        return;
+                    }
+
+                    if (__request->header.count("Content-Length") > 0) {
+                        try {
+                            __body_size = stod<size_t>(__request->header["Content-Length"]);
                         }
-                        if (not ec) {
-                            this->write_response(socket, r);
+                        catch (const std::exception& e) {
+                            break;
                         }
-                    };
+                        if (__request->content_buffer.size() < __body_size) {
+                            arm_timer(self, s.__con_timeout);
+                            __trace_phase = trace_mark();
+                            BOOST_ASIO_CORO_YIELD boost::asio::async_read(*__socket, __request->content_buffer,
+                                boost::asio::transfer_exactly(__body_size - __request->content_buffer.size()),
+                                resume{std::move(self)});
+                            if (ec) {
+                                break;
+                            }
+                            trace(trace_read_body, __trace_phase);
+                        }
+                    }
+
+                    // with codel enabled the request goes through the io queue once, so its
+                    // queue delay can be measured
+                    if (s.__admission.codel_target_us) {
+                        __queued = steady_us();
+                        BOOST_ASIO_CORO_YIELD s.__ioservice.post(resume{std::move(self)});
+                        if (not s.__shedder.admit(steady_us() - __queued, steady_us(), s.__admission)) {
+                            __reject = true;
+                            break;
+                        }
+                    }
+
+                    //check path and method, get right handler and matched in logical_dict
+                    __trace_phase = trace_mark();
+                    __valid = s.valid_request(__request, __matched, __handler, &__route);
+                    trace(trace_route, __trace_phase);
+                    __limit = s.find_route_limit(__route);
+                    if (not s.rate_allowed(__route, __peer)) {
+                        __limited = true;
+                        break;
+                    }
+                    if (not s.admit_request(__limit)) {
+                        __reject = true;
+                        break;
+                    }
+
+                    arm_timer(self, s.__con_timeout);
+                    __request->address = __address;
+                    __request->set_body(__body_size);
+                    __unread = __request->content_buffer.size();
+                    if (s.__access) {
+                        __dispatched = steady_us();
+                    }
+
+                    if (__valid) {
+                        __request->match1.assign(__matched[1]);
+                        __request->match2.assign(__matched[2]);
+                        __request->match3.assign(__matched[3]);
+
+                        if (s.__offload and s.is_blocking(__route, __request->method)) {
+                            __trace_phase = trace_mark();
+                            BOOST_ASIO_CORO_YIELD offload(std::move(self));
+                            if (ec) {
+                                s.release_request(__limit);
+                                __reject = true;
+                                break;
+                            }
+                            trace(trace_deferred, __trace_phase);
+                        }
+                        else {
+                            __trace_phase = trace_mark();
+                            run_handler();
+                            trace(trace_handler, __trace_phase);
+                            if (__deferred) {
+                                __trace_phase = trace_mark();
+                                BOOST_ASIO_CORO_YIELD {
+                                    if (__pending.fetch_sub(1) == 1) {
+                                        s.__ioservice.post(resume{std::move(self)});
+                                    }
+                                }
+                                trace(trace_deferred, __trace_phase);
+                            }
+                        }
+                    }
+                    else {
+                        ostream response(__response.get());
+                        response << templates::bad_request;
+                    }
+
+                    __keep = settle_keep_alive(*__request, *__response, ++__served, s.__keep_alive);
+                    if (s.__access) {
+                        log_access(response_status(*__response), __response->size());
+                    }
+                    __trace_phase = trace_mark();
+                    BOOST_ASIO_CORO_YIELD boost::asio::async_write(*__socket, *__response, resume{std::move(self)});
+                    s.release_request(__limit);
+                    if (ec) {
+                        break;
+                    }
+                    trace(trace_write, __trace_phase);
+                    trace(trace_request, __trace_start);
 
-                    auto ctsize = stod<size_t>(r->header["Content-Length"]);
-                    auto ntrans = boost::asio::transfer_exactly(ctsize - num_additional_bytes);
-                    boost::asio::async_read(*socket, r->content_buffer, ntrans, read_body_callback);
+                    // drop what the handler did not read of the body, keep pipelined requests
+                    {
+                        auto& buffer = __request->content_buffer;
+                        const size_t consumed = __unread - min(__unread, buffer.size());
+                        if (__body_size > consumed) {
+                            buffer.consume(__body_size - consumed);
+                        }
+                    }
+
+                    if (not __keep) {
+                        break;
+                    }
                 }
-                else {
-                    this->write_response(socket, r);
+
+                // shedding or admission failed, tell the client
+                if (__reject) {
+                    s.__admission_stats.rejected.fetch_add(1, boost::memory_order_relaxed);
+                    if (s.__access) {
+                        log_access(service_unavailable, templates::service_unavailable.size());
+                    }
+                    BOOST_ASIO_CORO_YIELD boost::asio::async_write(*__socket,
+                        boost::asio::buffer(templates::service_unavailable), resume{std::move(self)});
+                }
+                else if (__limited) {
+                    s.__admission_stats.limited.fetch_add(1, boost::memory_order_relaxed);
+                    if (s.__access) {
+                        log_access(too_many_requests, templates::too_many_requests.size());
+                    }
+                    BOOST_ASIO_CORO_YIELD boost::asio::async_write(*__socket,
+                        boost::asio::buffer(templates::too_many_requests), resume{std::move(self)});
                 }
             }
-        };
 
-        boost::asio::async_read_until(*socket, r->content_buffer, "\r\n\r\n", read_header_callback);
+            if (self and this->is_complete()) {
+                __timer.cancel();
+                close();
+            }
+        }
+
+        server_base*    __server;
+        socket_type_ptr __socket;
+        boost::asio::steady_timer __timer;
+
+        request_ptr   __request;
+        streambuf_ptr __response;
+        size_t        __body_size;
+        size_t        __unread;     // bytes of body (and beyond) buffered before the handler ran
+        size_t        __served;     // responses on this connection
+        uint64_t      __queued;
+        uint64_t      __started;    // steady_us() of the request head read, for the access log
+        uint64_t      __dispatched; // and of the handler dispatched, 0 if none ran
+        uint64_t      __trace;      // request_tracer id, 0 if not traced
+        uint64_t      __trace_start;
+        uint64_t      __trace_phase;
+        trace_setup   __setup;      // traced with the first request, cleared then
+
+        boost::smatch      __matched;
+        handler_for_server __handler;
+        route_limit*       __limit;
+        const string*      __route;
+        bool               __valid;
+        bool               __keep;      // the connection stays open after this response
+
+        bool               __reject;
+        bool               __limited;
+        string             __address;
+        ip_key             __peer;
+        bool               __deferred;
+        boost::atomic<int> __pending;
+    };
+
+    // an exception of a handler becomes a 500 for that request only
+    bool run_handler(const handler_for_server& handler, streambuf_ptr response, request_ptr request)
+    {
+        try {
+            handler(response, request);
+        }
+        catch (const std::exception& e) {
+            __loger.commit(__func__, e.what(), "ERROR");
+            response->consume(response->size());
+            header_builder(*response).status(internal_server_error).content_length(0).end();
+            return false;
+        }
+        return true;
+    }
+
+    void read_request_and_content(socket_type_ptr socket, const trace_setup& setup = trace_setup())
+    {
+        boost::make_shared<connection>(this, socket, setup)->start();
     }
 
+    // false if no websocket route matches the path
+    bool start_websocket(socket_type_ptr socket, request_ptr req)
+    {
+        for (auto& it : __websockets) {
+            boost::smatch matched;
+            if (boost::regex_match(req->path, matched, __sredict[it.first])) {
+                req->match1.assign(matched[1]);
+                req->match2.assign(matched[2]);
+                req->match3.assign(matched[3]);
+                error_code ec;
+                req->address = socket->lowest_layer().remote_endpoint(ec).address().to_string();
+                websocket<socket_type>::start(socket, __ioservice, it.second, req);
+                return true;
+            }
+        }
+        return false;
+    }
 
     // istream is very slow now..., better ideas?
     void parse_request(request_ptr r, istream& stream) const
@@ -259,15 +1052,19 @@ struct server_base
     }
 
 
-    inline bool valid_request(const request_ptr& req, boost::smatch& matched, handler_for_server& handler)
+    inline bool valid_request(const request_ptr& req, boost::smatch& matched, handler_for_server& handler,
+                              const string** route = nullptr)
     {
         auto iter = std::find_if(__logical_list.begin(), __logical_list.end(),
-            [this, req, &matched, &handler](const logical_dict::iterator& _iter){
+            [this, req, &matched, &handler, route](const logical_dict::iterator& _iter){
                 auto sre  = _iter->first;
                 auto mhd = _iter->second;
                 if (boost::regex_match(req->path, matched, __sredict[sre])) {
                     if (mhd.count(req->method)) {
                         handler = mhd[req->method];
+                        if (route) {
+                            *route = &_iter->first;
+                        }
                         return true;
                     }
                 }
@@ -282,52 +1079,68 @@ struct server_base
         return false;
     }
 
-    //finally, write response to client, buf if http1.1...
-    void write_response(socket_type_ptr socket, request_ptr r)
+    inline route_limit* find_route_limit(const string* route)
     {
-        boost::smatch matched;
-        handler_for_server user_handler;
-        streambuf_ptr buffer(new boost::asio::streambuf);
-        async_timer_ptr timer;
-
-        if (__con_timeout > 0) {
-            timer = set_timeout_on_socket(socket, __con_timeout);
+        if (not route or __route_limits.empty()) {
+            return nullptr;
         }
+        auto found = __route_limits.find(*route);
+        return found != __route_limits.end() ? found->second.get() : nullptr;
+    }
 
-        //check path and method, get right handler and matched in logical_dict
-        bool valid = valid_request(r, matched, user_handler);
-
-        r->address = remote_addr(*socket);
-        if (valid) {
-            r->match1.assign(matched[1]);
-            r->match2.assign(matched[2]);
-            r->match3.assign(matched[3]);
-            user_handler(buffer, r);
-        } else {
-            ostream response(buffer.get());
-            response << templates::bad_request;
+    // global limit first, then the one of the route
+    inline bool rate_allowed(const string* route, const ip_key& client)
+    {
+        if (not __global_rate and __rate_limits.empty()) {
+            return true;
         }
-
-        ///////////////////////////////////////////////////////////////////////////////////////////////////
-        // Be careful: must capture buffer in lambda so it is not destroyed before async_write is finished!
-        ///////////////////////////////////////////////////////////////////////////////////////////////////
-        auto write_callback = [this,timer,r,buffer,socket](const error_code& ec, size_t bytes_transferred) {
-            if (__con_timeout > 0) {
-                timer->cancel();
-            }
-            //if http 1.1 persistent connection
-            if (not ec and r->version != "1.0") {
-                this->read_request_and_content(socket); //more async operations
+        const uint64_t now = steady_us();
+        if (__global_rate and not __global_rate->allow(client, now)) {
+            return false;
+        }
+        if (route and not __rate_limits.empty()) {
+            auto found = __rate_limits.find(*route);
+            if (found != __rate_limits.end() and not found->second->allow(client, now)) {
+                return false;
             }
-        };
+        }
+        return true;
+    }
 
-        boost::asio::async_write(*socket, *buffer, write_callback);
+    inline bool is_blocking(const string* route, const string& method)
+    {
+        if (not route or __blocking_routes.empty()) {
+            return false;
+        }
+        auto found = __blocking_routes.find(*route);
+        return found != __blocking_routes.end() and found->second.count(method);
     }
 
     // see typedefs.hpp for more details
     logical_dict __user_logical;
     logical_dict __default_logical;
 
+    // before __ioservice: sockets still owned by queued handlers release their slot when the
+    // io service is destroyed
+    admission_options __admission;
+    admission_stats   __admission_stats;
+    codel_shedder     __shedder;
+    boost::atomic<size_t> __accept_paused;    // accepts waiting for a connection slot
+    listener_options  __listener;
+    keep_alive_options __keep_alive;
+    affinity_options  __affinity;
+    size_t            __spin_us;
+    busy_poll_stats   __busy_stats;
+    boost::unordered_map<string, boost::shared_ptr<route_limit>> __route_limits;
+    boost::unordered_map<string, std::set<string>> __blocking_routes;  // sre -> methods
+    boost::unordered_map<string, ip_rate_limiter_ptr> __rate_limits;
+    boost::unordered_map<string, micro_cache_ptr> __micro_caches;
+    ip_rate_limiter_ptr __global_rate;
+    boost::shared_ptr<access_log_options> __access_opts;
+    access_logger_ptr   __access;
+    request_tracer      __tracer;
+    boost::unordered_map<string, websocket_endpoint<socket_type>> __websockets;  // sre -> handlers
+
     asio_service  __ioservice;
     asio_endpoint __endpoint;
     asio_acceptor __acceptor;
@@ -336,12 +1149,19 @@ struct server_base
     size_t __num_threads;
     std::vector<boost::thread> __threads;
 
+    // after __ioservice, so pending offloaded handlers can still post their writes when the
+    // pool drains in its destructor
+    work_pool_ptr __offload;
+    size_t __offload_workers;   // set_offload_pool(), 0 if not called
+    size_t __offload_queued;
+
     size_t __req_timeout;
     size_t __con_timeout;
 
     std::vector<typename logical_dict::iterator> __logical_list;
     regex_dict __sredict;
 
+
     boost::regex __xprot; //("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
     boost::regex __xhead; //("^([^:]*): ?(.*)$");
 
@@ -350,9 +1170,88 @@ struct server_base
 };
 
 
+// operator new calls of the whole process, counted only where a program defines
+// BASIOHTTP_COUNT_ALLOCATIONS before including the server, see bench_request_allocations
+inline boost::atomic<size_t>& allocation_count(void)
+{
+    static boost::atomic<size_t> count(0);
+    return count;
+}
+
+
+// allocations per keep-alive GET against a server running in this process. the client reads
+// into a fixed buffer and allocates nothing per request, so all that is counted comes from the
+// server: connection, parsing, handler and the write. 0 if allocations are not counted or a
+// request failed
+inline double bench_request_allocations(const string& host, const size_t port, const size_t requests,
+                                        const string& path = "/")
+{
+    const string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    asio_service io_service;
+    asio_socket socket(io_service);
+    error_code ec;
+    socket.connect(asio_endpoint(ip_address::from_string(host), port), ec);
+    std::vector<char> buf(1 << 20);
+
+    auto roundtrip = [&]() {
+        size_t have = 0;
+        size_t total = 0;
+        boost::asio::write(socket, boost::asio::buffer(request), ec);
+        while (not ec and (total == 0 or have < total)) {
+            have += socket.read_some(boost::asio::buffer(&buf[have], buf.size() - have), ec);
+            if (total == 0) {
+                const char* end = static_cast<const char*>(memmem(&buf[0], have, "\r\n\r\n", 4));
+                const char* length = static_cast<const char*>(memmem(&buf[0], have, "Content-Length: ", 16));
+                if (end) {
+                    total = end + 4 - &buf[0] + (length and length < end ? strtoul(length + 16, nullptr, 10) : 0);
+                }
+            }
+            if (have == buf.size()) {
+                ec = boost::asio::error::message_size;
+            }
+        }
+        return not ec;
+    };
+
+    // the first requests warm up the connection and the caches of the server
+    for (size_t i = 0; i < 16; ++i) {
+        if (not roundtrip()) {
+            return 0;
+        }
+    }
+    const size_t before = allocation_count().load();
+    for (size_t i = 0; i < requests; ++i) {
+        if (not roundtrip()) {
+            return 0;
+        }
+    }
+    return double(allocation_count().load() - before) / std::max<size_t>(requests, 1);
+}
+
+
 }//basiohttp
 
 
+#ifdef BASIOHTTP_COUNT_ALLOCATIONS
+// replacements of the global operator new, so in one translation unit only. not inlined, gcc
+// would take the free() of an inlined delete for a mismatch with new
+__attribute__((noinline)) void* operator new(size_t n)
+{
+    ++basiohttp::allocation_count();
+    void* p = malloc(n ? n : 1);
+    if (not p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    free(p);
+}
+#endif//BASIOHTTP_COUNT_ALLOCATIONS
+
+
 
 #endif  /* SERVER_BASE_HTTP_HPP */
 
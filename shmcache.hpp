@@ -0,0 +1,213 @@
+/**
+ * file   : shmcache.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * response cache in shared memory, one copy for all workers of the pre-fork mode
+ */
+#pragma once
+#ifndef SHM_CACHE_HTTP_HPP
+#define SHM_CACHE_HTTP_HPP
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <boost/noncopyable.hpp>
+#include <boost/interprocess/managed_external_buffer.hpp>
+#include <boost/interprocess/allocators/allocator.hpp>
+#include <boost/interprocess/containers/map.hpp>
+#include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/sync/interprocess_upgradable_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "reply.hpp"
+
+namespace basiohttp
+{
+
+// same interface as response_cache, plus write() that copies a cached response straight into a
+// response buffer. the segment is an anonymous shared mapping, so construct it before
+// server_base::start_workers() forks: every worker then sees the same entries at the same
+// address. when the segment is full the oldest entries make room. a worker killed while it
+// holds the lock of the segment blocks the others, handlers must not crash inside get/set/write
+struct shared_response_cache: public boost::noncopyable
+{
+    typedef boost::interprocess::managed_external_buffer::segment_manager segment_manager;
+    typedef boost::interprocess::allocator<char, segment_manager> char_allocator;
+    typedef boost::interprocess::basic_string<char, std::char_traits<char>, char_allocator> shm_string;
+
+    struct entry
+    {
+        shm_string head;
+        shm_string content;
+        uint32_t   crc_content;
+        uint64_t   stamp;       // insertion order, the smallest is evicted first
+
+        entry(const char_allocator& a):head(a), content(a), crc_content(0), stamp(0)
+        {
+        }
+    };
+
+    // keys of the segment compare with std::string without a copy into it
+    struct key_less
+    {
+        typedef void is_transparent;
+
+        static inline int compare(const char* a, const size_t an, const char* b, const size_t bn)
+        {
+            const int c = memcmp(a, b, min(an, bn));
+            return c ? c : (an < bn ? -1 : (an > bn ? 1 : 0));
+        }
+
+        template<typename A, typename B>
+        inline bool operator()(const A& a, const B& b) const
+        {
+            return compare(a.data(), a.size(), b.data(), b.size()) < 0;
+        }
+    };
+
+    typedef std::pair<const shm_string, entry> value_type;
+    typedef boost::interprocess::allocator<value_type, segment_manager> map_allocator;
+    typedef boost::interprocess::map<shm_string, entry, key_less, map_allocator> map_type;
+    typedef boost::interprocess::interprocess_upgradable_mutex mutex_type;
+    typedef boost::interprocess::sharable_lock<mutex_type> reads_lock;
+    typedef boost::interprocess::scoped_lock<mutex_type> write_lock;
+
+    // what lives in the segment besides the entries
+    struct root
+    {
+        mutex_type mutex;
+        map_type   map;
+        uint64_t   stamp;
+
+        root(segment_manager* manager):map(key_less(), map_allocator(manager)), stamp(0)
+        {
+        }
+    };
+
+    explicit shared_response_cache(const size_t bytes = 64 << 20):
+        __size(bytes)
+    {
+        __base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (__base == MAP_FAILED) {
+            throw std::runtime_error(string("mmap of shared cache failed: ") + strerror(errno));
+        }
+        __segment = boost::interprocess::managed_external_buffer(boost::interprocess::create_only, __base, bytes);
+        __root = __segment.construct<root>(boost::interprocess::anonymous_instance)(__segment.get_segment_manager());
+    }
+
+    ~shared_response_cache(void)
+    {
+        __segment = boost::interprocess::managed_external_buffer();
+        ::munmap(__base, __size);
+    }
+
+    // true if an entry of `key` was replaced. a response taking more than half of the segment is
+    // not kept, it would push out everything else
+    bool set(const string& key, response_ptr res)
+    {
+        write_lock lock(__root->mutex);
+        bool replaced = erase(key);
+        if (key.size() + res->head.size() + res->content.size() > __size / 2) {
+            return replaced;
+        }
+        for (;;) {
+            try {
+                char_allocator a(__segment.get_segment_manager());
+                value_type v(shm_string(key.data(), key.size(), a), entry(a));
+                v.second.head.assign(res->head.data(), res->head.size());
+                v.second.content.assign(res->content.data(), res->content.size());
+                v.second.crc_content = res->crc_content;
+                v.second.stamp = ++__root->stamp;
+                __root->map.insert(boost::move(v));
+                return replaced;
+            }
+            catch (const std::exception&) { //bad_alloc, or length_error once beyond free memory
+                if (__root->map.empty()) {
+                    return replaced;
+                }
+                evict_oldest();
+            }
+        }
+    }
+
+    // a copy of the entry, null if there is none
+    response_ptr get(const string& key)
+    {
+        reads_lock lock(__root->mutex);
+        response_ptr ret;
+        auto iter = __root->map.find(key);
+        if (iter != __root->map.end()) {
+            ret.reset(new _response);
+            ret->head.assign(iter->second.head.data(), iter->second.head.size());
+            ret->content.assign(iter->second.content.data(), iter->second.content.size());
+            ret->crc_content = iter->second.crc_content;
+        }
+        return ret;
+    }
+
+    // status line, head and content of `key` into `response`, false if there is no such entry
+    bool write(const string& key, boost::asio::streambuf& response, const STATUS_TYPE st = ok)
+    {
+        reads_lock lock(__root->mutex);
+        auto iter = __root->map.find(key);
+        if (iter == __root->map.end()) {
+            return false;
+        }
+        header_builder(response).status(st)
+                                .write(iter->second.head.data(), iter->second.head.size())
+                                .write(iter->second.content.data(), iter->second.content.size());
+        return true;
+    }
+
+    bool remove(const string& key)
+    {
+        write_lock lock(__root->mutex);
+        return erase(key);
+    }
+
+    size_t size(void)
+    {
+        reads_lock lock(__root->mutex);
+        return __root->map.size();
+    }
+
+    // bytes of the segment not in use
+    size_t free_memory(void)
+    {
+        reads_lock lock(__root->mutex);
+        return __segment.get_free_memory();
+    }
+
+protected:
+    inline bool erase(const string& key)
+    {
+        auto iter = __root->map.find(key);
+        if (iter == __root->map.end()) {
+            return false;
+        }
+        __root->map.erase(iter);
+        return true;
+    }
+
+    void evict_oldest(void)
+    {
+        auto oldest = __root->map.begin();
+        for (auto it = __root->map.begin(); it != __root->map.end(); ++it) {
+            if (it->second.stamp < oldest->second.stamp) {
+                oldest = it;
+            }
+        }
+        __root->map.erase(oldest);
+    }
+
+    size_t __size;
+    void*  __base;
+    boost::interprocess::managed_external_buffer __segment;
+    root*  __root;
+};
+
+}//basiohttp
+
+
+#endif//SHM_CACHE_HTTP_HPP
@@ -0,0 +1,130 @@
+/**
+ * file   : singleflight.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * one load per missing cache entry, concurrent requests for it wait for that load
+ */
+#pragma once
+#ifndef SINGLE_FLIGHT_HTTP_HPP
+#define SINGLE_FLIGHT_HTTP_HPP
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "reply.hpp"
+
+namespace basiohttp
+{
+
+enum FLIGHT_ROLE
+{
+    flight_hit,     // the cached response was written
+    flight_lead,    // the caller loads the entry and must land() it
+    flight_wait     // the request was deferred, it is answered when the entry lands
+};
+
+
+// coalesces the loads of cache misses, over response_cache or shared_response_cache. of the
+// handlers missing the same key at the same time the first one loads it, the others defer their
+// requests and get the response_ptr it loaded written into theirs, on the thread of the leader,
+// without holding an io thread meanwhile. flights are per process, pre-fork workers each load
+// once
+template<typename Cache>
+struct single_flight: public boost::noncopyable
+{
+    explicit single_flight(Cache& cache):__cache(cache), __loads(0), __coalesced(0)
+    {
+    }
+
+    // the cached response of `key` into `response`, or the role of the caller in loading it. a
+    // leader must land() the key whatever happens, else its waiters hang. a request that cannot
+    // be deferred leads a load of its own
+    FLIGHT_ROLE join(const string& key, const streambuf_ptr& response, const request_ptr& r,
+                     const STATUS_TYPE st = ok)
+    {
+        if (__cache.write(key, *response, st)) {
+            return flight_hit;
+        }
+        boost::mutex::scoped_lock lock(__mutex);
+        auto found = __flights.find(key);
+        if (found == __flights.end()) {
+            // a load that landed since the lookup above is in the cache by now
+            if (__cache.write(key, *response, st)) {
+                return flight_hit;
+            }
+            __flights[key];
+            ++__loads;
+            return flight_lead;
+        }
+        boost::function<void(void)> done = r->defer();
+        if (not done) {
+            ++__loads;
+            return flight_lead;
+        }
+        found->second.push_back(waiter{response, done, st});
+        ++__coalesced;
+        return flight_wait;
+    }
+
+    // the load of `key` is done: `res` goes into the cache and to the waiting requests, null if
+    // the load failed, they get a 500 then
+    void land(const string& key, const response_ptr& res)
+    {
+        if (res) {
+            __cache.set(key, res);
+        }
+        std::vector<waiter> waiters;
+        {
+            boost::mutex::scoped_lock lock(__mutex);
+            auto found = __flights.find(key);
+            if (found == __flights.end()) {
+                return;
+            }
+            waiters.swap(found->second);
+            __flights.erase(found);
+        }
+        for (auto& w : waiters) {
+            if (res) {
+                header_builder(*w.response).status(w.status).write(res->head).write(res->content);
+            }
+            else {
+                header_builder(*w.response).status(internal_server_error).content_length(0).end();
+            }
+            w.done();
+        }
+    }
+
+    // misses that loaded, and misses that waited for one of those instead
+    inline size_t loads(void) const
+    {
+        return __loads.load(boost::memory_order_relaxed);
+    }
+
+    inline size_t coalesced(void) const
+    {
+        return __coalesced.load(boost::memory_order_relaxed);
+    }
+
+protected:
+    struct waiter
+    {
+        streambuf_ptr response;
+        boost::function<void(void)> done;
+        STATUS_TYPE   status;
+    };
+
+    Cache&       __cache;
+    boost::mutex __mutex;
+    boost::unordered_map<string, std::vector<waiter>> __flights;
+    boost::atomic<size_t> __loads;
+    boost::atomic<size_t> __coalesced;
+};
+
+}//basiohttp
+
+
+#endif//SINGLE_FLIGHT_HTTP_HPP
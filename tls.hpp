@@ -0,0 +1,498 @@
+/**
+ * file   : tls.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * tls session cache, session ticket keys and handshake tuning for server<asio_https>
+ */
+#pragma once
+#ifndef TLS_HTTP_HPP
+#define TLS_HTTP_HPP
+#include <cstring>
+#include <string>
+#include <openssl/ssl.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/ssl/host_name_verification.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+struct tls_options
+{
+    size_t session_cache_size;  // entries of the server side session cache, 0 disables it
+    long   session_timeout;     // seconds a session (cached or ticket) can be resumed
+    bool   session_tickets;     // stateless resumption (rfc 5077 / tls1.3 tickets)
+    size_t ticket_rotation;     // seconds between ticket key rotations, 0 means never rotate
+    string ciphers;             // tls1.2 and below, openssl cipher list format
+    string ciphersuites;        // tls1.3 only
+    string curves;              // ecdh groups in preference order, e.g. "X25519:P-256"
+    bool   alpn_h2;             // offer "h2" before "http/1.1" in alpn, see h2.hpp
+
+    tls_options(void):
+        session_cache_size(20480),
+        session_timeout(3600),
+        session_tickets(true),
+        ticket_rotation(3600),
+        ciphers("ECDHE+AESGCM:ECDHE+CHACHA20:!aNULL:!MD5:!RC4"),
+        curves("X25519:P-256:P-384"),
+        alpn_h2(true)
+    {
+    }
+};
+
+
+// handshake counters, updated by server<asio_https> after every handshake
+struct tls_stats
+{
+    boost::atomic<size_t> full;
+    boost::atomic<size_t> resumed;
+    boost::atomic<size_t> failed;
+
+    tls_stats(void):full(0), resumed(0), failed(0)
+    {
+    }
+};
+
+
+// ticket keys, the newest one encrypts and all of them decrypt. a ticket decrypted with an
+// older key is accepted and renewed, so rotating every `ticket_rotation` seconds with a ring of
+// NUM_KEYS keeps tickets valid for about NUM_KEYS * ticket_rotation seconds.
+struct ticket_keyring
+{
+    enum { NUM_KEYS = 3 };
+
+    struct ticket_key
+    {
+        unsigned char name[16];
+        unsigned char hmac[32];
+        unsigned char aes[32];
+    };
+
+    ticket_keyring(void):__current(0)
+    {
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            generate(__keys[i]);
+        }
+    }
+
+    void rotate(void)
+    {
+        ticket_key fresh;
+        generate(fresh);
+        boost::mutex::scoped_lock lock(__mutex);
+        __current = (__current + 1) % NUM_KEYS;
+        __keys[__current] = fresh;
+    }
+
+    // copy the encryption key
+    void current(ticket_key& key)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        key = __keys[__current];
+    }
+
+    // 0: unknown key name, 1: found current key, 2: found an older key (ticket should be renewed)
+    int find(const unsigned char* name, ticket_key& key)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            if (memcmp(__keys[i].name, name, sizeof(key.name)) == 0) {
+                key = __keys[i];
+                return i == __current ? 1 : 2;
+            }
+        }
+        return 0;
+    }
+
+    static void generate(ticket_key& key)
+    {
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(&key), sizeof(key)) != 1) {
+            throw std::runtime_error("RAND_bytes failed for ticket key!");
+        }
+    }
+
+    // the keyring is attached to its SSL_CTX, so the c callback can find it
+    static int ex_index(void)
+    {
+        static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    static ticket_keyring* from(SSL* ssl)
+    {
+        return static_cast<ticket_keyring*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ex_index()));
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int __hmac_init(EVP_MAC_CTX* hctx, unsigned char* hmac_key)
+    {
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, hmac_key, 32);
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("sha256"), 0);
+        params[2] = OSSL_PARAM_construct_end();
+        return EVP_MAC_CTX_set_params(hctx, params);
+    }
+
+    static int callback(SSL* ssl, unsigned char* name, unsigned char* iv,
+                        EVP_CIPHER_CTX* cctx, EVP_MAC_CTX* hctx, int enc)
+#else
+    static int __hmac_init(HMAC_CTX* hctx, unsigned char* hmac_key)
+    {
+        return HMAC_Init_ex(hctx, hmac_key, 32, EVP_sha256(), nullptr);
+    }
+
+    static int callback(SSL* ssl, unsigned char* name, unsigned char* iv,
+                        EVP_CIPHER_CTX* cctx, HMAC_CTX* hctx, int enc)
+#endif
+    {
+        auto ring = from(ssl);
+        if (not ring) {
+            return -1;
+        }
+        ticket_key key;
+        int found = 1;
+
+        if (enc) {
+            ring->current(key);
+            if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+                return -1;
+            }
+            memcpy(name, key.name, sizeof(key.name));
+            if (EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes, iv) != 1) {
+                return -1;
+            }
+        }
+        else {
+            found = ring->find(name, key);
+            if (not found) {
+                return 0; //unknown or expired key, do a full handshake
+            }
+            if (SSL_version(ssl) >= TLS1_3_VERSION) {
+                found = 2; //tls1.3 tickets are single use, always hand out a fresh one
+            }
+            if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes, iv) != 1) {
+                return -1;
+            }
+        }
+        if (__hmac_init(hctx, key.hmac) != 1) {
+            return -1;
+        }
+        OPENSSL_cleanse(&key, sizeof(key));
+        return found;
+    }
+
+    boost::mutex __mutex;
+    ticket_key __keys[NUM_KEYS];
+    size_t __current;
+};
+
+
+// alpn selection of the server, our preference wins: "h2" if the client offers it, then "http/1.1"
+inline int alpn_select_h2(SSL*, const unsigned char** out, unsigned char* outlen,
+                          const unsigned char* in, unsigned int inlen, void*)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+
+// apply options to a server context, throws std::runtime_error on bad ciphers or curves
+inline void configure_tls_context(boost::asio::ssl::context& context,
+                                  const tls_options& opts,
+                                  ticket_keyring* keyring)
+{
+    SSL_CTX* ctx = context.native_handle();
+
+    context.set_options(boost::asio::ssl::context::default_workarounds |
+                        boost::asio::ssl::context::no_sslv2 |
+                        boost::asio::ssl::context::no_sslv3 |
+                        boost::asio::ssl::context::single_dh_use);
+    SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    if (not opts.ciphers.empty() and SSL_CTX_set_cipher_list(ctx, opts.ciphers.c_str()) != 1) {
+        throw std::runtime_error("bad cipher list: " + opts.ciphers);
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (not opts.ciphersuites.empty() and SSL_CTX_set_ciphersuites(ctx, opts.ciphersuites.c_str()) != 1) {
+        throw std::runtime_error("bad tls1.3 ciphersuites: " + opts.ciphersuites);
+    }
+#endif
+    if (not opts.curves.empty() and SSL_CTX_set1_curves_list(ctx, opts.curves.c_str()) != 1) {
+        throw std::runtime_error("bad curves list: " + opts.curves);
+    }
+
+    static const unsigned char sid_ctx[] = "basiohttp";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_timeout(ctx, opts.session_timeout);
+
+    if (opts.session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, opts.session_cache_size);
+    }
+    else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (opts.session_tickets and keyring) {
+        SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_ex_data(ctx, ticket_keyring::ex_index(), keyring);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_keyring::callback);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_keyring::callback);
+#endif
+    }
+    else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+
+    if (opts.alpn_h2) {
+        SSL_CTX_set_alpn_select_cb(ctx, alpn_select_h2, nullptr);
+    }
+}
+
+
+struct client_tls_options
+{
+    bool   verify;          // check the certificate chain and that it is for the host
+    string ca_file;         // trusted certificates, empty uses the system store
+    size_t sessions;        // hosts whose last session is kept for resumption, 0 none
+
+    client_tls_options(void):
+        verify(true),
+        sessions(1024)
+    {
+    }
+};
+
+
+// the context all https clients share, and the newest session of each host:port. a client
+// calls prepare() before its handshake: sni, verification of the host name, and the session
+// to resume. openssl hands new sessions to the store through a callback, tls1.3 tickets
+// included, which arrive after the handshake. a reconnect to the same backend then resumes
+// without certificate exchange and signature
+struct client_tls: public boost::noncopyable
+{
+    explicit client_tls(const client_tls_options& opts = client_tls_options()):
+        __opts(opts),
+        __context(boost::asio::ssl::context::sslv23_client),
+        __resumed(0),
+        __full(0)
+    {
+        SSL_CTX* ctx = __context.native_handle();
+        __context.set_options(boost::asio::ssl::context::default_workarounds |
+                              boost::asio::ssl::context::no_sslv2 |
+                              boost::asio::ssl::context::no_sslv3);
+        if (opts.verify) {
+            __context.set_verify_mode(boost::asio::ssl::verify_peer);
+            if (opts.ca_file.empty()) {
+                __context.set_default_verify_paths();
+            }
+            else {
+                __context.load_verify_file(opts.ca_file);
+            }
+        }
+        else {
+            __context.set_verify_mode(boost::asio::ssl::verify_none);
+        }
+        SSL_CTX_set_ex_data(ctx, ex_index(), this);
+        if (opts.sessions) {
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ctx, new_session);
+        }
+        else {
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        }
+    }
+
+    ~client_tls(void)
+    {
+        for (auto& s : __sessions) {
+            SSL_SESSION_free(s.second);
+        }
+    }
+
+    // options of shared(), change them before the first https client is made
+    static client_tls_options& shared_options(void)
+    {
+        static client_tls_options opts;
+        return opts;
+    }
+
+    // the one create_client() uses
+    static client_tls& shared(void)
+    {
+        static client_tls tls(shared_options());
+        return tls;
+    }
+
+    boost::asio::ssl::context& context(void)
+    {
+        return __context;
+    }
+
+    // before the handshake of `stream` to `host`:`port`. `key` must stay until the handshake and
+    // the tls1.3 tickets after it are done, i.e. as long as the connection
+    void prepare(asio_https& stream, const string& host, const string* key)
+    {
+        SSL* ssl = stream.native_handle();
+        SSL_set_tlsext_host_name(ssl, host.c_str());
+        if (__opts.verify) {
+            stream.set_verify_callback(boost::asio::ssl::host_name_verification(host));
+        }
+        SSL_set_ex_data(ssl, ex_index(), const_cast<string*>(key));
+        boost::mutex::scoped_lock lock(__mutex);
+        auto found = __sessions.find(*key);
+        if (found != __sessions.end()) {
+            SSL_set_session(ssl, found->second);
+        }
+    }
+
+    // after the handshake, counts resumptions
+    void handshaken(asio_https& stream)
+    {
+        if (SSL_session_reused(stream.native_handle())) {
+            __resumed.fetch_add(1, boost::memory_order_relaxed);
+        }
+        else {
+            __full.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+
+    // forget the session of `key`, e.g. after a handshake using it failed
+    void forget(const string& key)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        auto found = __sessions.find(key);
+        if (found != __sessions.end()) {
+            SSL_SESSION_free(found->second);
+            __sessions.erase(found);
+        }
+    }
+
+    inline size_t resumed(void) const
+    {
+        return __resumed.load(boost::memory_order_relaxed);
+    }
+
+    inline size_t full(void) const
+    {
+        return __full.load(boost::memory_order_relaxed);
+    }
+
+protected:
+    static int ex_index(void)
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    // openssl owns `session` if this returns 0. the newest session of a host replaces the one
+    // before, tls1.3 tickets are meant to be used once
+    static int new_session(SSL* ssl, SSL_SESSION* session)
+    {
+        auto tls = static_cast<client_tls*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ex_index()));
+        auto key = static_cast<const string*>(SSL_get_ex_data(ssl, ex_index()));
+        if (not tls or not key) {
+            return 0;
+        }
+        boost::mutex::scoped_lock lock(tls->__mutex);
+        auto found = tls->__sessions.find(*key);
+        if (found != tls->__sessions.end()) {
+            SSL_SESSION_free(found->second);
+            found->second = session;
+            return 1;
+        }
+        if (tls->__sessions.size() >= tls->__opts.sessions) {
+            SSL_SESSION_free(tls->__sessions.begin()->second);
+            tls->__sessions.erase(tls->__sessions.begin());
+        }
+        tls->__sessions.emplace(*key, session);
+        return 1;
+    }
+
+    client_tls_options __opts;
+    boost::asio::ssl::context __context;
+    boost::mutex __mutex;
+    boost::unordered_map<string, SSL_SESSION*> __sessions;  // host:port -> newest session
+    boost::atomic<size_t> __resumed;
+    boost::atomic<size_t> __full;
+};
+
+
+// handshakes per second against a local https server, each connection resumes the session of
+// the previous one if `resume` is true. returns handshakes/sec, `resumed` gets the
+// number of handshakes the server accepted as resumptions.
+inline double bench_tls_handshake(const string& host, const size_t port, const size_t count,
+                                  const bool resume, size_t& resumed)
+{
+    using boost::asio::ssl::context;
+    asio_service io_service;
+    context ctx(context::sslv23_client);
+    ctx.set_verify_mode(boost::asio::ssl::verify_none);
+    SSL_CTX_set_session_cache_mode(ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+
+    asio_endpoint endpoint(ip_address::from_string(host), port);
+    const string request = "GET / HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+    SSL_SESSION* session = nullptr;
+    resumed = 0;
+
+    // only connect and handshake are timed, the request round trip is just to collect tickets
+    boost::posix_time::time_duration elapsed;
+    for (size_t i = 0; i < count; ++i) {
+        auto start = boost::posix_time::microsec_clock::universal_time();
+        asio_https stream(io_service, ctx);
+        stream.lowest_layer().connect(endpoint);
+        if (resume and session) {
+            SSL_set_session(stream.native_handle(), session);
+        }
+        stream.handshake(boost::asio::ssl::stream_base::client);
+        elapsed += boost::posix_time::microsec_clock::universal_time() - start;
+        if (SSL_session_reused(stream.native_handle())) {
+            ++resumed;
+        }
+        // tls1.3 tickets arrive after the handshake
+        boost::asio::write(stream, boost::asio::buffer(request));
+        boost::asio::streambuf response;
+        error_code ec;
+        boost::asio::read_until(stream, response, "\r\n\r\n", ec);
+        if (resume) {
+            // tickets are single use, keep the newest one like a browser does
+            if (session) {
+                SSL_SESSION_free(session);
+            }
+            session = SSL_get1_session(stream.native_handle());
+        }
+        // closing without a shutdown makes openssl drop the session as not resumable
+        SSL_set_shutdown(stream.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        stream.lowest_layer().close(ec);
+    }
+
+    if (session) {
+        SSL_SESSION_free(session);
+    }
+    return count * 1e6 / max<double>(elapsed.total_microseconds(), 1);
+}
+
+
+}//basiohttp
+
+
+#endif//TLS_HTTP_HPP
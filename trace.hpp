@@ -0,0 +1,268 @@
+/**
+ * file   : trace.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * sampled per request phase spans in per thread buffers, dumped as chrome trace json
+ */
+#pragma once
+#ifndef TRACE_HTTP_HPP
+#define TRACE_HTTP_HPP
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "admission.hpp"
+
+namespace basiohttp
+{
+
+enum TRACE_PHASE
+{
+    trace_request,      // head read started .. response written
+    trace_accept,       // accept completion handled, connection set up
+    trace_handshake,    // tls handshake
+    trace_read_head,    // waiting for the request head, idle keep-alive time included
+    trace_read_body,
+    trace_parse,        // parse_request
+    trace_route,        // valid_request
+    trace_handler,
+    trace_deferred,     // a deferred or offloaded handler until its response is complete
+    trace_write,        // the response sent
+    NUM_TRACE_PHASES
+};
+
+inline const char* trace_phase_name(const TRACE_PHASE phase)
+{
+    static const char* names[NUM_TRACE_PHASES] = {
+        "request", "accept", "handshake", "read_head", "read_body", "parse", "route", "handler",
+        "deferred", "write"
+    };
+    return phase < NUM_TRACE_PHASES ? names[phase] : "?";
+}
+
+// cpu timestamp counter where there is one, else steady_clock nanoseconds. the tsc is turned
+// into time when the trace is dumped, against steady_clock over the life of the tracer
+inline uint64_t trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+struct trace_event
+{
+    uint64_t      begin;    // trace_clock()
+    uint64_t      end;
+    uint64_t      id;       // of the request, spans of one request share it
+    const string* label;    // the route, null if none. must outlive the tracer
+    uint32_t      phase;
+};
+
+
+// the accept and tls handshake of a connection, timed before it has a request. they are
+// recorded under the id of its first request, so they are sampled with that one
+struct trace_setup
+{
+    uint64_t accept_begin;      // trace_clock(), 0 if the tracer was off
+    uint64_t accept_end;
+    uint64_t handshake_begin;
+    uint64_t handshake_end;
+
+    trace_setup(void): accept_begin(0), accept_end(0), handshake_begin(0), handshake_end(0)
+    {
+    }
+};
+
+
+// off until enable(). when on, begin_request() picks one in `sample_every` requests of each
+// thread and spans of the others cost a branch. each thread records into a ring buffer of its
+// own, the newest `events_per_thread` spans are kept. dump() writes what the buffers hold, the
+// oldest spans of a thread recording meanwhile may come out torn, so disable() before dumping
+// if that matters
+struct request_tracer: public boost::noncopyable
+{
+    request_tracer(const size_t events_per_thread = 1 << 16):
+        __enabled(false),
+        __sample_every(1),
+        __capacity(max<size_t>(events_per_thread, 1)),
+        __clock0(trace_clock()),
+        __steady0(steady_us())
+    {
+    }
+
+    void enable(const size_t sample_every = 1)
+    {
+        __sample_every.store(max<size_t>(sample_every, 1), boost::memory_order_relaxed);
+        __enabled.store(true, boost::memory_order_release);
+    }
+
+    void disable(void)
+    {
+        __enabled.store(false, boost::memory_order_release);
+    }
+
+    inline bool enabled(void) const
+    {
+        return __enabled.load(boost::memory_order_relaxed);
+    }
+
+    // id of a request to trace, 0 if this one is not
+    inline uint64_t begin_request(void)
+    {
+        if (not enabled()) {
+            return 0;
+        }
+        thread_buffer& b = local();
+        if (++b.requests % __sample_every.load(boost::memory_order_relaxed)) {
+            return 0;
+        }
+        return (static_cast<uint64_t>(b.tid) << 40) | (b.requests & ((1ULL << 40) - 1));
+    }
+
+    inline void span(const uint64_t id, const TRACE_PHASE phase, const uint64_t begin, const uint64_t end,
+                     const string* label = nullptr)
+    {
+        if (not id) {
+            return;
+        }
+        thread_buffer& b = local();
+        const uint64_t n = b.head.load(boost::memory_order_relaxed);
+        trace_event& e = b.events[n % b.events.size()];
+        e.begin = begin;
+        e.end = end;
+        e.id = id;
+        e.label = label;
+        e.phase = phase;
+        b.head.store(n + 1, boost::memory_order_release);
+    }
+
+    // chrome trace event format, for chrome://tracing or ui.perfetto.dev
+    bool dump(const string& path)
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        if (not f) {
+            return false;
+        }
+        const double ticks_per_us = calibrate();
+        const int pid = getpid();
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        boost::mutex::scoped_lock lock(__mutex);
+        for (auto& b : __buffers) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"io-%u\"}}",
+                    first ? "" : ",\n", pid, b->tid, b->tid);
+            first = false;
+            const uint64_t head = b->head.load(boost::memory_order_acquire);
+            const uint64_t size = b->events.size();
+            for (uint64_t n = head > size ? head - size : 0; n < head; ++n) {
+                const trace_event e = b->events[n % size];
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+                           "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":\"%llx\"",
+                        trace_phase_name(static_cast<TRACE_PHASE>(e.phase)), pid, b->tid,
+                        (e.begin - __clock0) / ticks_per_us, (e.end - e.begin) / ticks_per_us,
+                        static_cast<unsigned long long>(e.id));
+                if (e.label) {
+                    fputs(",\"route\":\"", f);
+                    for (const char c : *e.label) {
+                        if (c == '"' or c == '\\') {
+                            fputc('\\', f);
+                        }
+                        if (static_cast<unsigned char>(c) >= 0x20) {
+                            fputc(c, f);
+                        }
+                    }
+                    fputc('"', f);
+                }
+                fputs("}}", f);
+            }
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
+    }
+
+    // forget all recorded spans
+    void clear(void)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        for (auto& b : __buffers) {
+            b->head.store(0, boost::memory_order_release);
+        }
+    }
+
+protected:
+    struct thread_buffer
+    {
+        std::vector<trace_event> events;
+        boost::atomic<uint64_t>  head;      // spans ever recorded
+        uint64_t requests;                  // seen by begin_request(), for the sampling
+        unsigned tid;
+
+        thread_buffer(const size_t capacity, const unsigned tid):
+            events(capacity), head(0), requests(0), tid(tid)
+        {
+        }
+    };
+
+    // the calling thread's buffer, made on its first span
+    inline thread_buffer& local(void)
+    {
+        static thread_local const request_tracer* owner = nullptr;
+        static thread_local thread_buffer* buffer = nullptr;
+        if (owner != this) {
+            boost::mutex::scoped_lock lock(__mutex);
+            const boost::thread::id self = boost::this_thread::get_id();
+            buffer = nullptr;
+            for (size_t i = 0; i < __buffers.size(); ++i) {
+                if (__threads[i] == self) {
+                    buffer = __buffers[i].get();
+                }
+            }
+            if (not buffer) {
+                __buffers.emplace_back(new thread_buffer(__capacity, static_cast<unsigned>(__buffers.size() + 1)));
+                __threads.push_back(self);
+                buffer = __buffers.back().get();
+            }
+            owner = this;
+        }
+        return *buffer;
+    }
+
+    // trace_clock() ticks per microsecond
+    double calibrate(void) const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        const uint64_t clock = trace_clock();
+        const uint64_t steady = steady_us();
+        return steady > __steady0 ? max<double>((clock - __clock0) / double(steady - __steady0), 1e-3) : 1e3;
+#else
+        return 1e3;
+#endif
+    }
+
+    boost::atomic<bool>   __enabled;
+    boost::atomic<size_t> __sample_every;
+    size_t   __capacity;
+    uint64_t __clock0;
+    uint64_t __steady0;
+    boost::mutex __mutex;
+    std::vector<boost::shared_ptr<thread_buffer>> __buffers;
+    std::vector<boost::thread::id> __threads;
+};
+
+}//basiohttp
+
+
+#endif//TRACE_HTTP_HPP
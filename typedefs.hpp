@@ -60,10 +60,40 @@ struct _request //for server
     boost::asio::streambuf content_buffer;
     boost::unordered_map<string, string> header;
 
-    _request(void):content(&content_buffer)
+    _request(void):content(&content_buffer), __body_length(0), __body_buffered(0)
     {
     }
 
+    // the body in place in content_buffer, no copy. the input of a streambuf is one contiguous
+    // block, so this is the whole body, never a piece of it. what was read through `content`
+    // is not part of it anymore, bytes of a pipelined next request never are. valid until the
+    // handler returns, or the deferred response completes
+    boost::asio::const_buffer body(void) const
+    {
+        const size_t size = content_buffer.size();
+        const size_t consumed = __body_buffered > size ? __body_buffered - size : 0;
+        const size_t left = __body_length > consumed ? __body_length - consumed : 0;
+        return boost::asio::const_buffer(boost::asio::buffer_cast<const char*>(content_buffer.data()),
+                                         left < size ? left : size);
+    }
+
+    // by the connection, once the `length` bytes of the body are at the front of content_buffer
+    void set_body(const size_t length)
+    {
+        __body_length = length;
+        __body_buffered = content_buffer.size();
+    }
+
+    // for async handlers: call defer() before returning and invoke the returned function once
+    // the response is complete (from any thread), the connection waits for it before writing
+    boost::function<void(void)> defer(void)
+    {
+        return __defer ? __defer() : boost::function<void(void)>();
+    }
+
+    boost::function<boost::function<void(void)>(void)> __defer; //set by the connection
+    size_t __body_length;
+    size_t __body_buffered; //size of content_buffer when the handler was called
 };
 
 typedef boost::shared_ptr<_request>  request_ptr;
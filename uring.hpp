@@ -0,0 +1,1459 @@
+/**
+ * file   : uring.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * io_uring backend of server<asio_http>, talks to the kernel directly so liburing is not needed
+ */
+#pragma once
+#ifndef URING_HTTP_HPP
+#define URING_HTTP_HPP
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+#include "fileio.hpp"
+#include "filecache.hpp"
+#include "busypoll.hpp"
+#include "serverbase.hpp"
+
+namespace basiohttp
+{
+
+enum IO_BACKEND
+{
+    backend_asio,   // epoll reactor of boost::asio, the default
+    backend_uring   // one io_uring per io thread, linux 6.0 or newer
+};
+
+
+struct uring_options
+{
+    unsigned entries;       // submission queue size of every ring
+    unsigned buffers;       // provided recv buffers per ring, a power of two
+    unsigned buffer_size;   // bytes of one recv buffer
+    unsigned files;         // registered file slots per ring, 0 keeps plain descriptors
+
+    uring_options(void):
+        entries(512),
+        buffers(256),
+        buffer_size(4096),
+        files(4096)
+    {
+    }
+};
+
+
+// snapshot summed over all rings, see server<asio_http>::io_stats
+struct uring_stats
+{
+    size_t enters;          // io_uring_enter calls, the syscalls of the io path
+    size_t completions;
+    size_t accepted;
+    size_t requests;
+    size_t nobufs;          // recvs that found no provided buffer
+
+    uring_stats(void):enters(0), completions(0), accepted(0), requests(0), nobufs(0)
+    {
+    }
+};
+
+
+// a bare ring: mapped submission/completion queues and the three syscalls
+struct io_ring: public boost::noncopyable
+{
+    explicit io_ring(const unsigned entries):
+        __fd(-1), __sq_ptr(MAP_FAILED), __cq_ptr(MAP_FAILED), __sqes(nullptr),
+        __sq_size(0), __cq_size(0), __sqe_tail(0), __enters(0)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // one thread submits and reaps, so task work can wait until we enter the kernel anyway
+        p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        __fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (__fd < 0 and errno == EINVAL) {
+            memset(&p, 0, sizeof(p));
+            __fd = syscall(__NR_io_uring_setup, entries, &p);
+        }
+        if (__fd < 0) {
+            throw std::runtime_error(string("io_uring_setup failed: ") + strerror(errno));
+        }
+
+        __sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        __cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            __sq_size = __cq_size = max(__sq_size, __cq_size);
+        }
+        __sq_ptr = mmap(0, __sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, __fd, IORING_OFF_SQ_RING);
+        if (__sq_ptr == MAP_FAILED) {
+            close_ring();
+            throw std::runtime_error("mmap of io_uring sq failed!");
+        }
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            __cq_ptr = __sq_ptr;
+        }
+        else {
+            __cq_ptr = mmap(0, __cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, __fd, IORING_OFF_CQ_RING);
+        }
+        void* sqes = mmap(0, p.sq_entries * sizeof(io_uring_sqe), PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, __fd, IORING_OFF_SQES);
+        __sq_entries = p.sq_entries;
+        if (sqes != MAP_FAILED) {
+            __sqes = static_cast<io_uring_sqe*>(sqes);
+        }
+        if (__cq_ptr == MAP_FAILED or sqes == MAP_FAILED) {
+            close_ring();
+            throw std::runtime_error("mmap of io_uring cq or sqes failed!");
+        }
+
+        char* sq = static_cast<char*>(__sq_ptr);
+        __sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        __sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        __sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        char* cq = static_cast<char*>(__cq_ptr);
+        __cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        __cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        __cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        __cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        // sqes are always filled in ring order, so the index array is the identity
+        auto array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        for (unsigned i = 0; i < __sq_entries; ++i) {
+            array[i] = i;
+        }
+        __sqe_tail = *__sq_tail;
+    }
+
+    ~io_ring(void)
+    {
+        close_ring();
+    }
+
+    // a zeroed sqe, flushes the queue to the kernel when it is full
+    io_uring_sqe* get_sqe(void)
+    {
+        if (__sqe_tail - __atomic_load_n(__sq_head, __ATOMIC_ACQUIRE) >= __sq_entries) {
+            submit(0);
+            if (__sqe_tail - __atomic_load_n(__sq_head, __ATOMIC_ACQUIRE) >= __sq_entries) {
+                throw std::runtime_error("io_uring submission queue is full!");
+            }
+        }
+        io_uring_sqe* sqe = &__sqes[__sqe_tail & __sq_mask];
+        ++__sqe_tail;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // publish queued sqes and wait for `wait_nr` completions, one syscall
+    int submit(const unsigned wait_nr)
+    {
+        __atomic_store_n(__sq_tail, __sqe_tail, __ATOMIC_RELEASE);
+        const unsigned pending = __sqe_tail - __atomic_load_n(__sq_head, __ATOMIC_ACQUIRE);
+        if (not pending and not wait_nr) {
+            return 0;
+        }
+        for (;;) {
+            __enters.fetch_add(1, boost::memory_order_relaxed);
+            int ret = syscall(__NR_io_uring_enter, __fd, pending, wait_nr,
+                              wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0) {
+                return ret;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EBUSY or errno == EAGAIN) {
+                return 0; //completion queue overflowed, reap first
+            }
+            return -errno;
+        }
+    }
+
+    // submits what is queued and, with DEFER_TASKRUN, lets the kernel post the completions that
+    // are ready, without waiting for any
+    int poll(void)
+    {
+        __atomic_store_n(__sq_tail, __sqe_tail, __ATOMIC_RELEASE);
+        const unsigned pending = __sqe_tail - __atomic_load_n(__sq_head, __ATOMIC_ACQUIRE);
+        __enters.fetch_add(1, boost::memory_order_relaxed);
+        int ret = syscall(__NR_io_uring_enter, __fd, pending, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+        return ret < 0 ? -errno : ret;
+    }
+
+    // copy out all available completions
+    size_t reap(std::vector<io_uring_cqe>& out)
+    {
+        unsigned head = *__cq_head;
+        const unsigned tail = __atomic_load_n(__cq_tail, __ATOMIC_ACQUIRE);
+        const size_t n = tail - head;
+        for (; head != tail; ++head) {
+            out.push_back(__cqes[head & __cq_mask]);
+        }
+        __atomic_store_n(__cq_head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    int enroll(const unsigned opcode, void* arg, const unsigned nr)
+    {
+        int ret = syscall(__NR_io_uring_register, __fd, opcode, arg, nr);
+        return ret < 0 ? -errno : ret;
+    }
+
+    void close_ring(void)
+    {
+        if (__sqes) {
+            munmap(__sqes, __sq_entries * sizeof(io_uring_sqe));
+            __sqes = nullptr;
+        }
+        if (__cq_ptr != MAP_FAILED and __cq_ptr != __sq_ptr) {
+            munmap(__cq_ptr, __cq_size);
+        }
+        if (__sq_ptr != MAP_FAILED) {
+            munmap(__sq_ptr, __sq_size);
+        }
+        __sq_ptr = __cq_ptr = MAP_FAILED;
+        if (__fd >= 0) {
+            ::close(__fd);
+            __fd = -1;
+        }
+    }
+
+    int    __fd;
+    void*  __sq_ptr;
+    void*  __cq_ptr;
+    io_uring_sqe* __sqes;
+    io_uring_cqe* __cqes;
+    size_t __sq_size;
+    size_t __cq_size;
+
+    unsigned  __sq_entries;
+    unsigned* __sq_head;
+    unsigned* __sq_tail;
+    unsigned  __sq_mask;
+    unsigned* __cq_head;
+    unsigned* __cq_tail;
+    unsigned  __cq_mask;
+    unsigned  __sqe_tail;   // local tail, published by submit()
+
+    boost::atomic<size_t> __enters;
+};
+
+
+typedef server_base<asio_http> http_server_base;
+
+// one ring and one thread: multishot accept on the shared listening socket, multishot recv
+// into a provided buffer ring, connections in the registered file table, send linked to the
+// shutdown when the connection ends with this response. requests go through the same
+// parse/route/admission/offload path as the asio backend.
+struct uring_worker: public boost::noncopyable
+{
+    // low 3 bits of user_data, the rest is the connection or 0
+    enum { TAG_ACCEPT = 1, TAG_WAKE, TAG_TICK, TAG_FILE };
+    enum { TAG_RECV = 1, TAG_SEND, TAG_SLOT, TAG_SHUT, TAG_CLOSE, TAG_AUX };
+    enum { SLOT_LISTEN = 0, SLOT_FILE = 1, SLOT_FIRST = 2 };
+
+    struct connection: public boost::enable_shared_from_this<connection>
+    {
+        typedef boost::shared_ptr<connection> pointer;
+
+        connection(uring_worker* worker, const int fd):
+            worker(worker), fd(fd), slot(-1), update(fd), response(new boost::asio::streambuf),
+            body_size(0), served(0), out(nullptr), out_size(0), sent(0), deadline(0), started(0), dispatched(0),
+            trace(0), trace_start(0), trace_phase(0), limit(nullptr), route(nullptr), ops(0),
+            reading_body(false), busy(false), in_handler(false), admitted(false), close_after(false),
+            closing(false), closed(false), deferred(false), pending(0)
+        {
+        }
+
+        boost::function<void(void)> defer(void)
+        {
+            deferred = true;
+            pending.store(2); //the handler returning and the done call, whichever comes last resumes
+            pointer self = this->shared_from_this();
+            return [self]() {
+                if (self->pending.fetch_sub(1) == 1) {
+                    self->worker->complete(self);
+                }
+            };
+        }
+
+        uring_worker* worker;
+        int      fd;            // plain descriptor, -1 once it lives in the fixed table only
+        int      slot;          // fixed file index or -1
+        int      update;        // in/out argument of the files update
+        string   address;
+        ip_key   peer;
+        string   inbox;         // received but not handed to a request yet
+
+        request_ptr   request;
+        streambuf_ptr response;
+        size_t        body_size;
+        size_t        served;   // responses on this connection
+        const char*   out;      // bytes being sent
+        size_t        out_size;
+        size_t        sent;
+        uint64_t      deadline; // steady_us, 0 means none
+        uint64_t      started;  // steady_us of the request head reaped, for the access log
+        uint64_t      dispatched;   // and of the handler dispatched, 0 if none ran
+        uint64_t      trace;        // request_tracer id, 0 if not traced
+        uint64_t      trace_start;
+        uint64_t      trace_phase;
+
+        boost::smatch      matched;
+        handler_for_server handler;
+        route_limit*       limit;
+        const string*      route;
+
+        int  ops;               // submitted and not finally completed
+        bool reading_body;
+        bool busy;              // a request is handled or its response is in flight
+        bool in_handler;        // offloaded or deferred handler not done yet
+        bool admitted;
+        bool close_after;
+        bool closing;
+        bool closed;
+        bool deferred;
+        boost::atomic<int> pending;
+    };
+
+    typedef connection::pointer connection_ptr;
+
+    uring_worker(http_server_base& server, const uring_options& opts, const int listen_fd):
+        __server(server),
+        __opts(opts),
+        __ring(opts.entries),
+        __listen_fd(listen_fd),
+        __files(false),
+        __multishot_accept(true),
+        __multishot_recv(true),
+        __accept_paused(false),
+        __accept_reserved(false),
+        __stopping(false),
+        __br(MAP_FAILED),
+        __br_size(0),
+        __br_tail(0),
+        __wakefd(-1),
+        __reaped(0),
+        __completions(0), __accepted(0), __requests(0), __nobufs(0)
+    {
+        __wakefd = eventfd(0, EFD_CLOEXEC);
+        if (__wakefd < 0) {
+            throw std::runtime_error("eventfd failed!");
+        }
+        try {
+            setup_buffers();
+        }
+        catch (const std::exception& e) {
+            ::close(__wakefd);
+            throw;
+        }
+        setup_files();
+        __tick.tv_sec = 1;
+        __tick.tv_nsec = 0;
+    }
+
+    ~uring_worker(void)
+    {
+        if (__accept_reserved) {
+            __server.__admission_stats.connections.fetch_sub(1);
+        }
+        for (auto& c : __live) {
+            if (c->fd >= 0) {
+                ::close(c->fd);
+            }
+        }
+        __live.clear();
+        __ring.close_ring();    //before the buffers it may still write to
+        if (__br != MAP_FAILED) {
+            munmap(__br, __br_size);
+        }
+        ::close(__wakefd);
+    }
+
+    // the worker a handler runs on, null outside of ring threads
+    static uring_worker*& current(void)
+    {
+        static thread_local uring_worker* worker = nullptr;
+        return worker;
+    }
+
+    void run(void)
+    {
+        current() = this;
+        arm_accept();
+        arm_wake();
+        arm_tick();
+
+        // with busy polling the ring is entered without waiting until spin_us have passed since the
+        // last completion. DEFER_TASKRUN posts cqes only inside an enter, peeking at the cq is not enough
+        const uint64_t spin_us = __server.__spin_us;
+        busy_poll_meter meter(__server.__busy_stats, spin_us);
+        bool spinning = spin_us > 0;
+
+        std::vector<io_uring_cqe> batch;
+        while (not __stopping.load(boost::memory_order_relaxed)) {
+            const uint64_t begin = spinning ? steady_us() : 0;
+            if (spinning) {
+                __ring.poll();
+            }
+            else {
+                if (spin_us) {
+                    meter.blocking();
+                }
+                __ring.submit(1);
+            }
+            batch.clear();
+            if (not __stash.empty()) {
+                batch.swap(__stash);
+            }
+            __ring.reap(batch);
+            __reaped = steady_us();
+            __completions.fetch_add(batch.size(), boost::memory_order_relaxed);
+            for (auto& cqe : batch) {
+                dispatch(cqe);
+            }
+            if (spinning) {
+                const uint64_t end = batch.empty() ? __reaped : steady_us();
+                meter.polled(begin, end, batch.size());
+                spinning = meter.spinning(end);
+            }
+            else if (spin_us) {
+                meter.woken(__reaped);
+                spinning = true;
+            }
+        }
+        current() = nullptr;
+    }
+
+    void stop(void)
+    {
+        __stopping.store(true);
+        wake();
+    }
+
+    // hands a finished offloaded or deferred handler back to the ring thread, any thread
+    void complete(const connection_ptr& c)
+    {
+        {
+            boost::mutex::scoped_lock lock(__done_mutex);
+            __done.push_back(c);
+        }
+        wake();
+    }
+
+    // open, read and close of a whole file as one linked chain through this ring, the other
+    // completions reaped while waiting are kept for the event loop
+    bool read_file(const string& filename, const size_t size, string& out)
+    {
+        if (not __files) {
+            return false;
+        }
+        out.resize(size);
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(filename.c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->file_index = SLOT_FILE + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = TAG_FILE;
+
+        sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = SLOT_FILE;
+        sqe->addr = reinterpret_cast<uint64_t>(&out[0]);
+        sqe->len = size;
+        sqe->off = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->user_data = TAG_FILE;
+
+        sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = SLOT_FILE + 1;
+        sqe->user_data = TAG_FILE;
+
+        int results[3];
+        wait_file(results, 3);
+        return results[0] >= 0 and results[1] == static_cast<int>(size);
+    }
+
+    // a file opened already, e.g. kept by file_cache, is one read
+    bool read_file(const int fd, const size_t size, string& out)
+    {
+        out.resize(size);
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&out[0]);
+        sqe->len = size;
+        sqe->off = 0;
+        sqe->user_data = TAG_FILE;
+
+        int result;
+        wait_file(&result, 1);
+        return result == static_cast<int>(size);
+    }
+
+    uring_stats stats(void) const
+    {
+        uring_stats s;
+        s.enters = __ring.__enters.load(boost::memory_order_relaxed);
+        s.completions = __completions.load(boost::memory_order_relaxed);
+        s.accepted = __accepted.load(boost::memory_order_relaxed);
+        s.requests = __requests.load(boost::memory_order_relaxed);
+        s.nobufs = __nobufs.load(boost::memory_order_relaxed);
+        return s;
+    }
+
+protected:
+    void wait_file(int* results, const size_t count)
+    {
+        size_t got = 0;
+        std::vector<io_uring_cqe> batch;
+        while (got < count) {
+            __ring.submit(1);
+            batch.clear();
+            __ring.reap(batch);
+            for (auto& cqe : batch) {
+                if (cqe.user_data == TAG_FILE and got < count) {
+                    results[got++] = cqe.res;
+                }
+                else {
+                    __stash.push_back(cqe);
+                }
+            }
+        }
+    }
+
+    void setup_buffers(void)
+    {
+        if (__opts.buffers & (__opts.buffers - 1)) {
+            throw std::runtime_error("uring_options::buffers must be a power of two!");
+        }
+        __br_size = __opts.buffers * sizeof(io_uring_buf);
+        __br = mmap(0, __br_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (__br == MAP_FAILED) {
+            throw std::runtime_error("mmap of buffer ring failed!");
+        }
+        __pool.resize(__opts.buffers * __opts.buffer_size);
+        __br_tail = 0;
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(__br);
+        reg.ring_entries = __opts.buffers;
+        reg.bgid = 0;
+        int ret = __ring.enroll(IORING_REGISTER_PBUF_RING, &reg, 1);
+        if (ret < 0) {
+            munmap(__br, __br_size);
+            throw std::runtime_error(string("register of buffer ring failed: ") + strerror(-ret));
+        }
+        for (unsigned bid = 0; bid < __opts.buffers; ++bid) {
+            recycle(bid);
+        }
+    }
+
+    // sparse table, slot 0 is the listening socket, 1 is for read_file(), the rest is allocated
+    // by the kernel to connections. without it everything works on plain descriptors
+    void setup_files(void)
+    {
+        if (__opts.files <= SLOT_FIRST) {
+            return;
+        }
+        io_uring_rsrc_register reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.nr = __opts.files;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (__ring.enroll(IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0) {
+            return;
+        }
+        io_uring_file_index_range range;
+        memset(&range, 0, sizeof(range));
+        range.off = SLOT_FIRST;
+        range.len = __opts.files - SLOT_FIRST;
+        io_uring_files_update update;
+        memset(&update, 0, sizeof(update));
+        update.offset = SLOT_LISTEN;
+        update.fds = reinterpret_cast<uint64_t>(&__listen_fd);
+        if (__ring.enroll(IORING_REGISTER_FILE_ALLOC_RANGE, &range, 0) < 0 or
+            __ring.enroll(IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+            __ring.enroll(IORING_UNREGISTER_FILES, nullptr, 0);
+            return;
+        }
+        __files = true;
+    }
+
+    inline char* buffer(const unsigned bid)
+    {
+        return &__pool[static_cast<size_t>(bid) * __opts.buffer_size];
+    }
+
+    // give a buffer back to the kernel, the tail overlays the reserved field of entry 0
+    void recycle(const unsigned bid)
+    {
+        auto bufs = static_cast<io_uring_buf*>(__br);
+        io_uring_buf& b = bufs[__br_tail & (__opts.buffers - 1)];
+        b.addr = reinterpret_cast<uint64_t>(buffer(bid));
+        b.len = __opts.buffer_size;
+        b.bid = bid;
+        ++__br_tail;
+        __atomic_store_n(&static_cast<io_uring_buf_ring*>(__br)->tail, __br_tail, __ATOMIC_RELEASE);
+    }
+
+    void wake(void)
+    {
+        uint64_t one = 1;
+        if (::write(__wakefd, &one, sizeof(one)) < 0) {
+            ; //counter is saturated, the loop is awake anyway
+        }
+    }
+
+    io_uring_sqe* prep(connection& c, const int opcode, const unsigned tag)
+    {
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = opcode;
+        if (c.slot >= 0) {
+            sqe->fd = c.slot;
+            sqe->flags = IOSQE_FIXED_FILE;
+        }
+        else {
+            sqe->fd = c.fd;
+        }
+        sqe->user_data = reinterpret_cast<uint64_t>(&c) | tag;
+        ++c.ops;
+        return sqe;
+    }
+
+    // with a connection limit every ring keeps one single shot accept that holds a connection
+    // slot, like the pending accept of the asio backend, so the rings together stay at the limit
+    void arm_accept(void)
+    {
+        const bool limited = __server.__admission.max_connections > 0;
+        if (limited) {
+            if (not __server.reserve_connection()) {
+                __accept_paused = true;
+                return;
+            }
+            __accept_reserved = true;
+        }
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        if (__files) {
+            sqe->fd = SLOT_LISTEN;
+            sqe->flags = IOSQE_FIXED_FILE;
+        }
+        else {
+            sqe->fd = __listen_fd;
+        }
+        sqe->accept_flags = SOCK_CLOEXEC;
+        if (__multishot_accept and not limited) {
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        }
+        sqe->user_data = TAG_ACCEPT;
+    }
+
+    void arm_wake(void)
+    {
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = __wakefd;
+        sqe->addr = reinterpret_cast<uint64_t>(&__wakebuf);
+        sqe->len = sizeof(__wakebuf);
+        sqe->user_data = TAG_WAKE;
+    }
+
+    void arm_tick(void)
+    {
+        io_uring_sqe* sqe = __ring.get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&__tick);
+        sqe->len = 1;
+        sqe->user_data = TAG_TICK;
+    }
+
+    void arm_recv(connection& c)
+    {
+        io_uring_sqe* sqe = prep(c, IORING_OP_RECV, TAG_RECV);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        if (__multishot_recv) {
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+        }
+    }
+
+    void dispatch(const io_uring_cqe& cqe)
+    {
+        const unsigned tag = cqe.user_data & 7;
+        auto c = reinterpret_cast<connection*>(cqe.user_data & ~static_cast<uint64_t>(7));
+        if (not c) {
+            switch (tag) {
+            case TAG_ACCEPT: on_accept(cqe); break;
+            case TAG_WAKE:   on_wake(); break;
+            case TAG_TICK:   on_tick(); break;
+            default: break;
+            }
+            return;
+        }
+        if (not (cqe.flags & IORING_CQE_F_MORE)) {
+            --c->ops;
+        }
+        switch (tag) {
+        case TAG_RECV:  on_recv(*c, cqe); break;
+        case TAG_SEND:  on_send(*c, cqe); break;
+        case TAG_SLOT:  on_slot(*c, cqe); break;
+        default: break; //shutdown, close and closing the plain fd need no follow up
+        }
+        finish(*c);
+    }
+
+    void on_accept(const io_uring_cqe& cqe)
+    {
+        // the slot of a reserved accept becomes the connection, or is given back
+        const bool reserved = __accept_reserved;
+        __accept_reserved = false;
+        if (reserved and cqe.res < 0) {
+            __server.__admission_stats.connections.fetch_sub(1);
+        }
+        if (not (cqe.flags & IORING_CQE_F_MORE) and not __stopping.load()) {
+            if (cqe.res == -EINVAL and __multishot_accept) {
+                __multishot_accept = false; //kernel older than 5.19
+            }
+            arm_accept();
+        }
+        if (cqe.res < 0) {
+            return;
+        }
+        if (not reserved) {
+            __server.__admission_stats.connections.fetch_add(1);
+        }
+        __accepted.fetch_add(1, boost::memory_order_relaxed);
+
+        connection_ptr c(new connection(this, cqe.res));
+        c->address = peer_address(cqe.res, c->peer);
+        c->deadline = deadline(__server.__req_timeout);
+        __live.insert(c);
+        if (__files) {
+            io_uring_sqe* sqe = prep(*c, IORING_OP_FILES_UPDATE, TAG_SLOT);
+            sqe->fd = -1;
+            sqe->flags = 0;
+            sqe->addr = reinterpret_cast<uint64_t>(&c->update);
+            sqe->len = 1;
+            sqe->off = IORING_FILE_INDEX_ALLOC;
+        }
+        else {
+            arm_recv(*c);
+        }
+    }
+
+    // the socket got a fixed slot, its plain descriptor is not needed any more
+    void on_slot(connection& c, const io_uring_cqe& cqe)
+    {
+        if (cqe.res == 1) {
+            c.slot = c.update;
+            io_uring_sqe* sqe = __ring.get_sqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = c.fd;
+            sqe->user_data = reinterpret_cast<uint64_t>(&c) | TAG_AUX;
+            ++c.ops;
+            c.fd = -1;
+        }
+        if (not c.closing) {
+            arm_recv(c);
+        }
+    }
+
+    void on_recv(connection& c, const io_uring_cqe& cqe)
+    {
+        const bool more = cqe.flags & IORING_CQE_F_MORE;
+        if (cqe.res > 0) {
+            const unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            c.inbox.append(buffer(bid), cqe.res);
+            recycle(bid);
+            if (not c.closing) {
+                if (not more) {
+                    arm_recv(c);
+                }
+                next_request(c);
+            }
+        }
+        else if (cqe.res == -ENOBUFS) {
+            __nobufs.fetch_add(1, boost::memory_order_relaxed);
+            if (not c.closing and not more) {
+                arm_recv(c);
+            }
+        }
+        else if (cqe.res == -EINVAL and __multishot_recv and not c.closing) {
+            __multishot_recv = false; //kernel older than 6.0
+            arm_recv(c);
+        }
+        else {
+            close(c); //peer closed or error
+        }
+    }
+
+    // cut the next complete request out of the inbox, unless one is still being handled
+    void next_request(connection& c)
+    {
+        while (not c.busy and not c.closing) {
+            if (not c.reading_body) {
+                const size_t end = c.inbox.find("\r\n\r\n");
+                if (end == string::npos) {
+                    const bool idle = c.served and c.inbox.empty();
+                    c.deadline = deadline(idle ? __server.idle_timeout() : __server.__req_timeout);
+                    return;
+                }
+                fresh_request(c);
+                c.trace = __server.__tracer.begin_request();
+                c.trace_start = trace_mark(c);
+                auto& buf = c.request->content_buffer;
+                buf.commit(boost::asio::buffer_copy(buf.prepare(end + 4), boost::asio::buffer(c.inbox, end + 4)));
+                c.inbox.erase(0, end + 4);
+                __server.parse_request(c.request, c.request->content);
+                trace(c, trace_parse, c.trace_start);
+                c.started = __reaped;
+                c.dispatched = 0;
+
+                c.body_size = 0;
+                auto length = c.request->header.find("Content-Length");
+                if (length != c.request->header.end()) {
+                    try {
+                        c.body_size = stod<size_t>(length->second);
+                    }
+                    catch (const std::exception& e) {
+                        close(c);
+                        return;
+                    }
+                }
+                c.reading_body = true;
+            }
+            if (c.inbox.size() < c.body_size) {
+                c.deadline = deadline(__server.__con_timeout);
+                return;
+            }
+            auto& buf = c.request->content_buffer;
+            buf.commit(boost::asio::buffer_copy(buf.prepare(c.body_size), boost::asio::buffer(c.inbox, c.body_size)));
+            c.inbox.erase(0, c.body_size);
+            c.reading_body = false;
+            handle(c);
+        }
+    }
+
+    // requests and buffers are reused unless a handler still holds on to them
+    void fresh_request(connection& c)
+    {
+        if (c.request and c.request.use_count() == 1) {
+            auto& r = *c.request;
+            r.path.clear();
+            r.method.clear();
+            r.version.clear();
+            r.match1.clear();
+            r.match2.clear();
+            r.match3.clear();
+            r.header.clear();
+            r.content.clear();
+            r.content_buffer.consume(r.content_buffer.size());
+        }
+        else {
+            c.request.reset(new _request);
+            connection* raw = &c;
+            c.request->__defer = [raw]() { return raw->defer(); };
+        }
+        if (c.response.use_count() > 1) {
+            c.response.reset(new boost::asio::streambuf);
+        }
+        c.limit = nullptr;
+        c.deferred = false;
+    }
+
+    void handle(connection& c)
+    {
+        http_server_base& s = __server;
+        c.busy = true;
+        __requests.fetch_add(1, boost::memory_order_relaxed);
+
+        // the queue delay here is the time the request waited behind the rest of its batch
+        if (s.__admission.codel_target_us) {
+            const uint64_t now = steady_us();
+            if (not s.__shedder.admit(now - __reaped, now, s.__admission)) {
+                reject(c);
+                return;
+            }
+        }
+
+        c.route = nullptr;
+        c.trace_phase = trace_mark(c);
+        const bool valid = s.valid_request(c.request, c.matched, c.handler, &c.route);
+        trace(c, trace_route, c.trace_phase);
+        c.limit = s.find_route_limit(c.route);
+        if (not s.rate_allowed(c.route, c.peer)) {
+            too_many(c);
+            return;
+        }
+        if (not s.admit_request(c.limit)) {
+            reject(c);
+            return;
+        }
+        c.admitted = true;
+        c.deadline = deadline(s.__con_timeout);
+        c.request->address = c.address;
+        c.request->set_body(c.body_size);
+        if (s.__access) {
+            c.dispatched = steady_us();
+        }
+
+        if (valid) {
+            c.request->match1.assign(c.matched[1]);
+            c.request->match2.assign(c.matched[2]);
+            c.request->match3.assign(c.matched[3]);
+
+            c.trace_phase = trace_mark(c);
+            if (s.__offload and s.is_blocking(c.route, c.request->method)) {
+                offload(c);
+                return;
+            }
+            s.run_handler(c.handler, c.response, c.request);
+            trace(c, trace_handler, c.trace_phase);
+            c.trace_phase = trace_mark(c);
+            if (c.deferred and c.pending.fetch_sub(1) != 1) {
+                c.in_handler = true; //complete() resumes
+                return;
+            }
+        }
+        else {
+            ostream response(c.response.get());
+            response << templates::bad_request;
+        }
+        respond(c);
+    }
+
+    void offload(connection& c)
+    {
+        connection_ptr keep(c.shared_from_this());
+        c.in_handler = true;
+        bool queued = __server.__offload->submit([keep]() {
+            const uint64_t begin = keep->worker->trace_mark(*keep);
+            keep->worker->__server.run_handler(keep->handler, keep->response, keep->request);
+            keep->worker->trace(*keep, trace_handler, begin);
+            if (not keep->deferred or keep->pending.fetch_sub(1) == 1) {
+                keep->worker->complete(keep);
+            }
+        });
+        if (not queued) {
+            c.in_handler = false;
+            release(c);
+            reject(c);
+        }
+    }
+
+    void on_wake(void)
+    {
+        if (not __stopping.load()) {
+            arm_wake();
+        }
+        std::vector<connection_ptr> done;
+        {
+            boost::mutex::scoped_lock lock(__done_mutex);
+            done.swap(__done);
+        }
+        for (auto& c : done) {
+            c->in_handler = false;
+            trace(*c, trace_deferred, c->trace_phase);
+            if (c->closing) {
+                release(*c);
+                finish(*c);
+            }
+            else {
+                respond(*c);
+            }
+        }
+    }
+
+    void on_tick(void)
+    {
+        if (__stopping.load()) {
+            return;
+        }
+        arm_tick();
+        const uint64_t now = steady_us();
+        std::vector<connection*> expired;
+        for (auto& c : __live) {
+            if (c->deadline and now > c->deadline and not c->closing) {
+                expired.push_back(c.get());
+            }
+        }
+        for (auto c : expired) {
+            __server.__loger.commit("connection", "time out!");
+            close(*c);
+            finish(*c);
+        }
+        resume_accept();
+    }
+
+    void reject(connection& c)
+    {
+        __server.__admission_stats.rejected.fetch_add(1, boost::memory_order_relaxed);
+        refuse(c, templates::service_unavailable);
+    }
+
+    void too_many(connection& c)
+    {
+        __server.__admission_stats.limited.fetch_add(1, boost::memory_order_relaxed);
+        refuse(c, templates::too_many_requests);
+    }
+
+    void refuse(connection& c, const string& response)
+    {
+        c.close_after = true;
+        c.trace_phase = trace_mark(c);
+        c.out = response.data();
+        c.out_size = response.size();
+        c.sent = 0;
+        log_access(c);
+        send(c);
+    }
+
+    void respond(connection& c)
+    {
+        c.close_after = not settle_keep_alive(*c.request, *c.response, ++c.served, __server.__keep_alive);
+        c.trace_phase = trace_mark(c);
+        auto data = c.response->data();
+        c.out = boost::asio::buffer_cast<const char*>(data);
+        c.out_size = boost::asio::buffer_size(data);
+        c.sent = 0;
+        log_access(c);
+        send(c);
+    }
+
+    // trace_clock() if the request of `c` is traced, 0 otherwise
+    inline uint64_t trace_mark(const connection& c) const
+    {
+        return c.trace ? trace_clock() : 0;
+    }
+
+    // a span of the request of `c` from `begin` to now
+    inline void trace(const connection& c, const TRACE_PHASE phase, const uint64_t begin)
+    {
+        if (c.trace) {
+            __server.__tracer.span(c.trace, phase, begin, trace_clock(), c.route);
+        }
+    }
+
+    inline void log_access(const connection& c)
+    {
+        if (__server.__access) {
+            const uint64_t now = steady_us();
+            __server.__access->commit(c.peer, c.request->method, c.request->path,
+                                      response_status(c.out, c.out_size), c.out_size,
+                                      now - c.started, c.dispatched ? now - c.dispatched : 0);
+        }
+    }
+
+    // a response that ends the connection takes the shutdown with it in one linked submission
+    void send(connection& c)
+    {
+        io_uring_sqe* sqe = prep(c, IORING_OP_SEND, TAG_SEND);
+        sqe->addr = reinterpret_cast<uint64_t>(c.out + c.sent);
+        sqe->len = c.out_size - c.sent;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (c.close_after) {
+            sqe->flags |= IOSQE_IO_LINK;
+            sqe = prep(c, IORING_OP_SHUTDOWN, TAG_SHUT);
+            sqe->len = SHUT_RDWR;
+        }
+    }
+
+    void on_send(connection& c, const io_uring_cqe& cqe)
+    {
+        if (cqe.res < 0) {
+            release(c);
+            close(c);
+            return;
+        }
+        c.sent += cqe.res;
+        if (c.sent < c.out_size and not c.closing) {
+            send(c); //short send broke the link, the shutdown is queued again with the rest
+            return;
+        }
+        release(c);
+        trace(c, trace_write, c.trace_phase);
+        trace(c, trace_request, c.trace_start);
+        c.trace = 0;
+        c.response->consume(c.response->size());
+        c.busy = false;
+        if (c.close_after) {
+            c.closing = true; //the linked shutdown ends the recv
+            return;
+        }
+        next_request(c);
+    }
+
+    inline void release(connection& c)
+    {
+        if (c.admitted) {
+            __server.release_request(c.limit);
+            c.admitted = false;
+        }
+    }
+
+    void close(connection& c)
+    {
+        if (c.closing) {
+            return;
+        }
+        c.closing = true;
+        io_uring_sqe* sqe = prep(c, IORING_OP_SHUTDOWN, TAG_SHUT);
+        sqe->len = SHUT_RDWR;
+    }
+
+    // when the last operation of a closing connection completed the descriptor is closed, and
+    // when that completed the connection is gone
+    void finish(connection& c)
+    {
+        if (not c.closing or c.ops > 0) {
+            return;
+        }
+        if (not c.closed) {
+            c.closed = true;
+            io_uring_sqe* sqe = __ring.get_sqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            if (c.slot >= 0) {
+                sqe->file_index = c.slot + 1;
+            }
+            else {
+                sqe->fd = c.fd;
+            }
+            sqe->user_data = reinterpret_cast<uint64_t>(&c) | TAG_CLOSE;
+            ++c.ops;
+            c.fd = -1;
+            return;
+        }
+        if (not c.in_handler) {
+            release(c);
+        }
+        // a pending handler may still own it, and finishes it again when it is done
+        if (__live.erase(c.shared_from_this())) {
+            __server.__admission_stats.connections.fetch_sub(1);
+            resume_accept();
+        }
+    }
+
+    void resume_accept(void)
+    {
+        if (__accept_paused and not __stopping.load()) {
+            __accept_paused = false;
+            __server.resume_paused(); //the count reserve_connection() left on the server
+            arm_accept();
+        }
+    }
+
+    static inline uint64_t deadline(const size_t seconds)
+    {
+        return seconds ? steady_us() + seconds * 1000000 : 0;
+    }
+
+    static string peer_address(const int fd, ip_key& key)
+    {
+        sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        if (getpeername(fd, reinterpret_cast<sockaddr*>(&ss), &len) != 0) {
+            return string();
+        }
+        key = make_ip_key(ss);
+        char text[INET6_ADDRSTRLEN] = {0};
+        if (ss.ss_family == AF_INET) {
+            inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&ss)->sin_addr, text, sizeof(text));
+        }
+        else {
+            inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&ss)->sin6_addr, text, sizeof(text));
+        }
+        return text;
+    }
+
+    http_server_base& __server;
+    uring_options __opts;
+    io_ring  __ring;
+    int      __listen_fd;
+    bool     __files;
+    bool     __multishot_accept;
+    bool     __multishot_recv;
+    bool     __accept_paused;
+    bool     __accept_reserved;
+    boost::atomic<bool> __stopping;
+
+    void*    __br;          // provided buffer ring
+    size_t   __br_size;
+    uint16_t __br_tail;
+    std::vector<char> __pool;
+
+    int      __wakefd;
+    uint64_t __wakebuf;
+    __kernel_timespec __tick;
+    uint64_t __reaped;      // when the current batch was reaped
+
+    boost::unordered_set<connection_ptr> __live;
+    std::vector<io_uring_cqe> __stash;
+    boost::mutex __done_mutex;
+    std::vector<connection_ptr> __done;
+
+    boost::atomic<size_t> __completions;
+    boost::atomic<size_t> __accepted;
+    boost::atomic<size_t> __requests;
+    boost::atomic<size_t> __nobufs;
+};
+
+
+// the rings of one server, one thread each. rings are created on their own thread since they
+// are set up single issuer
+struct uring_backend: public boost::noncopyable
+{
+    uring_backend(http_server_base& server, const uring_options& opts):
+        __server(server), __opts(opts), __stopping(false)
+    {
+    }
+
+    ~uring_backend(void)
+    {
+        stop();
+    }
+
+    // true if this kernel can run a ring with these options
+    static bool supported(http_server_base& server, const uring_options& opts)
+    {
+        try {
+            // without the listener: a ring drops its files only some time after it is closed,
+            // and the listener may have to be bound again (affinity_options::incoming_cpu)
+            uring_worker probe(server, opts, -1);
+        }
+        catch (const std::exception& e) {
+            server.__loger.commit(__func__, e.what(), "ERROR");
+            return false;
+        }
+        return true;
+    }
+
+    void start(const size_t num_threads)
+    {
+        const size_t n = max<size_t>(num_threads, 1);
+        const std::vector<int> plan = plan_affinity(__server.__affinity, n);
+        steer(plan);
+        for (size_t i = 0; i < n; ++i) {
+            const int listen_fd = __listeners.empty() ? __server.__acceptor.native_handle() : __listeners[i];
+            const int cpu = plan[i];
+            __threads.emplace_back([this, listen_fd, cpu]() {
+                pin_thread(cpu); //before the ring and its buffers are allocated
+                boost::shared_ptr<uring_worker> worker;
+                try {
+                    worker.reset(new uring_worker(__server, __opts, listen_fd));
+                }
+                catch (const std::exception& e) {
+                    __server.__loger.commit("uring_backend", e.what(), "ERROR");
+                    return;
+                }
+                {
+                    boost::mutex::scoped_lock lock(__mutex);
+                    if (__stopping) {
+                        return;
+                    }
+                    __workers.push_back(worker);
+                }
+                worker->run();
+            });
+        }
+    }
+
+    void stop(void)
+    {
+        {
+            boost::mutex::scoped_lock lock(__mutex);
+            __stopping = true;
+            for (auto& w : __workers) {
+                w->stop();
+            }
+        }
+        for (auto& t : __threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+        __workers.clear();
+        for (const int fd : __listeners) {
+            ::close(fd);
+        }
+        __listeners.clear();
+    }
+
+    uring_stats stats(void)
+    {
+        uring_stats total;
+        boost::mutex::scoped_lock lock(__mutex);
+        for (auto& w : __workers) {
+            uring_stats s = w->stats();
+            total.enters += s.enters;
+            total.completions += s.completions;
+            total.accepted += s.accepted;
+            total.requests += s.requests;
+            total.nobufs += s.nobufs;
+        }
+        return total;
+    }
+
+protected:
+    // affinity_options::incoming_cpu with every ring pinned: the shared listener is replaced by
+    // one SO_REUSEPORT listener per ring. it was bound without SO_REUSEPORT, so it is closed
+    // first, and opened again should a listener of the group fail
+    void steer(const std::vector<int>& plan)
+    {
+        if (not __server.__affinity.incoming_cpu or std::find(plan.begin(), plan.end(), -1) != plan.end()) {
+            return;
+        }
+        auto& acceptor = __server.__acceptor;
+        error_code ec;
+        const asio_endpoint endpoint = acceptor.local_endpoint(ec);
+        if (ec) {
+            return;
+        }
+        acceptor.close(ec);
+        try {
+            for (const int cpu : plan) {
+                __listeners.push_back(open_steered_listener(endpoint, __server.__listener, cpu));
+            }
+        }
+        catch (const std::exception& e) {
+            __server.__loger.commit("uring_backend", e.what(), "ERROR");
+            for (const int fd : __listeners) {
+                ::close(fd);
+            }
+            __listeners.clear();
+            try {
+                acceptor.open(endpoint.protocol());
+                acceptor.set_option(asio_acceptor::reuse_address(true));
+                acceptor.bind(endpoint);
+                acceptor.listen();
+                apply_listener_options(acceptor, __server.__listener);
+            }
+            catch (const std::exception& e) {
+                __server.__loger.commit("uring_backend", e.what(), "ERROR");
+            }
+        }
+    }
+
+public:
+    http_server_base& __server;
+    uring_options __opts;
+    bool __stopping;
+    boost::mutex __mutex;
+    std::vector<boost::shared_ptr<uring_worker>> __workers;
+    std::vector<boost::thread> __threads;
+    std::vector<int> __listeners;   // steered listeners, one per ring, empty when shared
+};
+
+
+// drop in for mmap_reader: on a ring thread the file is read through that ring, anywhere else
+// (asio backend, offload pool) it is mapped as before
+struct ring_reader
+{
+    ring_reader(void) = delete;
+    ring_reader(const string& filename):__mmap(filename), __fn(filename), __done(false)
+    {
+    }
+
+    // a file of file_cache, read without a lookup of its name
+    ring_reader(const file_handle_ptr& file):__mmap(file->fd, file->size), __file(file), __done(false)
+    {
+    }
+
+    size_t size(void)
+    {
+        return __mmap.size();
+    }
+
+    const byte* read(void)
+    {
+        auto worker = uring_worker::current();
+        if (not worker or (not __file and not file_check(__fn))) {
+            return __mmap.read();
+        }
+        if (not __done) {
+            __done = __file ? worker->read_file(__file->fd, size(), __data) : worker->read_file(__fn, size(), __data);
+            if (not __done) {
+                return __mmap.read();
+            }
+        }
+        return __data.data();
+    }
+
+    mmap_reader __mmap;
+    string __fn;
+    file_handle_ptr __file;
+    string __data;
+    bool   __done;
+};
+
+
+// keep-alive GETs from `connections` threads against a running server, returns requests/sec.
+// with strace -fc on the server (or server<asio_http>::io_stats) it gives syscalls per request
+inline double bench_http_requests(const string& host, const size_t port, const size_t connections,
+                                  const size_t requests, const string& path = "/")
+{
+    const string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    asio_endpoint endpoint(ip_address::from_string(host), port);
+    boost::atomic<size_t> completed(0);
+
+    auto start = boost::posix_time::microsec_clock::universal_time();
+    std::vector<boost::thread> clients;
+    for (size_t i = 0; i < connections; ++i) {
+        clients.emplace_back([&]() {
+            asio_service io_service;
+            asio_socket socket(io_service);
+            error_code ec;
+            socket.connect(endpoint, ec);
+            boost::asio::streambuf response;
+            for (size_t n = 0; n < requests and not ec; ++n) {
+                boost::asio::write(socket, boost::asio::buffer(request), ec);
+                const size_t head = boost::asio::read_until(socket, response, "\r\n\r\n", ec);
+                if (ec) {
+                    break;
+                }
+                string text(boost::asio::buffer_cast<const char*>(response.data()), head);
+                response.consume(head);
+                size_t length = 0;
+                auto pos = text.find("Content-Length: ");
+                if (pos != string::npos) {
+                    length = strtoul(text.c_str() + pos + 16, nullptr, 10);
+                }
+                if (response.size() < length) {
+                    boost::asio::read(socket, response, boost::asio::transfer_exactly(length - response.size()), ec);
+                }
+                response.consume(length);
+                completed.fetch_add(1, boost::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    auto elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    return completed.load() * 1e6 / max<double>(elapsed.total_microseconds(), 1);
+}
+
+
+}//basiohttp
+
+
+#endif//URING_HTTP_HPP
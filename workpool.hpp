@@ -0,0 +1,202 @@
+/**
+ * file   : workpool.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * work stealing thread pool for blocking handlers, keeps io threads free of blocking work
+ */
+#pragma once
+#ifndef WORK_POOL_HTTP_HPP
+#define WORK_POOL_HTTP_HPP
+#include <deque>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+struct work_pool_stats
+{
+    boost::atomic<size_t> queued;     // submitted but not started
+    boost::atomic<size_t> max_depth;  // high water mark of queued
+    boost::atomic<size_t> executed;
+    boost::atomic<size_t> stolen;     // run by a worker other than the one it was queued to
+    boost::atomic<size_t> rejected;   // queue was full, or the pool stopping
+
+    work_pool_stats(void):queued(0), max_depth(0), executed(0), stolen(0), rejected(0)
+    {
+    }
+};
+
+
+// every worker owns a deque, submit() spreads tasks round robin, a worker takes from the front
+// of its own deque and an idle one steals from the back of the others.
+struct work_pool: public boost::noncopyable
+{
+    typedef boost::function<void(void)> task_type;
+
+    work_pool(const size_t num_workers, const size_t max_queued):
+        __queues(max<size_t>(num_workers, 1)),
+        __max_queued(max_queued),
+        __next(0),
+        __sleeping(0),
+        __stopping(false)
+    {
+        for (size_t i = 0; i < __queues.size(); ++i) {
+            __queues[i].reset(new worker_queue);
+        }
+        for (size_t i = 0; i < __queues.size(); ++i) {
+            __workers.emplace_back([this, i]() { this->run(i); });
+        }
+    }
+
+    ~work_pool(void)
+    {
+        stop();
+    }
+
+    // false if max_queued tasks are waiting already or stop() was called, the task is not run then
+    bool submit(task_type task)
+    {
+        size_t depth = 0;
+        {
+            // stop() sets the flag under this lock: a task counted here keeps the workers
+            // running until it is taken, any later one is refused
+            boost::mutex::scoped_lock lock(__idle_mutex);
+            if (__stopping.load()) {
+                __stats.rejected.fetch_add(1, boost::memory_order_relaxed);
+                return false;
+            }
+            depth = __stats.queued.fetch_add(1) + 1;
+        }
+        if (__max_queued and depth > __max_queued) {
+            __stats.queued.fetch_sub(1);
+            __stats.rejected.fetch_add(1, boost::memory_order_relaxed);
+            return false;
+        }
+        size_t high = __stats.max_depth.load(boost::memory_order_relaxed);
+        while (depth > high and not __stats.max_depth.compare_exchange_weak(high, depth)) {
+            ;
+        }
+
+        auto& q = *__queues[__next.fetch_add(1, boost::memory_order_relaxed) % __queues.size()];
+        {
+            boost::mutex::scoped_lock lock(q.mutex);
+            q.tasks.push_back(task);
+        }
+        if (__sleeping.load()) {
+            boost::mutex::scoped_lock lock(__idle_mutex);
+            __idle.notify_one();
+        }
+        return true;
+    }
+
+    // runs what is queued already, then joins the workers
+    void stop(void)
+    {
+        {
+            boost::mutex::scoped_lock lock(__idle_mutex);
+            __stopping.store(true);
+            __idle.notify_all();
+        }
+        for (auto& t : __workers) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+    }
+
+    const work_pool_stats& stats(void) const
+    {
+        return __stats;
+    }
+
+    inline size_t size(void) const
+    {
+        return __queues.size();
+    }
+
+protected:
+    struct worker_queue
+    {
+        boost::mutex mutex;
+        std::deque<task_type> tasks;
+    };
+
+    bool take(const size_t self, task_type& task)
+    {
+        {
+            auto& own = *__queues[self];
+            boost::mutex::scoped_lock lock(own.mutex);
+            if (not own.tasks.empty()) {
+                task.swap(own.tasks.front());
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < __queues.size(); ++k) {
+            auto& victim = *__queues[(self + k) % __queues.size()];
+            boost::mutex::scoped_lock lock(victim.mutex, boost::try_to_lock);
+            if (lock.owns_lock() and not victim.tasks.empty()) {
+                task.swap(victim.tasks.back());
+                victim.tasks.pop_back();
+                __stats.stolen.fetch_add(1, boost::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(const size_t self)
+    {
+        task_type task;
+        for (;;) {
+            if (take(self, task)) {
+                __stats.queued.fetch_sub(1);
+                try {
+                    task();
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "work_pool: " << e.what() << "\n";
+                }
+                task.clear();
+                __stats.executed.fetch_add(1, boost::memory_order_relaxed);
+                continue;
+            }
+            boost::mutex::scoped_lock lock(__idle_mutex);
+            if (__stopping.load() and __stats.queued.load() == 0) {
+                return;
+            }
+            __sleeping.fetch_add(1);
+            // the timeout is only a safety net, submit() notifies whenever someone sleeps
+            __idle.timed_wait(lock, boost::posix_time::milliseconds(100), [this]() {
+                return __stopping.load() or __stats.queued.load() > 0;
+            });
+            __sleeping.fetch_sub(1);
+        }
+    }
+
+    std::vector<boost::shared_ptr<worker_queue>> __queues;
+    std::vector<boost::thread> __workers;
+    size_t __max_queued;
+
+    boost::atomic<size_t> __next;
+    boost::atomic<size_t> __sleeping;
+    boost::atomic<bool>   __stopping;
+    boost::mutex __idle_mutex;
+    boost::condition_variable __idle;
+
+    work_pool_stats __stats;
+};
+
+typedef boost::shared_ptr<work_pool> work_pool_ptr;
+
+}//basiohttp
+
+
+#endif//WORK_POOL_HTTP_HPP
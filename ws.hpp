@@ -0,0 +1,693 @@
+/**
+ * file   : ws.hpp
+ * author : cypro666
+ * date   : 2026.10.19
+ * websocket (rfc 6455) connections for server_base: frames parsed in the read buffer, payloads
+ * unmasked with simd, pre-encoded refcounted frames for broadcast
+ */
+#pragma once
+#ifndef WEBSOCKET_HTTP_HPP
+#define WEBSOCKET_HTTP_HPP
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/algorithm/string.hpp>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "utils.hpp"
+#include "typedefs.hpp"
+
+namespace basiohttp
+{
+
+enum WS_OPCODE
+{
+    ws_continuation = 0x0,
+    ws_text         = 0x1,
+    ws_binary       = 0x2,
+    ws_close        = 0x8,
+    ws_ping         = 0x9,
+    ws_pong         = 0xa
+};
+
+enum WS_CLOSE_CODE
+{
+    ws_normal          = 1000,
+    ws_going_away      = 1001,
+    ws_protocol_error  = 1002,
+    ws_no_status       = 1005,
+    ws_abnormal        = 1006,
+    ws_invalid_data    = 1007,
+    ws_policy          = 1008,
+    ws_too_big         = 1009
+};
+
+struct websocket_options
+{
+    size_t max_message;     // bytes of one (reassembled) message, larger ones close with 1009
+    size_t max_queued;      // frames waiting to be written, a slower client is dropped
+    size_t close_timeout;   // seconds to wait for the close reply of the client
+
+    websocket_options(void):
+        max_message(1 << 20),
+        max_queued(4096),
+        close_timeout(5)
+    {
+    }
+};
+
+
+// xor with the 4 byte key, `data` starts at a multiple of 4 of the payload
+inline void ws_unmask(char* data, const size_t size, const uint8_t key[4])
+{
+    uint8_t* p = reinterpret_cast<uint8_t*>(data);
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i mask256 = _mm256_set1_epi32(static_cast<int>(key32));
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), _mm256_xor_si256(v, mask256));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i mask128 = _mm_set1_epi32(static_cast<int>(key32));
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_xor_si128(v, mask128));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(p + i, veorq_u8(vld1q_u8(p + i), mask128));
+    }
+#endif
+    const uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        v ^= key64;
+        memcpy(p + i, &v, 8);
+    }
+    for (; i < size; ++i) {
+        p[i] ^= key[i & 3];
+    }
+}
+
+
+// utf-8 of a text message as rfc 3629 has it, i.e. no overlong forms, surrogates or code points
+// past U+10FFFF. fed a fragment at a time, a sequence may span fragments, a bad byte fails at once
+struct ws_utf8_validator
+{
+    ws_utf8_validator(void):__needed(0), __lower(0x80), __upper(0xbf)
+    {
+    }
+
+    bool feed(const char* data, const size_t size)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        size_t i = 0;
+        while (i < size) {
+            if (__needed == 0) {
+                // ascii 8 bytes at a time
+                uint64_t v;
+                for (; i + 8 <= size; i += 8) {
+                    memcpy(&v, p + i, 8);
+                    if (v & 0x8080808080808080ull) {
+                        break;
+                    }
+                }
+                if (i == size) {
+                    break;
+                }
+                const uint8_t b = p[i++];
+                if (b < 0x80) {
+                    continue;
+                }
+                __lower = 0x80;
+                __upper = 0xbf;
+                if (b >= 0xc2 and b <= 0xdf) {
+                    __needed = 1;
+                }
+                else if (b >= 0xe0 and b <= 0xef) {
+                    __needed = 2;
+                    __lower = b == 0xe0 ? 0xa0 : 0x80;
+                    __upper = b == 0xed ? 0x9f : 0xbf;
+                }
+                else if (b >= 0xf0 and b <= 0xf4) {
+                    __needed = 3;
+                    __lower = b == 0xf0 ? 0x90 : 0x80;
+                    __upper = b == 0xf4 ? 0x8f : 0xbf;
+                }
+                else {
+                    return false;
+                }
+                continue;
+            }
+            const uint8_t b = p[i++];
+            if (b < __lower or b > __upper) {
+                return false;
+            }
+            __lower = 0x80;
+            __upper = 0xbf;
+            --__needed;
+        }
+        return true;
+    }
+
+    // the message ended, a sequence cut short fails, ready for the next one either way
+    bool finish(void)
+    {
+        const bool whole = __needed == 0;
+        __needed = 0;
+        return whole;
+    }
+
+    unsigned __needed;      // continuation bytes still to come
+    uint8_t  __lower;       // range of the next one
+    uint8_t  __upper;
+};
+
+
+typedef boost::shared_ptr<const string> ws_frame_ptr;   // encoded once, written to any number of connections
+
+// an unmasked (server to client) frame
+inline ws_frame_ptr ws_encode_frame(const WS_OPCODE opcode, const char* data, const size_t size, const bool fin = true)
+{
+    boost::shared_ptr<string> frame(new string);
+    frame->reserve(size + 10);
+    frame->push_back(static_cast<char>((fin ? 0x80 : 0) | opcode));
+    if (size < 126) {
+        frame->push_back(static_cast<char>(size));
+    }
+    else if (size < 65536) {
+        frame->push_back(126);
+        frame->push_back(static_cast<char>(size >> 8));
+        frame->push_back(static_cast<char>(size));
+    }
+    else {
+        frame->push_back(127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame->push_back(static_cast<char>(static_cast<uint64_t>(size) >> shift));
+        }
+    }
+    frame->append(data, size);
+    return frame;
+}
+
+inline ws_frame_ptr ws_encode_frame(const WS_OPCODE opcode, const string& data)
+{
+    return ws_encode_frame(opcode, data.data(), data.size());
+}
+
+// Sec-WebSocket-Accept for the Sec-WebSocket-Key of a client
+inline string ws_accept_key(const string& key)
+{
+    static const string guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    const string input = key + guid;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+    char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    const int n = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded), digest, SHA_DIGEST_LENGTH);
+    return string(encoded, n);
+}
+
+// header names are case insensitive, clients do not all send "Sec-WebSocket-Key"
+inline const string* ws_find_header(const _request& r, const char* name)
+{
+    auto found = r.header.find(name);
+    if (found != r.header.end()) {
+        return &found->second;
+    }
+    for (auto& h : r.header) {
+        if (boost::iequals(h.first, name)) {
+            return &h.second;
+        }
+    }
+    return nullptr;
+}
+
+// a GET asking for "Upgrade: websocket" with version 13 and a key
+inline bool ws_upgrade_requested(const _request& r)
+{
+    if (r.method != "GET") {
+        return false;
+    }
+    const string* upgrade = ws_find_header(r, "Upgrade");
+    const string* key = ws_find_header(r, "Sec-WebSocket-Key");
+    const string* version = ws_find_header(r, "Sec-WebSocket-Version");
+    return upgrade and boost::iequals(*upgrade, "websocket") and key and not key->empty() and
+           version and *version == "13";
+}
+
+
+template<typename socket_type> struct websocket;
+
+// handlers of one websocket route. on_message gets the payload in the read buffer, it is only
+// valid during the call. all three run on the strand of the connection
+template<typename socket_type>
+struct websocket_endpoint
+{
+    typedef boost::shared_ptr<websocket<socket_type>> pointer;
+
+    boost::function<void(pointer)> on_open;
+    boost::function<void(pointer, const char*, size_t, WS_OPCODE)> on_message;
+    boost::function<void(pointer, uint16_t)> on_close;
+    websocket_options options;
+};
+
+
+// one upgraded connection, send() and close() may be called from any thread
+template<typename socket_type>
+struct websocket: public boost::enable_shared_from_this<websocket<socket_type>>
+{
+    typedef boost::shared_ptr<socket_type> socket_ptr;
+    typedef boost::shared_ptr<websocket> pointer;
+    typedef websocket_endpoint<socket_type> endpoint_type;
+
+    // writes the 101 response and starts reading frames, bytes the client sent after the
+    // upgrade request are still in request->content_buffer
+    static void start(socket_ptr socket, asio_service& ioservice, const endpoint_type& endpoint, request_ptr request)
+    {
+        pointer ws(new websocket(socket, ioservice, endpoint, request));
+        auto& pending = request->content_buffer;
+        ws->reserve(pending.size());
+        ws->__end = boost::asio::buffer_copy(boost::asio::buffer(ws->__in), pending.data());
+        pending.consume(pending.size());
+
+        const string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                                "Upgrade: websocket\r\n"
+                                "Connection: Upgrade\r\n"
+                                "Sec-WebSocket-Accept: " + ws_accept_key(*ws_find_header(*request, "Sec-WebSocket-Key")) + "\r\n\r\n";
+        ws->__strand.dispatch([ws, response]() {
+            ws->__queue.push_back(ws_frame_ptr(new string(response)));
+            ws->flush();
+            if (ws->__endpoint.on_open) {
+                ws->__endpoint.on_open(ws);
+            }
+            if (ws->parse()) {
+                ws->read();
+            }
+        });
+    }
+
+    websocket(socket_ptr socket, asio_service& ioservice, const endpoint_type& endpoint, request_ptr request):
+        __socket(socket),
+        __strand(ioservice),
+        __timer(ioservice),
+        __endpoint(endpoint),
+        __request(request),
+        __in(16384),
+        __begin(0),
+        __end(0),
+        __message_opcode(ws_continuation),
+        __writing(false),
+        __close_sent(false),
+        __close_received(false),
+        __closed(false),
+        __close_code(ws_abnormal)
+    {
+    }
+
+    // the upgrade request: path, headers, route matches and address
+    inline const request_ptr& request(void) const
+    {
+        return __request;
+    }
+
+    void send(const ws_frame_ptr& frame)
+    {
+        pointer self = this->shared_from_this();
+        __strand.dispatch([self, frame]() { self->enqueue(frame); });
+    }
+
+    void send_text(const string& text)
+    {
+        send(ws_encode_frame(ws_text, text));
+    }
+
+    void send_binary(const char* data, const size_t size)
+    {
+        send(ws_encode_frame(ws_binary, data, size));
+    }
+
+    // starts the closing handshake
+    void close(const uint16_t code = ws_normal)
+    {
+        pointer self = this->shared_from_this();
+        __strand.dispatch([self, code]() { self->send_close(code); });
+    }
+
+protected:
+    void read(void)
+    {
+        if (__in.size() - __end < 4096) {
+            reserve(4096);
+        }
+        pointer self = this->shared_from_this();
+        __socket->async_read_some(boost::asio::buffer(&__in[__end], __in.size() - __end),
+            __strand.wrap([self](const error_code& ec, const size_t nbytes) {
+                if (ec) {
+                    self->finish(self->__close_received ? self->__close_code : static_cast<uint16_t>(ws_abnormal));
+                    return;
+                }
+                self->__end += nbytes;
+                if (self->parse()) {
+                    self->read();
+                }
+            })
+        );
+    }
+
+    // room for `more` bytes after __end, the unparsed bytes move to the front first
+    void reserve(const size_t more)
+    {
+        if (__begin > 0) {
+            memmove(&__in[0], &__in[__begin], __end - __begin);
+            __end -= __begin;
+            __begin = 0;
+        }
+        if (__in.size() - __end < more) {
+            __in.resize(__end + more);
+        }
+    }
+
+    // frames in [__begin, __end) are unmasked in place, false once no more reads are wanted
+    bool parse(void)
+    {
+        const websocket_options& opts = __endpoint.options;
+        while (not __close_received and not __closed) {
+            const size_t avail = __end - __begin;
+            if (avail < 2) {
+                break;
+            }
+            const uint8_t* h = reinterpret_cast<const uint8_t*>(&__in[__begin]);
+            const bool fin = h[0] & 0x80;
+            const uint8_t opcode = h[0] & 0x0f;
+            uint64_t length = h[1] & 0x7f;
+            size_t header = 2;
+            if ((h[0] & 0x70) or not (h[1] & 0x80)) {
+                send_close(ws_protocol_error); //no extensions, client frames must be masked
+                return false;
+            }
+            if (length == 126) {
+                if (avail < 4) {
+                    break;
+                }
+                length = (h[2] << 8) | h[3];
+                header = 4;
+            }
+            else if (length == 127) {
+                if (avail < 10) {
+                    break;
+                }
+                length = 0;
+                for (size_t i = 2; i < 10; ++i) {
+                    length = (length << 8) | h[i];
+                }
+                header = 10;
+            }
+            header += 4;
+            if ((opcode & 0x8) and (not fin or length > 125)) {
+                send_close(ws_protocol_error);
+                return false;
+            }
+            if (length > opts.max_message) {
+                send_close(ws_too_big);
+                return false;
+            }
+            if (avail < header + length) {
+                reserve(header + length - avail);
+                break;
+            }
+            char* payload = &__in[__begin + header];
+            ws_unmask(payload, length, h + header - 4);
+            __begin += header + length;
+            if (not on_frame(fin, static_cast<WS_OPCODE>(opcode), payload, length)) {
+                return false;
+            }
+        }
+        if (__begin == __end) {
+            __begin = __end = 0;
+        }
+        return not __close_received and not __closed;
+    }
+
+    bool on_frame(const bool fin, const WS_OPCODE opcode, const char* payload, const size_t size)
+    {
+        switch (opcode) {
+        case ws_text:
+        case ws_binary:
+            if (__message_opcode != ws_continuation) {
+                send_close(ws_protocol_error);
+                return false;
+            }
+            if (opcode == ws_text and not (__utf8.feed(payload, size) and (not fin or __utf8.finish()))) {
+                send_close(ws_invalid_data);
+                return false;
+            }
+            if (fin) {
+                deliver(opcode, payload, size); //straight from the read buffer
+            }
+            else {
+                __message.assign(payload, size);
+                __message_opcode = opcode;
+            }
+            return true;
+        case ws_continuation:
+            if (__message_opcode == ws_continuation) {
+                send_close(ws_protocol_error);
+                return false;
+            }
+            if (__message.size() + size > __endpoint.options.max_message) {
+                send_close(ws_too_big);
+                return false;
+            }
+            if (__message_opcode == ws_text and not (__utf8.feed(payload, size) and (not fin or __utf8.finish()))) {
+                send_close(ws_invalid_data);
+                return false;
+            }
+            __message.append(payload, size);
+            if (fin) {
+                const WS_OPCODE whole = __message_opcode;
+                __message_opcode = ws_continuation;
+                deliver(whole, __message.data(), __message.size());
+                __message.clear();
+            }
+            return true;
+        case ws_ping:
+            enqueue(ws_encode_frame(ws_pong, payload, size));
+            return true;
+        case ws_pong:
+            return true;
+        case ws_close:
+            __close_received = true;
+            __close_code = size >= 2 ? static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) |
+                                                             static_cast<uint8_t>(payload[1]))
+                                     : static_cast<uint16_t>(ws_no_status);
+            send_close(size >= 2 ? __close_code : static_cast<uint16_t>(ws_normal));
+            flush(); //our close may be out already
+            return false;
+        default:
+            send_close(ws_protocol_error);
+            return false;
+        }
+    }
+
+    void deliver(const WS_OPCODE opcode, const char* data, const size_t size)
+    {
+        if (__endpoint.on_message and not __close_sent) {
+            __endpoint.on_message(this->shared_from_this(), data, size, opcode);
+        }
+    }
+
+    void enqueue(const ws_frame_ptr& frame)
+    {
+        if (__close_sent or __closed) {
+            return;
+        }
+        if (__queue.size() >= __endpoint.options.max_queued) {
+            finish(ws_policy); //slow consumer
+            return;
+        }
+        __queue.push_back(frame);
+        flush();
+    }
+
+    void send_close(const uint16_t code)
+    {
+        if (__close_sent or __closed) {
+            return;
+        }
+        if (not __close_received) {
+            __close_code = code;
+        }
+        const char payload[2] = { static_cast<char>(code >> 8), static_cast<char>(code) };
+        __queue.push_back(ws_encode_frame(ws_close, payload, sizeof(payload)));
+        __close_sent = true;
+        flush();
+    }
+
+    // up to 64 queued frames in one gathered write, the frames themselves are not copied
+    void flush(void)
+    {
+        if (__writing or __closed) {
+            return;
+        }
+        if (__queue.empty()) {
+            if (__close_sent) {
+                closing_written();
+            }
+            return;
+        }
+        __inflight.clear();
+        __buffers.clear();
+        while (not __queue.empty() and __inflight.size() < 64) {
+            __inflight.push_back(__queue.front());
+            __buffers.push_back(boost::asio::buffer(*__queue.front()));
+            __queue.pop_front();
+        }
+        __writing = true;
+        pointer self = this->shared_from_this();
+        boost::asio::async_write(*__socket, __buffers,
+            __strand.wrap([self](const error_code& ec, const size_t) {
+                self->__writing = false;
+                self->__inflight.clear();
+                if (ec) {
+                    self->finish(ws_abnormal);
+                    return;
+                }
+                self->flush();
+            })
+        );
+    }
+
+    // our close frame is out: done if the client closed first, else give it some time to reply
+    void closing_written(void)
+    {
+        if (__close_received) {
+            finish(__close_code);
+            return;
+        }
+        pointer self = this->shared_from_this();
+        __timer.expires_after(std::chrono::seconds(__endpoint.options.close_timeout));
+        __timer.async_wait(__strand.wrap([self](const error_code& ec) {
+            if (not ec) {
+                self->finish(self->__close_code);
+            }
+        }));
+    }
+
+    void finish(const uint16_t code)
+    {
+        if (__closed) {
+            return;
+        }
+        __closed = true;
+        __timer.cancel();
+        error_code ignored;
+        __socket->lowest_layer().shutdown(asio_socket::shutdown_both, ignored);
+        __socket->lowest_layer().close(ignored);
+        __queue.clear();
+        if (__endpoint.on_close) {
+            __endpoint.on_close(this->shared_from_this(), code);
+        }
+    }
+
+    socket_ptr __socket;
+    asio_service::strand __strand;
+    boost::asio::steady_timer __timer;
+    const endpoint_type& __endpoint;    // owned by the server, lives as long as it
+    request_ptr __request;
+
+    std::vector<char> __in;
+    size_t __begin;                     // first byte not parsed yet
+    size_t __end;                       // end of the bytes read
+    string __message;                   // fragments of a message so far
+    WS_OPCODE __message_opcode;
+    ws_utf8_validator __utf8;           // of the text message being received
+
+    std::deque<ws_frame_ptr> __queue;
+    std::vector<ws_frame_ptr> __inflight;
+    std::vector<boost::asio::const_buffer> __buffers;
+    bool __writing;
+    bool __close_sent;
+    bool __close_received;
+    bool __closed;
+    uint16_t __close_code;
+};
+
+
+// connections a message goes to at once. a member that closed is dropped on the next broadcast,
+// so leave() is optional
+template<typename socket_type>
+struct websocket_group
+{
+    typedef boost::shared_ptr<websocket<socket_type>> pointer;
+
+    void join(const pointer& ws)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        __members[ws.get()] = ws;
+    }
+
+    void leave(const pointer& ws)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        __members.erase(ws.get());
+    }
+
+    size_t size(void)
+    {
+        boost::mutex::scoped_lock lock(__mutex);
+        return __members.size();
+    }
+
+    // the same frame object is queued on every member, returns the number of members
+    size_t broadcast(const ws_frame_ptr& frame)
+    {
+        std::vector<pointer> targets;
+        {
+            boost::mutex::scoped_lock lock(__mutex);
+            targets.reserve(__members.size());
+            for (auto it = __members.begin(); it != __members.end(); ) {
+                pointer ws = it->second.lock();
+                if (ws) {
+                    targets.push_back(ws);
+                    ++it;
+                }
+                else {
+                    it = __members.erase(it);
+                }
+            }
+        }
+        for (auto& ws : targets) {
+            ws->send(frame);
+        }
+        return targets.size();
+    }
+
+    size_t broadcast_text(const string& text)
+    {
+        return broadcast(ws_encode_frame(ws_text, text));
+    }
+
+protected:
+    boost::mutex __mutex;
+    std::map<websocket<socket_type>*, boost::weak_ptr<websocket<socket_type>>> __members;
+};
+
+}//basiohttp
+
+
+#endif//WEBSOCKET_HTTP_HPP